@@ -0,0 +1,468 @@
+#include <benchmark/report.hpp>
+#include <benchmark/synthetic.hpp>
+
+#include <canvas/image8.hpp>
+#include <canvas/image16.hpp>
+#include <canvas/image32.hpp>
+
+#include <utility/algorithm.hpp>
+#include <utility/mapped_memory.hpp>
+#include <utility/profiler.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace {
+
+  const size_t CHANNELS = 3;
+
+  const size_t POINTS = 100000;
+
+  // keeps results alive so the compiler cannot drop the measured work
+  volatile double sink;
+
+  template <class image_type>
+  class image_cases {
+
+  public:
+    typedef typename image_type::ptr image_ptr;
+
+    image_cases( const std::string& filename,
+                 const std::string& shifted,
+                 const std::string& output,
+                 const size_t& size )
+      : filename_( filename ), shifted_( shifted ), output_( output ),
+        size_( size )
+    {
+      boost::random::mt19937 generator( 7 );
+      boost::random::uniform_real_distribution<double> position(
+        0.0, static_cast<double>( size - 2 )
+      );
+
+      points_.reserve( POINTS );
+
+      for( size_t n = 0; n < POINTS; ++n ) {
+
+        double x( position( generator ) );
+        double y( position( generator ) );
+        points_.push_back( canvas::image::pixel( x, y ) );
+      }
+    }
+
+    void open()
+    {
+      image_.reset( new image_type( filename_ ) );
+      other_.reset( new image_type( shifted_ ) );
+    }
+
+    void open_loaded()
+    {
+      open();
+      load();
+    }
+
+    void load()
+    {
+      image_->allocate();
+      image_->load();
+    }
+
+    void open_and_load()
+    {
+      image_.reset( new image_type( filename_ ) );
+      load();
+    }
+
+    void load_window()
+    {
+      size_t q( size_ / 4 );
+      image_ptr region( image_->load( q, q, 3 * q, 3 * q ) );
+      sink = region->get_lines();
+    }
+
+    void compute_values()
+    {
+      double total( 0.0 );
+
+      for( size_t n = 0; n < points_.size(); ++n ) {
+
+        total += image_->compute_values( points_[n] )[0];
+      }
+
+      sink = total;
+    }
+
+    void compute_difference()
+    {
+      image_ptr result( image_->compute_difference( *other_ ) );
+      sink = result ? result->get_lines() : 0;
+    }
+
+    // includes the flush done when the written dataset is closed
+    void write()
+    {
+      image_->write( output_ );
+      image_.reset();
+    }
+
+    image_type& get()
+    {
+      return *image_;
+    }
+
+  private:
+    std::string filename_;
+
+    std::string shifted_;
+
+    std::string output_;
+
+    size_t size_;
+
+    std::vector<canvas::image::pixel> points_;
+
+    image_ptr image_;
+
+    image_ptr other_;
+
+  };
+
+  void remove_additive_noise( image_cases<canvas::image8>* cases )
+  {
+    std::vector<boost::uint8_t> noise( CHANNELS, 5 );
+    canvas::image8::ptr result( cases->get().remove_additive_noise( noise ) );
+    sink = result->get_lines();
+  }
+
+  void compute_stats( image_cases<canvas::image32>* cases )
+  {
+    canvas::image32::stats s( cases->get().compute_stats() );
+    sink = s.get<2>().front();
+  }
+
+  void type_cases( benchmark::report&, benchmark::result,
+                   image_cases<canvas::image16>& )
+  {
+  }
+
+  void type_cases( benchmark::report& rep, benchmark::result r,
+                   image_cases<canvas::image8>& cases )
+  {
+    r.name = "remove_additive_noise";
+    rep.run( r, boost::bind( &remove_additive_noise, &cases ),
+                boost::bind( &image_cases<canvas::image8>::open_loaded,
+                             &cases ) );
+  }
+
+  void type_cases( benchmark::report& rep, benchmark::result r,
+                   image_cases<canvas::image32>& cases )
+  {
+    r.name = "compute_stats";
+    rep.run( r, boost::bind( &compute_stats, &cases ),
+                boost::bind( &image_cases<canvas::image32>::open_loaded,
+                             &cases ) );
+  }
+
+  template <class image_type, typename num_type>
+  void run_image( benchmark::report& rep,
+                  const std::string& dir,
+                  GDALDataType type,
+                  const size_t& size,
+                  benchmark::layout l )
+  {
+    typedef image_cases<image_type> cases_type;
+
+    std::string tag( std::string( benchmark::type_name( type ) ) + "_"
+                   + boost::lexical_cast<std::string>( size ) + "_"
+                   + benchmark::layout_name( l ) );
+
+    std::string filename( dir + "/synthetic_" + tag + ".tif" );
+    std::string shifted ( dir + "/shifted_"   + tag + ".tif" );
+    std::string output  ( dir + "/output_"    + tag + ".tif" );
+
+    if( !benchmark::make_geotiff( filename, type, size, CHANNELS, l, 0 ) ||
+        !benchmark::make_geotiff( shifted, type, size, CHANNELS, l,
+                                  size / 4, 43 ) ) {
+
+      return;
+    }
+
+    cases_type cases( filename, shifted, output, size );
+
+    boost::uint64_t pixels( static_cast<boost::uint64_t>( size ) * size );
+
+    benchmark::result r;
+    r.pixel_type = benchmark::type_name( type );
+    r.layout     = benchmark::layout_name( l );
+    r.lines      = size;
+    r.columns    = size;
+    r.channels   = CHANNELS;
+    r.pixels     = pixels;
+    r.bytes      = pixels * CHANNELS * sizeof( num_type );
+
+    r.name = "load";
+    rep.run( r, boost::bind( &cases_type::open_and_load, &cases ) );
+
+    r.name = "write";
+    rep.run( r, boost::bind( &cases_type::write, &cases ),
+                boost::bind( &cases_type::open_loaded, &cases ) );
+
+    type_cases( rep, r, cases );
+
+    benchmark::result w( r );
+    w.name   = "load_window";
+    w.pixels = pixels / 4;
+    w.bytes  = r.bytes / 4;
+    rep.run( w, boost::bind( &cases_type::load_window, &cases ),
+                boost::bind( &cases_type::open, &cases ) );
+
+    benchmark::result d( r );
+    size_t overlap( size - size / 4 );
+    d.name   = "compute_difference";
+    d.pixels = static_cast<boost::uint64_t>( overlap ) * overlap;
+    d.bytes  = 2 * d.pixels * CHANNELS * sizeof( num_type );
+    rep.run( d, boost::bind( &cases_type::compute_difference, &cases ),
+                boost::bind( &cases_type::open, &cases ) );
+
+    benchmark::result v( r );
+    v.name   = "compute_values";
+    v.pixels = POINTS;
+    v.bytes  = POINTS * 4 * CHANNELS * sizeof( num_type );
+    rep.run( v, boost::bind( &cases_type::compute_values, &cases ),
+                boost::bind( &cases_type::open, &cases ) );
+
+    boost::filesystem::remove( filename );
+    boost::filesystem::remove( shifted );
+    boost::filesystem::remove( output );
+  }
+
+  void touch_memory( const boost::uint64_t& count )
+  {
+    utility::mapped_memory<float> m( count );
+    float* ptr( m.get() );
+
+    for( boost::uint64_t n = 0; n < count; ++n ) {
+
+      ptr[n] = static_cast<float>( n & 1023 );
+    }
+
+    sink = std::accumulate( ptr, ptr + count, 0.0 );
+  }
+
+  void run_mapped_memory( benchmark::report& rep )
+  {
+    typedef utility::mapped_memory<float> band;
+
+    boost::uint64_t counts[] = { band::MAX_IN_MEMORY / 2,
+                                 band::MAX_IN_MEMORY,
+                                 band::MAX_IN_MEMORY * 2,
+                                 band::MAX_IN_MEMORY * 8 };
+
+    for( size_t n = 0; n < 4; ++n ) {
+
+      benchmark::result r;
+      r.name       = "mapped_memory";
+      r.pixel_type = "Float32";
+      r.layout     = ( counts[n] > band::MAX_IN_MEMORY ) ? "mapped" : "heap";
+      r.lines      = 1;
+      r.columns    = counts[n];
+      r.channels   = 1;
+      r.pixels     = counts[n];
+      r.bytes      = counts[n] * sizeof( float );
+
+      rep.run( r, boost::bind( &touch_memory, counts[n] ) );
+    }
+  }
+
+  void write_text( const std::string& filename,
+                   const std::vector<double>* data )
+  {
+    utility::algorithm::write( filename, *data, std::ios::fixed, 6 );
+  }
+
+  void load_text( const std::string& filename )
+  {
+    boost::shared_ptr<std::vector<double> > data(
+      utility::algorithm::load<std::vector<double> >( filename )
+    );
+
+    sink = data->size();
+  }
+
+  void write_binary( const std::string& filename,
+                     const std::vector<double>* data )
+  {
+    utility::algorithm::write_binary( filename, *data );
+  }
+
+  void load_binary( const std::string& filename )
+  {
+    boost::shared_ptr<const utility::mapped_memory<double> > data(
+      utility::algorithm::load_binary<double>( filename )
+    );
+
+    sink = std::accumulate( data->begin(), data->end(), 0.0 );
+  }
+
+  void run_algorithm( benchmark::report& rep, const std::string& dir,
+                      const size_t& count )
+  {
+    std::vector<double> data( count );
+
+    boost::random::mt19937 generator( 11 );
+    boost::random::uniform_real_distribution<double> value( -1e4, 1e4 );
+
+    for( size_t n = 0; n < count; ++n ) {
+
+      data[n] = value( generator );
+    }
+
+    std::string text  ( dir + "/values.txt" );
+    std::string binary( dir + "/values.col" );
+
+    benchmark::result r;
+    r.pixel_type = "Float64";
+    r.lines      = 1;
+    r.columns    = count;
+    r.channels   = 1;
+    r.pixels     = count;
+    r.bytes      = count * sizeof( double );
+
+    r.layout = "text";
+
+    r.name = "algorithm_write";
+    rep.run( r, boost::bind( &write_text, text, &data ) );
+
+    r.name = "algorithm_load";
+    rep.run( r, boost::bind( &load_text, text ) );
+
+    r.layout = "binary";
+
+    r.name = "algorithm_write";
+    rep.run( r, boost::bind( &write_binary, binary, &data ) );
+
+    r.name = "algorithm_load";
+    rep.run( r, boost::bind( &load_binary, binary ) );
+
+    boost::filesystem::remove( text );
+    boost::filesystem::remove( binary );
+  }
+
+  void usage( const char* program )
+  {
+    std::cerr << "Usage: " << program << " [--dir DIR] [--repeat N]"
+              << " [--output FILE] [--profile PREFIX] [--quick]" << std::endl;
+  }
+
+}
+
+int main( int argc, char** argv )
+{
+  boost::filesystem::path tmp( boost::filesystem::temp_directory_path() );
+
+  std::string dir( ( tmp / "canvas_benchmark" ).string() );
+  std::string output;
+  std::string profile;
+  size_t repeat( 5 );
+  bool quick( false );
+
+  for( int n = 1; n < argc; ++n ) {
+
+    std::string arg( argv[n] );
+
+    if( ( arg == "--dir" ) && ( n + 1 < argc ) ) {
+
+      dir = argv[++n];
+
+    } else if( ( arg == "--repeat" ) && ( n + 1 < argc ) ) {
+
+      repeat = boost::lexical_cast<size_t>( argv[++n] );
+
+    } else if( ( arg == "--output" ) && ( n + 1 < argc ) ) {
+
+      output = argv[++n];
+
+    } else if( ( arg == "--profile" ) && ( n + 1 < argc ) ) {
+
+      profile = argv[++n];
+
+    } else if( arg == "--quick" ) {
+
+      quick = true;
+
+    } else {
+
+      usage( argv[0] );
+      return 1;
+    }
+  }
+
+  boost::filesystem::create_directories( dir );
+
+  if( !profile.empty() ) {
+
+    utility::profiler::enable();
+  }
+
+  std::vector<size_t> sizes;
+
+  if( quick ) {
+
+    sizes.push_back( 512 );
+
+  } else {
+
+    sizes.push_back( 1024 );
+    sizes.push_back( 4096 );
+  }
+
+  benchmark::report rep( repeat );
+
+  benchmark::layout layouts[] = { benchmark::Striped, benchmark::Tiled };
+
+  for( size_t s = 0; s < sizes.size(); ++s ) {
+
+    for( size_t l = 0; l < 2; ++l ) {
+
+      run_image<canvas::image8, boost::uint8_t>( rep, dir, GDT_Byte,
+                                                 sizes[s], layouts[l] );
+      run_image<canvas::image16, boost::uint16_t>( rep, dir, GDT_UInt16,
+                                                   sizes[s], layouts[l] );
+      run_image<canvas::image32, float>( rep, dir, GDT_Float32,
+                                         sizes[s], layouts[l] );
+    }
+  }
+
+  run_mapped_memory( rep );
+  run_algorithm( rep, dir, quick ? 1000000 : 10000000 );
+
+  if( output.empty() ) {
+
+    rep.write_json( std::cout );
+
+  } else {
+
+    std::ofstream out( output.c_str() );
+    rep.write_json( out );
+  }
+
+  if( !profile.empty() ) {
+
+    std::ofstream counters( ( profile + ".json" ).c_str() );
+    utility::profiler::write_json( counters );
+
+    std::ofstream trace( ( profile + ".trace.json" ).c_str() );
+    utility::profiler::write_trace( trace );
+  }
+
+  return 0;
+}
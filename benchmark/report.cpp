@@ -0,0 +1,133 @@
+#include <benchmark/report.hpp>
+
+#include <gdal_priv.h>
+
+#include <boost/version.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+namespace benchmark {
+
+  namespace {
+
+    std::string quote( const std::string& text )
+    {
+      std::string result( "\"" );
+
+      for( std::string::const_iterator it = text.begin();
+           it != text.end(); ++it ) {
+
+        switch( *it ) {
+
+          case '"'  : result += "\\\""; break;
+          case '\\' : result += "\\\\"; break;
+          case '\n' : result += "\\n";  break;
+          default   : result += *it;
+        }
+      }
+
+      return result + "\"";
+    }
+
+    std::string number( double value )
+    {
+      char buffer[32];
+      snprintf( buffer, sizeof( buffer ), "%.6g", value );
+      return buffer;
+    }
+
+    double median( std::vector<double> values )
+    {
+      std::sort( values.begin(), values.end() );
+      size_t n( values.size() );
+      return ( n % 2 ) ? values[n / 2]
+                       : 0.5 * ( values[n / 2 - 1] + values[n / 2] );
+    }
+
+  }
+
+  report::report( const size_t& repeat ) : repeat_( std::max( repeat,
+                                                              size_t( 1 ) ) )
+  {
+  }
+
+  void report::run( result r,
+                    const boost::function<void()>& task,
+                    const boost::function<void()>& setup )
+  {
+    typedef boost::chrono::steady_clock clock;
+
+    r.seconds.clear();
+
+    for( size_t n = 0; n < repeat_; ++n ) {
+
+      if( setup ) {
+
+        setup();
+      }
+
+      clock::time_point start( clock::now() );
+      task();
+      boost::chrono::duration<double> elapsed( clock::now() - start );
+
+      r.seconds.push_back( elapsed.count() );
+    }
+
+    std::cerr << r.name << " " << r.pixel_type << " " << r.layout << " "
+              << r.lines << "x" << r.columns << "x" << r.channels << ": "
+              << median( r.seconds ) << " s" << std::endl;
+
+    results_.push_back( r );
+  }
+
+  void report::write_json( std::ostream& out ) const
+  {
+    char date[32];
+    time_t now( time( 0 ) );
+    strftime( date, sizeof( date ), "%Y-%m-%dT%H:%M:%SZ", gmtime( &now ) );
+
+    out << "{\n";
+    out << "  \"date\": " << quote( date ) << ",\n";
+    out << "  \"gdal\": " << quote( GDALVersionInfo( "RELEASE_NAME" ) )
+        << ",\n";
+    out << "  \"boost\": " << quote( BOOST_LIB_VERSION ) << ",\n";
+    out << "  \"compiler\": " << quote( __VERSION__ ) << ",\n";
+    out << "  \"repeat\": " << repeat_ << ",\n";
+    out << "  \"results\": [";
+
+    for( size_t n = 0; n < results_.size(); ++n ) {
+
+      const result& r( results_[n] );
+
+      double t( median( r.seconds ) );
+      double best( *std::min_element( r.seconds.begin(), r.seconds.end() ) );
+
+      out << ( n ? ",\n" : "\n" );
+      out << "    { \"name\": " << quote( r.name )
+          << ", \"pixel_type\": " << quote( r.pixel_type )
+          << ", \"layout\": " << quote( r.layout )
+          << ", \"lines\": " << r.lines
+          << ", \"columns\": " << r.columns
+          << ", \"channels\": " << r.channels
+          << ", \"bytes\": " << r.bytes
+          << ", \"pixels\": " << r.pixels
+          << ", \"median_s\": " << number( t )
+          << ", \"min_s\": " << number( best )
+          << ", \"mb_per_s\": " << number( t > 0.0 ? r.bytes / t / 1e6 : 0.0 )
+          << ", \"pixels_per_s\": " << number( t > 0.0 ? r.pixels / t : 0.0 )
+          << ", \"seconds\": [";
+
+      for( size_t k = 0; k < r.seconds.size(); ++k ) {
+
+        out << ( k ? ", " : "" ) << number( r.seconds[k] );
+      }
+
+      out << "] }";
+    }
+
+    out << "\n  ]\n}\n";
+  }
+
+}
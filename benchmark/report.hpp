@@ -0,0 +1,58 @@
+#ifndef BENCHMARK_REPORT_HPP
+#define BENCHMARK_REPORT_HPP
+
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace benchmark {
+
+  struct result {
+
+    std::string name;
+
+    std::string pixel_type;
+
+    std::string layout;
+
+    size_t lines;
+
+    size_t columns;
+
+    size_t channels;
+
+    boost::uint64_t bytes;
+
+    boost::uint64_t pixels;
+
+    std::vector<double> seconds;
+
+  };
+
+  class report {
+
+  public:
+    report( const size_t& repeat );
+
+    // runs setup (untimed) and task (timed) repeat times and records the
+    // wall times under the given description
+    void run( result r,
+              const boost::function<void()>& task,
+              const boost::function<void()>& setup = boost::function<void()>() );
+
+    void write_json( std::ostream& out ) const;
+
+  private:
+    size_t repeat_;
+
+    std::vector<result> results_;
+
+  };
+
+}
+
+#endif
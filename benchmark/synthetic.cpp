@@ -0,0 +1,129 @@
+#include <benchmark/synthetic.hpp>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace benchmark {
+
+  namespace {
+
+    const char* PROJECTION =
+      "PROJCS[\"WGS 84 / UTM zone 23S\",GEOGCS[\"WGS 84\",DATUM[\"WGS_1984\","
+      "SPHEROID[\"WGS 84\",6378137,298.257223563]],PRIMEM[\"Greenwich\",0],"
+      "UNIT[\"degree\",0.0174532925199433]],PROJECTION[\"Transverse_Mercator\"],"
+      "PARAMETER[\"latitude_of_origin\",0],PARAMETER[\"central_meridian\",-45],"
+      "PARAMETER[\"scale_factor\",0.9996],PARAMETER[\"false_easting\",500000],"
+      "PARAMETER[\"false_northing\",10000000],UNIT[\"metre\",1]]";
+
+    const double PIXEL_SIZE = 30.0;
+
+    const size_t BORDER = 16;
+
+    double range( GDALDataType type )
+    {
+      switch( type ) {
+
+        case GDT_Byte   : return 254.0;
+        case GDT_UInt16 : return 4094.0;
+        default         : return 1000.0;
+      }
+    }
+
+  }
+
+  const char* layout_name( layout l )
+  {
+    return ( l == Tiled ) ? "tiled" : "striped";
+  }
+
+  const char* type_name( GDALDataType type )
+  {
+    switch( type ) {
+
+      case GDT_Byte    : return "Byte";
+      case GDT_UInt16  : return "UInt16";
+      case GDT_Float32 : return "Float32";
+      default          : return "Unknown";
+    }
+  }
+
+  bool make_geotiff( const std::string& filename,
+                     GDALDataType type,
+                     const size_t& size,
+                     const size_t& channels,
+                     layout l,
+                     const size_t& offset,
+                     unsigned int seed )
+  {
+    GDALAllRegister();
+
+    GDALDriver* driver =
+      GetGDALDriverManager()->GetDriverByName( "GTiff" );
+
+    char** options( 0 );
+
+    if( l == Tiled ) {
+
+      options = CSLSetNameValue( options, "TILED", "YES" );
+      options = CSLSetNameValue( options, "BLOCKXSIZE", "256" );
+      options = CSLSetNameValue( options, "BLOCKYSIZE", "256" );
+    }
+
+    GDALDataset* dataset = driver->Create( filename.c_str(), size, size,
+                                           channels, type, options );
+    CSLDestroy( options );
+
+    if( dataset == NULL ) {
+
+      std::cerr << "Unable to create image " << filename << std::endl;
+      return false;
+    }
+
+    double transform[] = { 500000.0 + offset * PIXEL_SIZE, PIXEL_SIZE, 0.0,
+                           7500000.0 - offset * PIXEL_SIZE, 0.0, -PIXEL_SIZE };
+
+    dataset->SetGeoTransform( transform );
+    dataset->SetProjection( PROJECTION );
+
+    boost::random::mt19937 generator( seed );
+    boost::random::uniform_real_distribution<double> noise( 0.0, 1.0 );
+
+    std::vector<double> line( size );
+
+    double r( range( type ) );
+    bool ok( true );
+
+    for( size_t k = 1; ok && ( k <= channels ); ++k ) {
+
+      GDALRasterBand* b_handle = dataset->GetRasterBand( k );
+      b_handle->SetNoDataValue( 0.0 );
+
+      for( size_t i = 0; ok && ( i < size ); ++i ) {
+
+        for( size_t j = 0; j < size; ++j ) {
+
+          bool border( ( i < BORDER ) || ( j < BORDER ) ||
+                       ( i >= size - BORDER ) || ( j >= size - BORDER ) );
+
+          double u( static_cast<double>( i + j ) / ( 2.0 * size ) );
+          double v( 0.5 + 0.5 * std::sin( 0.01 * k * ( i + 2.0 * j ) ) );
+
+          line[j] = border ? 0.0 : 1.0 + r * ( 0.6 * u + 0.3 * v
+                                             + 0.1 * noise( generator ) );
+        }
+
+        ok = ( b_handle->RasterIO( GF_Write, 0, i, size, 1, &line[0],
+                                   size, 1, GDT_Float64, 0, 0 ) == CE_None );
+      }
+    }
+
+    GDALClose( dataset );
+
+    return ok;
+  }
+
+}
@@ -0,0 +1,29 @@
+#ifndef BENCHMARK_SYNTHETIC_HPP
+#define BENCHMARK_SYNTHETIC_HPP
+
+#include <gdal_priv.h>
+
+#include <string>
+
+namespace benchmark {
+
+  enum layout { Striped=0, Tiled=1 };
+
+  const char* layout_name( layout l );
+
+  const char* type_name( GDALDataType type );
+
+  // Writes a size x size GeoTIFF with deterministic contents (smooth
+  // gradients plus seeded noise, and a nodata border of value 0). The origin
+  // is moved offset pixels right and down so shifted copies overlap.
+  bool make_geotiff( const std::string& filename,
+                     GDALDataType type,
+                     const size_t& size,
+                     const size_t& channels,
+                     layout l,
+                     const size_t& offset = 0,
+                     unsigned int seed = 42 );
+
+}
+
+#endif
@@ -0,0 +1,1063 @@
+#include <canvas/algebra.hpp>
+
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace canvas {
+
+  namespace {
+
+    struct negate_op {
+      float operator()( float a ) const { return -a; }
+    };
+
+    struct not_op {
+      float operator()( float a ) const { return ( a == 0.0f ) ? 1.0f : 0.0f; }
+    };
+
+    struct abs_op {
+      float operator()( float a ) const { return std::fabs( a ); }
+    };
+
+    struct sqrt_op {
+      float operator()( float a ) const { return std::sqrt( a ); }
+    };
+
+    struct log_op {
+      float operator()( float a ) const { return std::log( a ); }
+    };
+
+    struct exp_op {
+      float operator()( float a ) const { return std::exp( a ); }
+    };
+
+    struct floor_op {
+      float operator()( float a ) const { return std::floor( a ); }
+    };
+
+    struct ceil_op {
+      float operator()( float a ) const { return std::ceil( a ); }
+    };
+
+    struct add_op {
+      float operator()( float a, float b ) const { return a + b; }
+    };
+
+    struct subtract_op {
+      float operator()( float a, float b ) const { return a - b; }
+    };
+
+    struct multiply_op {
+      float operator()( float a, float b ) const { return a * b; }
+    };
+
+    struct divide_op {
+      float operator()( float a, float b ) const { return a / b; }
+    };
+
+    struct power_op {
+      float operator()( float a, float b ) const { return std::pow( a, b ); }
+    };
+
+    struct min_op {
+      float operator()( float a, float b ) const { return ( b < a ) ? b : a; }
+    };
+
+    struct max_op {
+      float operator()( float a, float b ) const { return ( a < b ) ? b : a; }
+    };
+
+    struct less_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a < b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct less_equal_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a <= b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct greater_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a > b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct greater_equal_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a >= b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct equal_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a == b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct not_equal_op {
+      float operator()( float a, float b ) const
+      {
+        return ( a != b ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct and_op {
+      float operator()( float a, float b ) const
+      {
+        return ( ( a != 0.0f ) && ( b != 0.0f ) ) ? 1.0f : 0.0f;
+      }
+    };
+
+    struct or_op {
+      float operator()( float a, float b ) const
+      {
+        return ( ( a != 0.0f ) || ( b != 0.0f ) ) ? 1.0f : 0.0f;
+      }
+    };
+
+    // plain loops over the block, which the compiler vectorises
+    template <typename function>
+    void apply( const float* a, float* out, size_t n, function f )
+    {
+      for( size_t i = 0; i < n; ++i ) {
+
+        out[i] = f( a[i] );
+      }
+    }
+
+    template <typename function>
+    void apply( const float* a, const float* b, float* out, size_t n,
+                function f )
+    {
+      for( size_t i = 0; i < n; ++i ) {
+
+        out[i] = f( a[i], b[i] );
+      }
+    }
+
+    void select( const float* c, const float* a, const float* b, float* out,
+                 size_t n )
+    {
+      for( size_t i = 0; i < n; ++i ) {
+
+        out[i] = ( c[i] != 0.0f ) ? a[i] : b[i];
+      }
+    }
+
+    // for images passed by reference
+    struct null_deleter {
+      void operator()( const void* ) const {}
+    };
+
+    inline bool is_finite( float value )
+    {
+      return ( value == value ) && ( std::fabs( value ) <= FLT_MAX );
+    }
+
+  }
+
+  // recursive descent over the grammar, from the lowest precedence:
+  //
+  //   select  := or [ '?' select ':' select ]
+  //   or      := and { '||' and }
+  //   and     := compare { '&&' compare }
+  //   compare := sum [ ( '<' | '<=' | '>' | '>=' | '==' | '!=' ) sum ]
+  //   sum     := product { ( '+' | '-' ) product }
+  //   product := unary { ( '*' | '/' ) unary }
+  //   unary   := ( '-' | '!' ) unary | power
+  //   power   := primary [ '^' unary ]
+  //   primary := number | band | name '(' select [ ',' select ] ')'
+  //            | '(' select ')'
+  class expression::parser {
+
+  public:
+    parser( expression& e ) : e_( e ), text_( e.text_ ), position_( 0 )
+    {
+    }
+
+    bool parse()
+    {
+      if( !select() ) {
+
+        return false;
+      }
+
+      skip();
+
+      if( position_ != text_.size() ) {
+
+        return fail( "unexpected input" );
+      }
+
+      return true;
+    }
+
+    const std::string& get_error() const
+    {
+      return error_;
+    }
+
+    size_t get_position() const
+    {
+      return position_;
+    }
+
+  private:
+    void skip()
+    {
+      while( ( position_ < text_.size() ) &&
+               std::isspace( static_cast<unsigned char>( text_[position_] ) ) ) {
+
+        ++position_;
+      }
+    }
+
+    // consumes token if it comes next
+    bool accept( const char* token )
+    {
+      skip();
+
+      size_t length( std::strlen( token ) );
+
+      if( text_.compare( position_, length, token ) == 0 ) {
+
+        position_ += length;
+        return true;
+      }
+
+      return false;
+    }
+
+    bool fail( const std::string& message )
+    {
+      if( error_.empty() ) {
+
+        error_ = message;
+      }
+
+      return false;
+    }
+
+    void emit( opcode code, size_t source = 0, float value = 0.0f )
+    {
+      instruction i = { code, source, value };
+      e_.program_.push_back( i );
+    }
+
+    bool select()
+    {
+      if( !logical_or() ) {
+
+        return false;
+      }
+
+      if( accept( "?" ) ) {
+
+        if( !select() ) {
+
+          return false;
+        }
+
+        if( !accept( ":" ) ) {
+
+          return fail( "expected ':'" );
+        }
+
+        if( !select() ) {
+
+          return false;
+        }
+
+        emit( SELECT );
+      }
+
+      return true;
+    }
+
+    bool logical_or()
+    {
+      if( !logical_and() ) {
+
+        return false;
+      }
+
+      while( accept( "||" ) ) {
+
+        if( !logical_and() ) {
+
+          return false;
+        }
+
+        emit( OR );
+      }
+
+      return true;
+    }
+
+    bool logical_and()
+    {
+      if( !compare() ) {
+
+        return false;
+      }
+
+      while( accept( "&&" ) ) {
+
+        if( !compare() ) {
+
+          return false;
+        }
+
+        emit( AND );
+      }
+
+      return true;
+    }
+
+    bool compare()
+    {
+      if( !sum() ) {
+
+        return false;
+      }
+
+      // two character operators first
+      static const char* tokens[] = { "<=", ">=", "==", "!=", "<", ">" };
+      static const opcode codes[] = { LESS_EQUAL, GREATER_EQUAL, EQUAL,
+                                      NOT_EQUAL, LESS, GREATER };
+
+      for( size_t k = 0; k < 6; ++k ) {
+
+        if( accept( tokens[k] ) ) {
+
+          if( !sum() ) {
+
+            return false;
+          }
+
+          emit( codes[k] );
+          break;
+        }
+      }
+
+      return true;
+    }
+
+    bool sum()
+    {
+      if( !product() ) {
+
+        return false;
+      }
+
+      for( ;; ) {
+
+        opcode code;
+
+        if( accept( "+" ) ) {
+
+          code = ADD;
+
+        } else if( accept( "-" ) ) {
+
+          code = SUBTRACT;
+
+        } else {
+
+          return true;
+        }
+
+        if( !product() ) {
+
+          return false;
+        }
+
+        emit( code );
+      }
+    }
+
+    bool product()
+    {
+      if( !unary() ) {
+
+        return false;
+      }
+
+      for( ;; ) {
+
+        opcode code;
+
+        if( accept( "*" ) ) {
+
+          code = MULTIPLY;
+
+        } else if( accept( "/" ) ) {
+
+          code = DIVIDE;
+
+        } else {
+
+          return true;
+        }
+
+        if( !unary() ) {
+
+          return false;
+        }
+
+        emit( code );
+      }
+    }
+
+    bool unary()
+    {
+      if( accept( "-" ) ) {
+
+        if( !unary() ) {
+
+          return false;
+        }
+
+        emit( NEGATE );
+        return true;
+      }
+
+      skip();
+
+      // "!" but not "!="
+      if( ( text_.compare( position_, 1, "!" ) == 0 ) &&
+          ( text_.compare( position_, 2, "!=" ) != 0 ) ) {
+
+        ++position_;
+
+        if( !unary() ) {
+
+          return false;
+        }
+
+        emit( NOT );
+        return true;
+      }
+
+      return power();
+    }
+
+    bool power()
+    {
+      if( !primary() ) {
+
+        return false;
+      }
+
+      if( accept( "^" ) ) {
+
+        if( !unary() ) {
+
+          return false;
+        }
+
+        emit( POWER );
+      }
+
+      return true;
+    }
+
+    bool number( size_t& value )
+    {
+      size_t start( position_ );
+
+      while( ( position_ < text_.size() ) &&
+               std::isdigit( static_cast<unsigned char>( text_[position_] ) ) ) {
+
+        ++position_;
+      }
+
+      if( position_ == start ) {
+
+        return false;
+      }
+
+      value = std::strtoul( text_.c_str() + start, 0, 10 );
+      return true;
+    }
+
+    // bK or iN.bK, the leading letter already consumed
+    bool band( size_t image )
+    {
+      size_t k;
+
+      if( !number( k ) || ( k == 0 ) ) {
+
+        return fail( "expected a band number from 1" );
+      }
+
+      source s( image, k );
+
+      std::vector<source>::iterator it =
+        std::find( e_.sources_.begin(), e_.sources_.end(), s );
+
+      emit( BAND, it - e_.sources_.begin() );
+
+      if( it == e_.sources_.end() ) {
+
+        e_.sources_.push_back( s );
+      }
+
+      return true;
+    }
+
+    bool primary()
+    {
+      skip();
+
+      if( position_ == text_.size() ) {
+
+        return fail( "unexpected end of expression" );
+      }
+
+      if( accept( "(" ) ) {
+
+        if( !select() ) {
+
+          return false;
+        }
+
+        return accept( ")" ) ? true : fail( "expected ')'" );
+      }
+
+      char c( text_[position_] );
+
+      if( std::isdigit( static_cast<unsigned char>( c ) ) || ( c == '.' ) ) {
+
+        const char* first( text_.c_str() + position_ );
+        char* last;
+        double value( std::strtod( first, &last ) );
+        position_ += last - first;
+        emit( CONSTANT, 0, static_cast<float>( value ) );
+        return true;
+      }
+
+      if( !std::isalpha( static_cast<unsigned char>( c ) ) ) {
+
+        return fail( "expected a number, band or function" );
+      }
+
+      size_t start( position_ );
+
+      while( ( position_ < text_.size() ) &&
+               std::isalnum( static_cast<unsigned char>( text_[position_] ) ) ) {
+
+        ++position_;
+      }
+
+      std::string name( text_, start, position_ - start );
+
+      if( ( name[0] == 'b' ) && ( name.size() > 1 ) &&
+            std::isdigit( static_cast<unsigned char>( name[1] ) ) ) {
+
+        position_ = start + 1;
+        return band( 0 );
+      }
+
+      if( ( name[0] == 'i' ) && ( name.size() > 1 ) &&
+            std::isdigit( static_cast<unsigned char>( name[1] ) ) ) {
+
+        position_ = start + 1;
+
+        size_t n;
+        number( n );
+
+        if( ( n == 0 ) || !accept( ".b" ) ) {
+
+          return fail( "expected iN.bK with N from 1" );
+        }
+
+        return band( n - 1 );
+      }
+
+      static const char* unary_names[] = {
+        "abs", "sqrt", "log", "exp", "floor", "ceil"
+      };
+      static const opcode unary_codes[] = { ABS, SQRT, LOG, EXP, FLOOR, CEIL };
+
+      static const char* binary_names[] = { "min", "max", "pow" };
+      static const opcode binary_codes[] = { MIN, MAX, POWER };
+
+      for( size_t k = 0; k < 6; ++k ) {
+
+        if( name == unary_names[k] ) {
+
+          if( !arguments( 1 ) ) {
+
+            return false;
+          }
+
+          emit( unary_codes[k] );
+          return true;
+        }
+      }
+
+      for( size_t k = 0; k < 3; ++k ) {
+
+        if( name == binary_names[k] ) {
+
+          if( !arguments( 2 ) ) {
+
+            return false;
+          }
+
+          emit( binary_codes[k] );
+          return true;
+        }
+      }
+
+      position_ = start;
+      return fail( "unknown name '" + name + "'" );
+    }
+
+    bool arguments( size_t count )
+    {
+      if( !accept( "(" ) ) {
+
+        return fail( "expected '('" );
+      }
+
+      for( size_t k = 0; k < count; ++k ) {
+
+        if( ( k > 0 ) && !accept( "," ) ) {
+
+          return fail( "expected ','" );
+        }
+
+        if( !select() ) {
+
+          return false;
+        }
+      }
+
+      return accept( ")" ) ? true : fail( "expected ')'" );
+    }
+
+    expression& e_;
+
+    const std::string& text_;
+
+    size_t position_;
+
+    std::string error_;
+
+  };
+
+  expression::expression( const std::string& text )
+    : text_( text ), valid_( false ), depth_( 0 )
+  {
+    parser p( *this );
+
+    if( !p.parse() ) {
+
+      std::cerr << "Invalid expression \"" << text_ << "\": "
+                << p.get_error() << " at position " << p.get_position()
+                << std::endl;
+
+      program_.clear();
+      sources_.clear();
+      return;
+    }
+
+    size_t depth( 0 );
+
+    for( size_t k = 0; k < program_.size(); ++k ) {
+
+      switch( program_[k].code ) {
+
+        case CONSTANT: case BAND:
+          depth_ = std::max( depth_, ++depth );
+          break;
+
+        case NEGATE: case NOT: case ABS: case SQRT: case LOG: case EXP:
+        case FLOOR: case CEIL:
+          break;
+
+        case SELECT:
+          depth -= 2;
+          break;
+
+        default:
+          --depth;
+          break;
+      }
+    }
+
+    BOOST_ASSERT( depth == 1 );
+    valid_ = true;
+  }
+
+  bool expression::is_valid() const
+  {
+    return valid_;
+  }
+
+  const std::string& expression::get_text() const
+  {
+    return text_;
+  }
+
+  size_t expression::get_images() const
+  {
+    size_t images( 0 );
+
+    for( size_t k = 0; k < sources_.size(); ++k ) {
+
+      images = std::max( images, sources_[k].first + 1 );
+    }
+
+    return images;
+  }
+
+  image32::ptr expression::evaluate( const std::vector<image::const_ptr>& images,
+                                     double nodata, size_t threads ) const
+  {
+    utility::profiler::scope profile( "expression::evaluate" );
+
+    image32::ptr result;
+
+    std::vector<const image*> inputs;
+
+    for( size_t k = 0; k < images.size(); ++k ) {
+
+      inputs.push_back( images[k].get() );
+    }
+
+    if( !check( inputs ) ) {
+
+      return result;
+    }
+
+    result = band_sink::create( *inputs.front(), 1, nodata );
+
+    band_sink output( result );
+
+    if( !run( inputs, output, static_cast<float>( nodata ), threads ) ) {
+
+      result.reset();
+    }
+
+    return result;
+  }
+
+  image32::ptr expression::evaluate( const image& input, double nodata,
+                                     size_t threads ) const
+  {
+    std::vector<image::const_ptr> images(
+      1, image::const_ptr( &input, null_deleter() )
+    );
+
+    return evaluate( images, nodata, threads );
+  }
+
+  bool expression::evaluate( const std::vector<image::const_ptr>& images,
+                             const std::string& filename, double nodata,
+                             size_t threads ) const
+  {
+    utility::profiler::scope profile( "expression::evaluate_file" );
+
+    std::vector<const image*> inputs;
+
+    for( size_t k = 0; k < images.size(); ++k ) {
+
+      inputs.push_back( images[k].get() );
+    }
+
+    if( !check( inputs ) ) {
+
+      return false;
+    }
+
+    file_sink output( filename, *inputs.front(), 1, nodata );
+
+    if( !output.is_open() ) {
+
+      return false;
+    }
+
+    return run( inputs, output, static_cast<float>( nodata ), threads );
+  }
+
+  bool expression::evaluate( const image& input, const std::string& filename,
+                             double nodata, size_t threads ) const
+  {
+    std::vector<image::const_ptr> images(
+      1, image::const_ptr( &input, null_deleter() )
+    );
+
+    return evaluate( images, filename, nodata, threads );
+  }
+
+  bool expression::check( const std::vector<const image*>& images ) const
+  {
+    if( !valid_ ) {
+
+      return false;
+    }
+
+    if( images.empty() || ( images.size() < get_images() ) ) {
+
+      std::cerr << "Expression \"" << text_ << "\" needs "
+                << std::max( get_images(), static_cast<size_t>( 1 ) )
+                << " image(s)" << std::endl;
+      return false;
+    }
+
+    for( size_t k = 0; k < images.size(); ++k ) {
+
+      if( ( images[k] == 0 ) ||
+          ( images[k]->get_lines()   != images[0]->get_lines()   ) ||
+          ( images[k]->get_columns() != images[0]->get_columns() ) ) {
+
+        std::cerr << "Images of expression \"" << text_
+                  << "\" differ in size" << std::endl;
+        return false;
+      }
+    }
+
+    for( size_t k = 0; k < sources_.size(); ++k ) {
+
+      if( sources_[k].second > images[sources_[k].first]->get_channels() ) {
+
+        std::cerr << "Image " << sources_[k].first + 1 << " has no band "
+                  << sources_[k].second << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool expression::run( const std::vector<const image*>& images,
+                        block_sink& output, float nodata,
+                        size_t threads ) const
+  {
+    size_t lines  ( images.front()->get_lines()   );
+    size_t columns( images.front()->get_columns() );
+
+    if( !lines || !columns ) {
+
+      return true;
+    }
+
+    size_t block_lines( std::max( BLOCK_PIXELS / columns,
+                                  static_cast<size_t>( 1 ) ) );
+    size_t blocks( ( lines + block_lines - 1 ) / block_lines );
+
+    size_t next( 0 );
+    bool ok( true );
+    boost::mutex mutex;
+
+    utility::thread_pool::global().run(
+      boost::bind( &expression::run_blocks, this, &images, &output, nodata,
+                   &next, blocks, block_lines, &ok, &mutex ),
+      utility::thread_pool::get_threads( threads, blocks )
+    );
+
+    return ok;
+  }
+
+  void expression::run_blocks( const std::vector<const image*>* images,
+                               block_sink* output, float nodata, size_t* next,
+                               size_t blocks, size_t block_lines, bool* ok,
+                               boost::mutex* mutex ) const
+  {
+    size_t lines  ( images->front()->get_lines()   );
+    size_t columns( images->front()->get_columns() );
+
+    size_t capacity( block_lines * columns );
+
+    // per thread scratch, reused for every block
+    std::vector< std::vector<float> > inputs( sources_.size() );
+    std::vector<const float*> input_ptrs( sources_.size() );
+
+    for( size_t k = 0; k < inputs.size(); ++k ) {
+
+      inputs[k].resize( capacity );
+      input_ptrs[k] = &inputs[k][0];
+    }
+
+    std::vector< std::vector<float> > slots( depth_ );
+    std::vector<float*> slot_ptrs( depth_ );
+
+    for( size_t k = 0; k < slots.size(); ++k ) {
+
+      slots[k].resize( capacity );
+      slot_ptrs[k] = &slots[k][0];
+    }
+
+    std::vector<const float*> stack( depth_ );
+
+    std::vector<unsigned char> valid( capacity );
+
+    for( ;; ) {
+
+      size_t b;
+
+      {
+        boost::lock_guard<boost::mutex> lock( *mutex );
+
+        if( !*ok || ( *next >= blocks ) ) {
+
+          return;
+        }
+
+        b = ( *next )++;
+      }
+
+      size_t l1( b * block_lines );
+      size_t l2( std::min( l1 + block_lines, lines ) );
+      size_t n( ( l2 - l1 ) * columns );
+
+      std::fill_n( valid.begin(), n, 1 );
+
+      for( size_t k = 0; k < sources_.size(); ++k ) {
+
+        const image& source( *( *images )[sources_[k].first] );
+        size_t band_number( sources_[k].second );
+
+        float* in_ptr( &inputs[k][0] );
+
+        if( !source.read_window( band_number, l1, 0, l2, columns, in_ptr ) ) {
+
+          boost::lock_guard<boost::mutex> lock( *mutex );
+          *ok = false;
+          return;
+        }
+
+        float nd( static_cast<float>( source.get_nodata( band_number ) ) );
+
+        for( size_t i = 0; i < n; ++i ) {
+
+          valid[i] &= ( in_ptr[i] != nd );
+        }
+      }
+
+      const float* r_ptr( execute( &input_ptrs[0], &slot_ptrs[0],
+                                   &stack[0], n ) );
+
+      float* out_ptr( slot_ptrs[0] );
+
+      for( size_t i = 0; i < n; ++i ) {
+
+        out_ptr[i] = ( valid[i] && is_finite( r_ptr[i] ) ) ? r_ptr[i] : nodata;
+      }
+
+      if( !output->write( 1, l1, l2, out_ptr ) ) {
+
+        boost::lock_guard<boost::mutex> lock( *mutex );
+        *ok = false;
+        return;
+      }
+    }
+  }
+
+  const float* expression::execute( const float* const* inputs,
+                                    float* const* slots, const float** stack,
+                                    size_t n ) const
+  {
+    size_t d( 0 );
+
+    for( size_t k = 0; k < program_.size(); ++k ) {
+
+      const instruction& i( program_[k] );
+
+      switch( i.code ) {
+
+        case CONSTANT:
+          std::fill_n( slots[d], n, i.value );
+          stack[d] = slots[d];
+          ++d;
+          continue;
+
+        case BAND:
+          stack[d] = inputs[i.source];
+          ++d;
+          continue;
+
+        case SELECT:
+          canvas::select( stack[d - 3], stack[d - 2], stack[d - 1],
+                          slots[d - 3], n );
+          stack[d - 3] = slots[d - 3];
+          d -= 2;
+          continue;
+
+        default:
+          break;
+      }
+
+      const float* a( stack[d - 1] );
+      float* out( slots[d - 1] );
+
+      switch( i.code ) {
+
+        case NEGATE: apply( a, out, n, negate_op() ); break;
+        case NOT:    apply( a, out, n, not_op()    ); break;
+        case ABS:    apply( a, out, n, abs_op()    ); break;
+        case SQRT:   apply( a, out, n, sqrt_op()   ); break;
+        case LOG:    apply( a, out, n, log_op()    ); break;
+        case EXP:    apply( a, out, n, exp_op()    ); break;
+        case FLOOR:  apply( a, out, n, floor_op()  ); break;
+        case CEIL:   apply( a, out, n, ceil_op()   ); break;
+
+        default: {
+
+          const float* x( stack[d - 2] );
+          out = slots[d - 2];
+
+          switch( i.code ) {
+
+            case ADD:           apply( x, a, out, n, add_op()           ); break;
+            case SUBTRACT:      apply( x, a, out, n, subtract_op()      ); break;
+            case MULTIPLY:      apply( x, a, out, n, multiply_op()      ); break;
+            case DIVIDE:        apply( x, a, out, n, divide_op()        ); break;
+            case POWER:         apply( x, a, out, n, power_op()         ); break;
+            case MIN:           apply( x, a, out, n, min_op()           ); break;
+            case MAX:           apply( x, a, out, n, max_op()           ); break;
+            case LESS:          apply( x, a, out, n, less_op()          ); break;
+            case LESS_EQUAL:    apply( x, a, out, n, less_equal_op()    ); break;
+            case GREATER:       apply( x, a, out, n, greater_op()       ); break;
+            case GREATER_EQUAL: apply( x, a, out, n, greater_equal_op() ); break;
+            case EQUAL:         apply( x, a, out, n, equal_op()         ); break;
+            case NOT_EQUAL:     apply( x, a, out, n, not_equal_op()     ); break;
+            case AND:           apply( x, a, out, n, and_op()           ); break;
+            case OR:            apply( x, a, out, n, or_op()            ); break;
+            default:            BOOST_ASSERT( false );                     break;
+          }
+
+          --d;
+        }
+      }
+
+      stack[d - 1] = out;
+    }
+
+    BOOST_ASSERT( d == 1 );
+    return stack[0];
+  }
+
+}
@@ -0,0 +1,111 @@
+#ifndef CANVAS_ALGEBRA_HPP
+#define CANVAS_ALGEBRA_HPP
+
+#include <canvas/block_sink.hpp>
+#include <canvas/image32.hpp>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace canvas {
+
+  // Band algebra evaluated in a single blockwise, multi-threaded pass.
+  //
+  // An expression combines bands, written bK for band K of the first image
+  // or iN.bK for band K of image N, with numbers and
+  //
+  //   + - * / ^ (power), unary - and !, < <= > >= == !=, && ||,
+  //   c ? a : b, abs sqrt log exp floor ceil (x), min max pow (x, y)
+  //
+  // e.g. "(b4 - b3) / (b4 + b3)" or "b1 > 40 && b2 < 10 ? 1 : 0". Values
+  // are computed as floats; comparisons and logical operators give 1 or 0.
+  // A pixel is nodata in the result if any band used is nodata there or
+  // the value is not finite (division by zero, log of a negative number).
+  class expression {
+
+  public:
+    typedef boost::shared_ptr<expression> ptr;
+
+    // pixels evaluated together, per thread
+    static const size_t BLOCK_PIXELS = 65536;
+
+    // errors are reported on std::cerr and leave the expression invalid
+    explicit expression( const std::string& text );
+
+    bool is_valid() const;
+
+    const std::string& get_text() const;
+
+    // highest image number used
+    size_t get_images() const;
+
+    // evaluates over images of the same size into a new single band image
+    // with the georeferencing of the first one
+    image32::ptr evaluate( const std::vector<image::const_ptr>& images,
+                           double nodata = -9999.0, size_t threads = 0 ) const;
+
+    image32::ptr evaluate( const image& input, double nodata = -9999.0,
+                           size_t threads = 0 ) const;
+
+    // evaluates straight into a Float32 file, one block at a time
+    bool evaluate( const std::vector<image::const_ptr>& images,
+                   const std::string& filename, double nodata = -9999.0,
+                   size_t threads = 0 ) const;
+
+    bool evaluate( const image& input, const std::string& filename,
+                   double nodata = -9999.0, size_t threads = 0 ) const;
+
+  private:
+    enum opcode {
+      CONSTANT=0, BAND=1, NEGATE=2, NOT=3, ABS=4, SQRT=5, LOG=6, EXP=7,
+      FLOOR=8, CEIL=9, ADD=10, SUBTRACT=11, MULTIPLY=12, DIVIDE=13, POWER=14,
+      MIN=15, MAX=16, LESS=17, LESS_EQUAL=18, GREATER=19, GREATER_EQUAL=20,
+      EQUAL=21, NOT_EQUAL=22, AND=23, OR=24, SELECT=25
+    };
+
+    struct instruction {
+
+      opcode code;
+
+      size_t source;
+
+      float value;
+
+    };
+
+    typedef std::pair<size_t,size_t> source;  // image, band (from 0, 1)
+
+    class parser;
+
+    bool check( const std::vector<const image*>& images ) const;
+
+    bool run( const std::vector<const image*>& images, block_sink& output,
+              float nodata, size_t threads ) const;
+
+    void run_blocks( const std::vector<const image*>* images,
+                     block_sink* output, float nodata, size_t* next,
+                     size_t blocks, size_t block_lines, bool* ok,
+                     boost::mutex* mutex ) const;
+
+    // the program over n pixels; returns the result (an input or slot)
+    const float* execute( const float* const* inputs, float* const* slots,
+                          const float** stack, size_t n ) const;
+
+    std::string text_;
+
+    bool valid_;
+
+    std::vector<instruction> program_;
+
+    std::vector<source> sources_;
+
+    size_t depth_;
+
+  };
+
+}
+
+#endif
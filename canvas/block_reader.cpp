@@ -0,0 +1,169 @@
+#include <canvas/block_reader.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+
+namespace canvas {
+
+  size_t block_reader::block::get_l1() const
+  {
+    return l1_;
+  }
+
+  size_t block_reader::block::get_l2() const
+  {
+    return l2_;
+  }
+
+  size_t block_reader::block::get_columns() const
+  {
+    return columns_;
+  }
+
+  block_reader::block_reader( const image& input, size_t band_number,
+                              const image::window& w, size_t block_lines,
+                              size_t depth )
+    : input_( input ), window_( w ),
+      block_lines_( std::max( block_lines, static_cast<size_t>( 1 ) ) ),
+      blocks_( 0 ), ring_( depth + 1 ), read_( 0 ), taken_( 0 ),
+      released_( 0 ), stop_( false ), failed_( false )
+  {
+    BOOST_ASSERT( band_number <= input.get_channels() );
+    BOOST_ASSERT( ( w.l1 <= w.l2 ) && ( w.l2 <= input.get_lines() ) );
+    BOOST_ASSERT( ( w.c1 <= w.c2 ) && ( w.c2 <= input.get_columns() ) );
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      if( !band_number || ( k == band_number ) ) {
+
+        bands_.push_back( k );
+      }
+    }
+
+    if( ( w.c1 < w.c2 ) && !bands_.empty() ) {
+
+      blocks_ = ( w.l2 - w.l1 + block_lines_ - 1 ) / block_lines_;
+    }
+
+    if( blocks_ ) {
+
+      thread_ = boost::thread( boost::bind( &block_reader::read_blocks,
+                                            this ) );
+    }
+  }
+
+  block_reader::~block_reader()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      stop_ = true;
+    }
+
+    changed_.notify_all();
+
+    if( thread_.joinable() ) {
+
+      thread_.join();
+    }
+  }
+
+  const block_reader::block* block_reader::next()
+  {
+    boost::unique_lock<boost::mutex> lock( mutex_ );
+
+    // the block handed out last can be read into again
+    if( released_ < taken_ ) {
+
+      released_ = taken_;
+      changed_.notify_all();
+    }
+
+    if( taken_ == blocks_ ) {
+
+      return 0;
+    }
+
+    while( !failed_ && ( read_ <= taken_ ) ) {
+
+      changed_.wait( lock );
+    }
+
+    // blocks read before an error are still handed out
+    if( read_ <= taken_ ) {
+
+      return 0;
+    }
+
+    return &ring_[taken_++ % ring_.size()];
+  }
+
+  bool block_reader::is_valid() const
+  {
+    boost::lock_guard<boost::mutex> lock( mutex_ );
+
+    return !failed_;
+  }
+
+  void block_reader::read_blocks()
+  {
+    size_t columns( window_.c2 - window_.c1 );
+
+    for( size_t n = 0; n < blocks_; ++n ) {
+
+      {
+        boost::unique_lock<boost::mutex> lock( mutex_ );
+
+        // a buffer of the ring is free once its block was released
+        while( !stop_ && ( n >= released_ + ring_.size() ) ) {
+
+          changed_.wait( lock );
+        }
+
+        if( stop_ ) {
+
+          return;
+        }
+      }
+
+      block& b( ring_[n % ring_.size()] );
+      b.l1_ = window_.l1 + n * block_lines_;
+      b.l2_ = std::min( b.l1_ + block_lines_, window_.l2 );
+      b.columns_ = columns;
+
+      size_t pixels( ( b.l2_ - b.l1_ ) * columns );
+      b.values_.resize( pixels * bands_.size() );
+
+      bool ok( true );
+
+      for( size_t k = 0; ok && ( k < bands_.size() ); ++k ) {
+
+        ok = input_.read_window( bands_[k], b.l1_, window_.c1, b.l2_,
+                                 window_.c2, &b.values_[k * pixels] );
+      }
+
+      {
+        boost::lock_guard<boost::mutex> lock( mutex_ );
+
+        if( ok ) {
+
+          read_ = n + 1;
+
+        } else {
+
+          failed_ = true;
+        }
+      }
+
+      changed_.notify_all();
+
+      if( !ok ) {
+
+        return;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,108 @@
+#ifndef CANVAS_BLOCK_READER_HPP
+#define CANVAS_BLOCK_READER_HPP
+
+#include <canvas/image.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <vector>
+
+namespace canvas {
+
+  // Blocks of lines of a window of an image, read in order by a thread of
+  // its own up to depth blocks ahead of the block being processed, into a
+  // ring of depth + 1 buffers reused from block to block. Reading the next
+  // blocks overlaps the work on the current one in sequential scans.
+  class block_reader : private boost::noncopyable {
+
+  public:
+    typedef boost::shared_ptr<block_reader> ptr;
+
+    // blocks read ahead by default
+    static const size_t DEPTH = 2;
+
+    // lines [l1, l2) of the window for the bands read
+    class block {
+
+    public:
+      size_t get_l1() const;
+
+      size_t get_l2() const;
+
+      size_t get_columns() const;
+
+      // values of the n-th band read, line by line
+      const float* get_values( size_t n ) const
+      {
+        return &values_[n * ( l2_ - l1_ ) * columns_];
+      }
+
+    private:
+      friend class block_reader;
+
+      size_t l1_;
+
+      size_t l2_;
+
+      size_t columns_;
+
+      std::vector<float> values_;
+
+    };
+
+    // band_number 0 for every band; lines are those of the window
+    block_reader( const image& input, size_t band_number,
+                  const image::window& w, size_t block_lines,
+                  size_t depth = DEPTH );
+
+    // stops reading ahead
+    ~block_reader();
+
+    // the next block, valid until the following call; empty at the end of
+    // the window and after the blocks read before an error
+    const block* next();
+
+    // false after a read error
+    bool is_valid() const;
+
+  private:
+    void read_blocks();
+
+    const image& input_;
+
+    std::vector<size_t> bands_;
+
+    image::window window_;
+
+    size_t block_lines_;
+
+    size_t blocks_;
+
+    std::vector<block> ring_;
+
+    // blocks read, handed out and released by the consumer
+    size_t read_;
+
+    size_t taken_;
+
+    size_t released_;
+
+    bool stop_;
+
+    bool failed_;
+
+    mutable boost::mutex mutex_;
+
+    boost::condition_variable changed_;
+
+    boost::thread thread_;
+
+  };
+
+}
+
+#endif
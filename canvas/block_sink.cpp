@@ -0,0 +1,132 @@
+#include <canvas/block_sink.hpp>
+#include <canvas/image_factory.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+namespace canvas {
+
+  block_sink::~block_sink()
+  {
+  }
+
+  band_sink::band_sink( const image32::ptr& target ) : target_( target )
+  {
+    BOOST_ASSERT( target_ );
+  }
+
+  image32::ptr band_sink::create( const image& reference, size_t channels,
+                                  double nodata )
+  {
+    image32::ptr result( new image32( reference.get_lines(),
+                                      reference.get_columns(), channels ) );
+    result->allocate();
+    result->set_metadata( reference.get_metadata() );
+
+    for( size_t k = 1; k <= channels; ++k ) {
+
+      result->set_nodata( k, nodata );
+    }
+
+    return result;
+  }
+
+  bool band_sink::write( size_t band_number, size_t l1, size_t l2,
+                         const float* values )
+  {
+    size_t columns( target_->get_columns() );
+
+    std::copy( values, values + ( l2 - l1 ) * columns,
+               target_->get_band( band_number )->get() + l1 * columns );
+
+    return true;
+  }
+
+  file_sink::file_sink( const std::string& filename, const image& reference,
+                        size_t channels, double nodata, GDALDataType type )
+    : dataset_( 0 ), columns_( reference.get_columns() )
+  {
+    std::map<std::string,std::string> drivers;
+    drivers[".tif"] = "GTiff";
+    drivers[".img"] = "HFA";
+
+    boost::filesystem::path p( filename );
+    std::string ext( p.extension().string() );
+
+    image_factory::register_drivers();
+
+    GDALDriver* driver = drivers.count( ext )
+      ? GetGDALDriverManager()->GetDriverByName( drivers[ext].c_str() ) : 0;
+
+    if( driver == NULL ) {
+
+      std::cerr << "No driver for " << filename << std::endl;
+      return;
+    }
+
+    dataset_ = driver->Create( filename.c_str(), reference.get_columns(),
+                               reference.get_lines(), channels, type,
+                               NULL );
+
+    if( dataset_ == NULL ) {
+
+      std::cerr << "Unable to create image " << filename << std::endl;
+      return;
+    }
+
+    boost::shared_ptr<image::metadata> md( reference.get_metadata() );
+
+    if( md ) {
+
+      const CGAL::Bbox_2& bb( md->get<1>() );
+      double transform[] = { bb.xmin(), md->get<0>(), 0.0,
+                             bb.ymax(), 0.0, -md->get<0>() };
+
+      dataset_->SetGeoTransform( transform );
+      dataset_->SetProjection( md->get<2>().c_str() );
+    }
+
+    for( size_t k = 1; k <= channels; ++k ) {
+
+      dataset_->GetRasterBand( k )->SetNoDataValue( nodata );
+    }
+  }
+
+  file_sink::~file_sink()
+  {
+    if( dataset_ != NULL ) {
+
+      GDALClose( dataset_ );
+    }
+  }
+
+  bool file_sink::is_open() const
+  {
+    return ( dataset_ != NULL );
+  }
+
+  bool file_sink::write( size_t band_number, size_t l1, size_t l2,
+                         const float* values )
+  {
+    return write( band_number, l1, l2, values, GDT_Float32 );
+  }
+
+  bool file_sink::write( size_t band_number, size_t l1, size_t l2,
+                         const void* values, GDALDataType type )
+  {
+    boost::lock_guard<boost::mutex> lock( mutex_ );
+
+    CPLErr e = image::raster_io( dataset_->GetRasterBand( band_number ),
+                                 GF_Write, 0, l1, columns_, l2 - l1,
+                                 const_cast<void*>( values ), columns_,
+                                 l2 - l1, type, 0, 0 );
+
+    return ( e == CE_None );
+  }
+
+}
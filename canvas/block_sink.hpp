@@ -0,0 +1,75 @@
+#ifndef CANVAS_BLOCK_SINK_HPP
+#define CANVAS_BLOCK_SINK_HPP
+
+#include <canvas/image32.hpp>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+
+namespace canvas {
+
+  // Destination of float results computed a block of whole lines at a time,
+  // possibly from several threads at once.
+  class block_sink : private boost::noncopyable {
+
+  public:
+    virtual ~block_sink();
+
+    // lines [l1, l2) of a band
+    virtual bool write( size_t band_number, size_t l1, size_t l2,
+                        const float* values ) = 0;
+
+  };
+
+  // into the bands of an image32 in memory
+  class band_sink : public block_sink {
+
+  public:
+    explicit band_sink( const image32::ptr& target );
+
+    // a new allocated image32 with the size and georeferencing of reference
+    static image32::ptr create( const image& reference, size_t channels,
+                                double nodata );
+
+    bool write( size_t band_number, size_t l1, size_t l2,
+                const float* values );
+
+  private:
+    image32::ptr target_;
+
+  };
+
+  // into a new file (Float32 unless given), written block by block and
+  // closed on destruction
+  class file_sink : public block_sink {
+
+  public:
+    file_sink( const std::string& filename, const image& reference,
+               size_t channels, double nodata,
+               GDALDataType type = GDT_Float32 );
+
+    ~file_sink();
+
+    bool is_open() const;
+
+    bool write( size_t band_number, size_t l1, size_t l2,
+                const float* values );
+
+    // values of the given type, converted by GDAL if it differs
+    bool write( size_t band_number, size_t l1, size_t l2,
+                const void* values, GDALDataType type );
+
+  private:
+    GDALDataset* dataset_;
+
+    size_t columns_;
+
+    boost::mutex mutex_;
+
+  };
+
+}
+
+#endif
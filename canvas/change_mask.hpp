@@ -0,0 +1,127 @@
+#ifndef CANVAS_CHANGE_MASK_HPP
+#define CANVAS_CHANGE_MASK_HPP
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+namespace canvas {
+
+  // One bit per pixel marking changes, each line padded to whole 64 bit
+  // words so that lines can be filled concurrently, and per band statistics
+  // of the absolute differences of the changed pixels.
+  class change_mask {
+
+  public:
+    typedef boost::shared_ptr<change_mask> ptr;
+
+    struct band_stats {
+
+      band_stats() : valid( 0 ), changed( 0 ), minimum( 0.0 ),
+                     maximum( 0.0 ), mean( 0.0 ), variance( 0.0 )
+      {
+      }
+
+      boost::uint64_t valid;            // pixels valid in both images
+
+      boost::uint64_t changed;          // over the threshold
+
+      double minimum;
+
+      double maximum;
+
+      double mean;
+
+      double variance;
+
+    };
+
+    change_mask( size_t lines, size_t columns, size_t channels )
+      : lines_( lines ), columns_( columns ),
+        words_( ( columns + 63 ) / 64 ), bits_( lines * words_, 0 ),
+        stats_( channels )
+    {
+    }
+
+    size_t get_lines() const
+    {
+      return lines_;
+    }
+
+    size_t get_columns() const
+    {
+      return columns_;
+    }
+
+    size_t get_channels() const
+    {
+      return stats_.size();
+    }
+
+    bool get( size_t i, size_t j ) const
+    {
+      return ( bits_[i * words_ + j / 64] >> ( j % 64 ) ) & 1;
+    }
+
+    void set( size_t i, size_t j )
+    {
+      bits_[i * words_ + j / 64] |=
+        static_cast<boost::uint64_t>( 1 ) << ( j % 64 );
+    }
+
+    // words of line i, bit j % 64 of word j / 64 for column j
+    boost::uint64_t* get_line( size_t i )
+    {
+      return &bits_[i * words_];
+    }
+
+    const boost::uint64_t* get_line( size_t i ) const
+    {
+      return &bits_[i * words_];
+    }
+
+    size_t get_words_per_line() const
+    {
+      return words_;
+    }
+
+    // pixels changed in any band
+    boost::uint64_t count() const
+    {
+      boost::uint64_t n( 0 );
+
+      for( size_t k = 0; k < bits_.size(); ++k ) {
+
+        n += __builtin_popcountll( bits_[k] );
+      }
+
+      return n;
+    }
+
+    const band_stats& get_stats( size_t band_number ) const
+    {
+      return stats_[band_number - 1];
+    }
+
+    band_stats& get_stats( size_t band_number )
+    {
+      return stats_[band_number - 1];
+    }
+
+  private:
+    size_t lines_;
+
+    size_t columns_;
+
+    size_t words_;
+
+    std::vector<boost::uint64_t> bits_;
+
+    std::vector<band_stats> stats_;
+
+  };
+
+}
+
+#endif
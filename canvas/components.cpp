@@ -0,0 +1,819 @@
+#include <canvas/components.hpp>
+#include <canvas/block_sink.hpp>
+#include <canvas/image32.hpp>
+
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace canvas {
+
+  namespace {
+
+    // directions of the pixel edges, clockwise with lines going down
+    enum direction { East=0, South=1, West=2, North=3 };
+
+    // root of x, halving the path on the way
+    boost::uint32_t find( std::vector<boost::uint32_t>& parent,
+                          boost::uint32_t x )
+    {
+      while( parent[x] != x ) {
+
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+      }
+
+      return x;
+    }
+
+    // the smaller root stays, so roots are the first label of their set
+    boost::uint32_t unite( std::vector<boost::uint32_t>& parent,
+                           boost::uint32_t a, boost::uint32_t b )
+    {
+      a = find( parent, a );
+      b = find( parent, b );
+
+      if( a < b ) {
+
+        parent[b] = a;
+        return a;
+      }
+
+      parent[a] = b;
+      return b;
+    }
+
+    void add_pixel( components::component& c, size_t i, size_t j )
+    {
+      if( !c.area ) {
+
+        c.bounds.l1 = i;
+        c.bounds.c1 = j;
+        c.bounds.l2 = i + 1;
+        c.bounds.c2 = j + 1;
+
+      } else {
+
+        c.bounds.l1 = std::min( c.bounds.l1, i );
+        c.bounds.c1 = std::min( c.bounds.c1, j );
+        c.bounds.l2 = std::max( c.bounds.l2, i + 1 );
+        c.bounds.c2 = std::max( c.bounds.c2, j + 1 );
+      }
+
+      ++c.area;
+      c.line   += i + 0.5;
+      c.column += j + 0.5;
+    }
+
+    // centroids still summed
+    void merge( components::component& c,
+                const components::component& other )
+    {
+      if( !c.area ) {
+
+        c = other;
+        return;
+      }
+
+      c.bounds.l1 = std::min( c.bounds.l1, other.bounds.l1 );
+      c.bounds.c1 = std::min( c.bounds.c1, other.bounds.c1 );
+      c.bounds.l2 = std::max( c.bounds.l2, other.bounds.l2 );
+      c.bounds.c2 = std::max( c.bounds.c2, other.bounds.c2 );
+
+      c.area   += other.area;
+      c.line   += other.line;
+      c.column += other.column;
+    }
+
+    // f from threads threads of the shared pool at once
+    void run_threads( const utility::thread_pool::task& f, size_t threads )
+    {
+      utility::thread_pool::global().run( f, threads );
+    }
+
+    size_t thread_count( size_t threads, size_t tasks )
+    {
+      return utility::thread_pool::get_threads( threads, tasks );
+    }
+
+  }
+
+  // shared by the threads labelling a mask
+  struct components::job {
+
+    const image* mask;
+
+    size_t band_number;
+
+    float nodata;
+
+    const change_mask* bits;
+
+    size_t block_lines;
+
+    size_t blocks;
+
+    size_t next;
+
+    bool ok;
+
+    boost::mutex mutex;
+
+    // components of each strip by local label - 1, centroids summed
+    std::vector<std::vector<component> > pieces;
+
+    // first provisional label of each strip less one
+    std::vector<boost::uint32_t> offsets;
+
+    // final label of every provisional label
+    std::vector<boost::uint32_t> final;
+
+  };
+
+  components::components( const image& mask, size_t band_number,
+                          connectivity neighbours, size_t threads )
+    : lines_( mask.get_lines() ), columns_( mask.get_columns() ),
+      neighbours_( neighbours ), metadata_( mask.get_metadata() ),
+      valid_( false )
+  {
+    utility::profiler::scope profile( "components::components" );
+
+    BOOST_ASSERT( ( band_number >= 1 ) &&
+                  ( band_number <= mask.get_channels() ) );
+
+    job j;
+    j.mask = &mask;
+    j.band_number = band_number;
+    j.nodata = static_cast<float>( mask.get_nodata( band_number ) );
+    j.bits = 0;
+
+    label( j, threads );
+  }
+
+  components::components( const change_mask& mask,
+                          const boost::shared_ptr<image::metadata>& md,
+                          connectivity neighbours, size_t threads )
+    : lines_( mask.get_lines() ), columns_( mask.get_columns() ),
+      neighbours_( neighbours ), metadata_( md ), valid_( false )
+  {
+    utility::profiler::scope profile( "components::components" );
+
+    job j;
+    j.mask = 0;
+    j.band_number = 0;
+    j.nodata = 0.0f;
+    j.bits = &mask;
+
+    label( j, threads );
+  }
+
+  void components::label( job& j, size_t threads )
+  {
+    labels_.reset( new labels( lines_ * columns_ ) );
+
+    if( !lines_ || !columns_ ) {
+
+      valid_ = true;
+      return;
+    }
+
+    j.block_lines = std::max( BLOCK_PIXELS / columns_,
+                              static_cast<size_t>( 1 ) );
+    j.blocks = ( lines_ + j.block_lines - 1 ) / j.block_lines;
+    j.next = 0;
+    j.ok = true;
+    j.pieces.resize( j.blocks );
+
+    threads = thread_count( threads, j.blocks );
+
+    run_threads( boost::bind( &components::label_strips, this, &j ),
+                 threads );
+
+    if( !j.ok ) {
+
+      std::cerr << "Unable to read the mask" << std::endl;
+      labels_.reset();
+      return;
+    }
+
+    // provisional labels: the local labels of every strip after those of
+    // the strips above
+    j.offsets.resize( j.blocks );
+    boost::uint64_t total( 0 );
+
+    for( size_t b = 0; b < j.blocks; ++b ) {
+
+      j.offsets[b] = static_cast<boost::uint32_t>( total );
+      total += j.pieces[b].size();
+    }
+
+    BOOST_ASSERT( total < std::numeric_limits<boost::uint32_t>::max() );
+
+    std::vector<boost::uint32_t> parent( total + 1 );
+
+    for( size_t p = 0; p <= total; ++p ) {
+
+      parent[p] = p;
+    }
+
+    const labels& l( *labels_ );
+    bool eight( neighbours_ == Eight );
+
+    for( size_t b = 1; b < j.blocks; ++b ) {
+
+      size_t above( ( b * j.block_lines - 1 ) * columns_ );
+      size_t below( b * j.block_lines * columns_ );
+
+      for( size_t c = 0; c < columns_; ++c ) {
+
+        if( !l[above + c] ) {
+
+          continue;
+        }
+
+        boost::uint32_t a( j.offsets[b - 1] + l[above + c] );
+
+        size_t c1( ( eight && c ) ? c - 1 : c );
+        size_t c2( ( eight && ( c + 1 < columns_ ) ) ? c + 1 : c );
+
+        for( size_t k = c1; k <= c2; ++k ) {
+
+          if( l[below + k] ) {
+
+            unite( parent, a, j.offsets[b] + l[below + k] );
+          }
+        }
+      }
+    }
+
+    // numbered in the order of their roots, the first provisional label of
+    // each component and so the one holding its first pixel
+    j.final.assign( total + 1, 0 );
+    boost::uint32_t n( 0 );
+    bool identity( true );
+
+    for( size_t p = 1; p <= total; ++p ) {
+
+      boost::uint32_t r( find( parent, p ) );
+      j.final[p] = ( r == p ) ? ++n : j.final[r];
+      identity = identity && ( j.final[p] == p );
+    }
+
+    components_.resize( n );
+
+    for( size_t b = 0; b < j.blocks; ++b ) {
+
+      for( size_t k = 0; k < j.pieces[b].size(); ++k ) {
+
+        merge( components_[j.final[j.offsets[b] + k + 1] - 1],
+               j.pieces[b][k] );
+      }
+
+      std::vector<component>().swap( j.pieces[b] );
+    }
+
+    for( size_t k = 0; k < n; ++k ) {
+
+      components_[k].line   /= components_[k].area;
+      components_[k].column /= components_[k].area;
+    }
+
+    if( !identity ) {
+
+      j.next = 0;
+      run_threads( boost::bind( &components::relabel_strips, this, &j ),
+                   threads );
+    }
+
+    valid_ = true;
+  }
+
+  void components::label_strips( components* self, job* j )
+  {
+    size_t columns( self->columns_ );
+    bool eight( self->neighbours_ == Eight );
+
+    std::vector<unsigned char> foreground( j->block_lines * columns );
+    std::vector<float> buffer;
+    std::vector<boost::uint32_t> local( j->block_lines * columns );
+    std::vector<boost::uint32_t> parent;
+    std::vector<boost::uint32_t> compact;
+
+    for( ;; ) {
+
+      size_t b;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( !j->ok || ( j->next >= j->blocks ) ) {
+
+          return;
+        }
+
+        b = j->next++;
+      }
+
+      size_t l1( b * j->block_lines );
+      size_t l2( std::min( l1 + j->block_lines, self->lines_ ) );
+      size_t n_lines( l2 - l1 );
+
+      if( !self->read_foreground( *j, l1, l2, foreground, buffer ) ) {
+
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+        j->ok = false;
+        return;
+      }
+
+      // first pass: provisional labels from the neighbours above and left
+      parent.assign( 1, 0 );
+
+      for( size_t r = 0; r < n_lines; ++r ) {
+
+        for( size_t c = 0; c < columns; ++c ) {
+
+          size_t x( r * columns + c );
+
+          if( !foreground[x] ) {
+
+            local[x] = 0;
+            continue;
+          }
+
+          boost::uint32_t label( 0 );
+
+          if( c && local[x - 1] ) {
+
+            label = local[x - 1];
+          }
+
+          if( r ) {
+
+            size_t up( x - columns );
+            size_t c1( ( eight && c ) ? c - 1 : c );
+            size_t c2( ( eight && ( c + 1 < columns ) ) ? c + 1 : c );
+
+            for( size_t k = c1; k <= c2; ++k ) {
+
+              boost::uint32_t n( local[up - c + k] );
+
+              if( n ) {
+
+                label = label ? unite( parent, label, n ) : n;
+              }
+            }
+          }
+
+          if( !label ) {
+
+            label = parent.size();
+            parent.push_back( label );
+          }
+
+          local[x] = label;
+        }
+      }
+
+      // local labels in the raster order of the first pixels
+      compact.assign( parent.size(), 0 );
+      boost::uint32_t count( 0 );
+
+      for( size_t p = 1; p < parent.size(); ++p ) {
+
+        boost::uint32_t root( find( parent, p ) );
+        compact[p] = ( root == p ) ? ++count : compact[root];
+      }
+
+      std::vector<component> pieces( count );
+      boost::uint32_t* out( self->labels_->get() + l1 * columns );
+
+      for( size_t r = 0; r < n_lines; ++r ) {
+
+        for( size_t c = 0; c < columns; ++c ) {
+
+          size_t x( r * columns + c );
+          boost::uint32_t label( local[x] ? compact[local[x]] : 0 );
+
+          out[x] = label;
+
+          if( label ) {
+
+            add_pixel( pieces[label - 1], l1 + r, c );
+          }
+        }
+      }
+
+      j->pieces[b].swap( pieces );
+    }
+  }
+
+  void components::relabel_strips( components* self, job* j )
+  {
+    for( ;; ) {
+
+      size_t b;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( j->next >= j->blocks ) {
+
+          return;
+        }
+
+        b = j->next++;
+      }
+
+      size_t l1( b * j->block_lines );
+      size_t l2( std::min( l1 + j->block_lines, self->lines_ ) );
+
+      boost::uint32_t* first( self->labels_->get() + l1 * self->columns_ );
+      boost::uint32_t* last( self->labels_->get() + l2 * self->columns_ );
+      boost::uint32_t offset( j->offsets[b] );
+
+      for( boost::uint32_t* it = first; it != last; ++it ) {
+
+        if( *it ) {
+
+          *it = j->final[offset + *it];
+        }
+      }
+    }
+  }
+
+  bool components::read_foreground( const job& j, size_t l1, size_t l2,
+                                    std::vector<unsigned char>& foreground,
+                                    std::vector<float>& buffer ) const
+  {
+    size_t n( ( l2 - l1 ) * columns_ );
+
+    if( j.bits ) {
+
+      for( size_t i = l1; i < l2; ++i ) {
+
+        const boost::uint64_t* words( j.bits->get_line( i ) );
+        unsigned char* f( &foreground[( i - l1 ) * columns_] );
+
+        for( size_t c = 0; c < columns_; ++c ) {
+
+          f[c] = ( words[c / 64] >> ( c % 64 ) ) & 1;
+        }
+      }
+
+      return true;
+    }
+
+    buffer.resize( n );
+
+    if( !j.mask->read_window( j.band_number, l1, 0, l2, columns_,
+                              &buffer[0] ) ) {
+
+      return false;
+    }
+
+    for( size_t x = 0; x < n; ++x ) {
+
+      float v( buffer[x] );
+      foreground[x] = ( v != 0.0f ) && ( v != j.nodata ) && ( v == v );
+    }
+
+    return true;
+  }
+
+  bool components::is_valid() const
+  {
+    return valid_;
+  }
+
+  size_t components::get_lines() const
+  {
+    return lines_;
+  }
+
+  size_t components::get_columns() const
+  {
+    return columns_;
+  }
+
+  components::connectivity components::get_connectivity() const
+  {
+    return neighbours_;
+  }
+
+  boost::shared_ptr<image::metadata> components::get_metadata() const
+  {
+    return metadata_;
+  }
+
+  size_t components::size() const
+  {
+    return components_.size();
+  }
+
+  const components::component&
+  components::get_component( boost::uint32_t label ) const
+  {
+    BOOST_ASSERT( ( label >= 1 ) && ( label <= components_.size() ) );
+
+    return components_[label - 1];
+  }
+
+  boost::uint32_t components::get_label( size_t i, size_t j ) const
+  {
+    return ( *labels_ )[i * columns_ + j];
+  }
+
+  const components::labels& components::get_labels() const
+  {
+    BOOST_ASSERT( labels_ );
+
+    return *labels_;
+  }
+
+  double components::get_map_area( boost::uint32_t label ) const
+  {
+    double area( get_component( label ).area );
+
+    if( metadata_ ) {
+
+      double ps( metadata_->get<0>() );
+      area *= ps * ps;
+    }
+
+    return area;
+  }
+
+  bool components::write_labels( const std::string& filename ) const
+  {
+    utility::profiler::scope profile( "components::write_labels" );
+
+    if( !valid_ ) {
+
+      return false;
+    }
+
+    // an unallocated image only for the size and georeferencing
+    image32 reference( lines_, columns_, 1 );
+    reference.set_metadata( metadata_ );
+
+    file_sink output( filename, reference, 1, 0.0, GDT_UInt32 );
+
+    if( !output.is_open() ) {
+
+      return false;
+    }
+
+    size_t block_lines( std::max( BLOCK_PIXELS / std::max( columns_,
+                                                           size_t( 1 ) ),
+                                  static_cast<size_t>( 1 ) ) );
+
+    for( size_t l1 = 0; l1 < lines_; l1 += block_lines ) {
+
+      size_t l2( std::min( l1 + block_lines, lines_ ) );
+
+      if( !output.write( 1, l1, l2, labels_->get() + l1 * columns_,
+                         GDT_UInt32 ) ) {
+
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  Kernel::Point_2 components::to_map( size_t line, size_t column ) const
+  {
+    if( !metadata_ ) {
+
+      return Kernel::Point_2( static_cast<double>( column ),
+                              -static_cast<double>( line ) );
+    }
+
+    double ps( metadata_->get<0>() );
+    const CGAL::Bbox_2& bb( metadata_->get<1>() );
+
+    return Kernel::Point_2( bb.xmin() + column * ps, bb.ymax() - line * ps );
+  }
+
+  components::polygon_with_holes
+  components::polygonise( boost::uint32_t label ) const
+  {
+    const component& comp( get_component( label ) );
+    const image::window& w( comp.bounds );
+
+    size_t height( w.l2 - w.l1 );
+    size_t width ( w.c2 - w.c1 );
+    size_t stride( width + 1 );
+
+    const labels& l( *labels_ );
+
+    // edges leaving each corner of the bounds, a bit per direction, with
+    // the component on their right going down the lines
+    std::vector<unsigned char> out( ( height + 1 ) * stride, 0 );
+
+    for( size_t r = 0; r < height; ++r ) {
+
+      const boost::uint32_t* line( l.get() + ( w.l1 + r ) * columns_ + w.c1 );
+
+      for( size_t c = 0; c < width; ++c ) {
+
+        if( line[c] != label ) {
+
+          continue;
+        }
+
+        if( !r || ( line[c - columns_] != label ) ) {
+
+          out[r * stride + c] |= 1 << East;
+        }
+
+        if( ( c + 1 == width ) || ( line[c + 1] != label ) ) {
+
+          out[r * stride + c + 1] |= 1 << South;
+        }
+
+        if( ( r + 1 == height ) || ( line[c + columns_] != label ) ) {
+
+          out[( r + 1 ) * stride + c + 1] |= 1 << West;
+        }
+
+        if( !c || ( line[c - 1] != label ) ) {
+
+          out[( r + 1 ) * stride + c] |= 1 << North;
+        }
+      }
+    }
+
+    // where two edges leave a corner of diagonal pixels, turning left keeps
+    // them in one ring and turning right keeps them apart
+    bool turn_left( neighbours_ == Eight );
+    long step[] = { 1, static_cast<long>( stride ), -1,
+                    -static_cast<long>( stride ) };
+
+    polygon outer;
+    std::vector<polygon> holes;
+
+    for( size_t v = 0; v < out.size(); ++v ) {
+
+      while( out[v] ) {
+
+        int start_d( 0 );
+
+        while( !( out[v] & ( 1 << start_d ) ) ) {
+
+          ++start_d;
+        }
+
+        // corners of the ring, the start edge taken last to close it
+        std::vector<size_t> corners;
+        size_t at( v );
+        int d( start_d );
+
+        for( ;; ) {
+
+          at += step[d];
+
+          int left( ( d + 3 ) % 4 );
+          int right( ( d + 1 ) % 4 );
+          bool has_left( out[at] & ( 1 << left ) );
+          bool has_right( out[at] & ( 1 << right ) );
+
+          int next( d );
+
+          if( has_left && has_right ) {
+
+            next = turn_left ? left : right;
+
+          } else if( has_left ) {
+
+            next = left;
+
+          } else if( has_right ) {
+
+            next = right;
+          }
+
+          if( ( at == v ) && ( next == start_d ) ) {
+
+            if( d != start_d ) {
+
+              corners.push_back( v );
+            }
+
+            break;
+          }
+
+          BOOST_ASSERT( out[at] & ( 1 << next ) );
+
+          if( next != d ) {
+
+            corners.push_back( at );
+          }
+
+          out[at] &= ~( 1 << next );
+          d = next;
+        }
+
+        out[v] &= ~( 1 << start_d );
+
+        // twice the area with lines going up, negative for the clockwise
+        // outer ring as traced, which is then reversed
+        long area( 0 );
+        polygon ring;
+
+        for( size_t k = corners.size(); k > 0; --k ) {
+
+          size_t p( corners[k % corners.size()] );
+          size_t q( corners[k - 1] );
+
+          long pr( p / stride ), pc( p % stride );
+          long qr( q / stride ), qc( q % stride );
+
+          area += pc * ( -qr ) - qc * ( -pr );
+          ring.push_back( to_map( w.l1 + qr, w.c1 + qc ) );
+        }
+
+        if( area > 0 ) {
+
+          outer = ring;
+
+        } else {
+
+          holes.push_back( ring );
+        }
+      }
+    }
+
+    polygon_with_holes result( outer );
+
+    for( size_t k = 0; k < holes.size(); ++k ) {
+
+      result.add_hole( holes[k] );
+    }
+
+    return result;
+  }
+
+  std::vector<components::polygon_with_holes>
+  components::polygonise( boost::uint64_t min_area, size_t threads ) const
+  {
+    utility::profiler::scope profile( "components::polygonise" );
+
+    std::vector<boost::uint32_t> selected;
+
+    for( size_t k = 0; k < components_.size(); ++k ) {
+
+      if( components_[k].area >= min_area ) {
+
+        selected.push_back( k + 1 );
+      }
+    }
+
+    std::vector<polygon_with_holes> result( selected.size() );
+
+    if( selected.empty() ) {
+
+      return result;
+    }
+
+    size_t next( 0 );
+    boost::mutex mutex;
+
+    run_threads( boost::bind( &components::polygonise_components, this,
+                              &selected, &result, &next, &mutex ),
+                 thread_count( threads, selected.size() ) );
+
+    return result;
+  }
+
+  void components::polygonise_components(
+    const components* self, std::vector<boost::uint32_t>* selected,
+    std::vector<polygon_with_holes>* out, size_t* next, boost::mutex* mutex )
+  {
+    for( ;; ) {
+
+      size_t k;
+
+      {
+        boost::lock_guard<boost::mutex> lock( *mutex );
+
+        if( *next >= selected->size() ) {
+
+          return;
+        }
+
+        k = ( *next )++;
+      }
+
+      ( *out )[k] = self->polygonise( ( *selected )[k] );
+    }
+  }
+
+}
@@ -0,0 +1,150 @@
+#ifndef CANVAS_COMPONENTS_HPP
+#define CANVAS_COMPONENTS_HPP
+
+#include <canvas/change_mask.hpp>
+#include <canvas/image.hpp>
+
+#include <utility/mapped_memory.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <CGAL/Polygon_2.h>
+#include <CGAL/Polygon_with_holes_2.h>
+
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // Connected regions of the foreground of a mask, labelled 1, 2, ... in
+  // the raster order of their first pixel (0 is background).
+  //
+  // Strips of lines are labelled by several threads with a union-find each,
+  // then the pieces touching across strip boundaries are merged and the
+  // labels renumbered in a second pass. Only a strip per thread is read at
+  // a time and the labels are kept in mapped memory, so masks larger than
+  // memory can be labelled from their dataset.
+  class components : private boost::noncopyable {
+
+  public:
+    typedef boost::shared_ptr<components> ptr;
+
+    typedef utility::mapped_memory<boost::uint32_t> labels;
+
+    typedef boost::shared_ptr<labels> labels_ptr;
+
+    typedef CGAL::Polygon_2<Kernel> polygon;
+
+    typedef CGAL::Polygon_with_holes_2<Kernel> polygon_with_holes;
+
+    // neighbours sharing an edge, or an edge or a corner
+    enum connectivity { Four=4, Eight=8 };
+
+    // pixels labelled together, per thread
+    static const size_t BLOCK_PIXELS = 1048576;
+
+    struct component {
+
+      component() : area( 0 ), line( 0.0 ), column( 0.0 )
+      {
+        bounds.l1 = bounds.c1 = bounds.l2 = bounds.c2 = 0;
+      }
+
+      boost::uint64_t area;             // pixels
+
+      image::window bounds;
+
+      double line;                      // centroid, pixel centres at .5
+
+      double column;
+
+    };
+
+    // foreground: pixels of the band neither 0 nor nodata
+    components( const image& mask, size_t band_number = 1,
+                connectivity neighbours = Eight, size_t threads = 0 );
+
+    // foreground: pixels set in the mask, georeferenced by md if given
+    components( const change_mask& mask,
+                const boost::shared_ptr<image::metadata>& md,
+                connectivity neighbours = Eight, size_t threads = 0 );
+
+    // false if the mask could not be read
+    bool is_valid() const;
+
+    size_t get_lines() const;
+
+    size_t get_columns() const;
+
+    connectivity get_connectivity() const;
+
+    boost::shared_ptr<image::metadata> get_metadata() const;
+
+    // number of components
+    size_t size() const;
+
+    const component& get_component( boost::uint32_t label ) const;
+
+    boost::uint32_t get_label( size_t i, size_t j ) const;
+
+    const labels& get_labels() const;
+
+    // area in squared map units, in pixels without metadata
+    double get_map_area( boost::uint32_t label ) const;
+
+    // the labels as a single UInt32 band with the mask georeferencing
+    bool write_labels( const std::string& filename ) const;
+
+    // outline of a component in map coordinates (x right, y up), pixel
+    // coordinates with y = -line without metadata. The outer ring is
+    // counterclockwise and holes clockwise, with a vertex at every corner
+    // only. Rings of diagonal pixels touch themselves at the shared corner
+    // with 8-connectivity.
+    polygon_with_holes polygonise( boost::uint32_t label ) const;
+
+    // components of at least min_area pixels, in label order
+    std::vector<polygon_with_holes> polygonise( boost::uint64_t min_area = 0,
+                                                size_t threads = 0 ) const;
+
+  private:
+    struct job;
+
+    void label( job& j, size_t threads );
+
+    static void label_strips( components* self, job* j );
+
+    static void relabel_strips( components* self, job* j );
+
+    static void polygonise_components( const components* self,
+                                       std::vector<boost::uint32_t>* selected,
+                                       std::vector<polygon_with_holes>* out,
+                                       size_t* next, boost::mutex* mutex );
+
+    // foreground of lines [l1, l2), false if it could not be read
+    bool read_foreground( const job& j, size_t l1, size_t l2,
+                          std::vector<unsigned char>& foreground,
+                          std::vector<float>& buffer ) const;
+
+    Kernel::Point_2 to_map( size_t line, size_t column ) const;
+
+    size_t lines_;
+
+    size_t columns_;
+
+    connectivity neighbours_;
+
+    boost::shared_ptr<image::metadata> metadata_;
+
+    labels_ptr labels_;
+
+    std::vector<component> components_;
+
+    bool valid_;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,479 @@
+#include <canvas/convolution.hpp>
+
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace canvas {
+
+  namespace {
+
+    // weights of valid pixels in the coverage sums: absolute weights when
+    // normalising, otherwise 1 for every tap so that counts stay exact
+    std::vector<float> coverage( const std::vector<float>& weights,
+                                 bool normalise )
+    {
+      std::vector<float> result( weights.size() );
+
+      for( size_t k = 0; k < weights.size(); ++k ) {
+
+        result[k] = normalise ? std::fabs( weights[k] )
+                              : ( ( weights[k] != 0.0f ) ? 1.0f : 0.0f );
+      }
+
+      return result;
+    }
+
+    // out[j] = sum over t of w[t] * in[j + t], for j in [0, n)
+    void correlate( const float* in, const float* w, size_t taps, float* out,
+                    size_t n )
+    {
+      std::fill_n( out, n, 0.0f );
+
+      for( size_t t = 0; t < taps; ++t ) {
+
+        const float weight( w[t] );
+        const float* in_ptr( in + t );
+
+        for( size_t j = 0; j < n; ++j ) {
+
+          out[j] += weight * in_ptr[j];
+        }
+      }
+    }
+
+    // out[j] += w * in[j], for j in [0, n)
+    void accumulate( const float* in, float w, float* out, size_t n )
+    {
+      for( size_t j = 0; j < n; ++j ) {
+
+        out[j] += w * in[j];
+      }
+    }
+
+  }
+
+  kernel::kernel( const std::vector<float>& vertical,
+                  const std::vector<float>& horizontal )
+    : separable_( true ), lines_( vertical.size() ),
+      columns_( horizontal.size() ), vertical_( vertical ),
+      horizontal_( horizontal )
+  {
+    BOOST_ASSERT( lines_ % 2 == 1 );
+    BOOST_ASSERT( columns_ % 2 == 1 );
+
+    weights_.reserve( lines_ * columns_ );
+
+    for( size_t i = 0; i < lines_; ++i ) {
+
+      for( size_t j = 0; j < columns_; ++j ) {
+
+        weights_.push_back( vertical_[i] * horizontal_[j] );
+      }
+    }
+  }
+
+  kernel::kernel( size_t lines, size_t columns,
+                  const std::vector<float>& weights )
+    : separable_( false ), lines_( lines ), columns_( columns ),
+      weights_( weights )
+  {
+    BOOST_ASSERT( lines_ % 2 == 1 );
+    BOOST_ASSERT( columns_ % 2 == 1 );
+    BOOST_ASSERT( weights_.size() == lines_ * columns_ );
+  }
+
+  kernel kernel::gaussian( double sigma, size_t radius )
+  {
+    BOOST_ASSERT( sigma > 0.0 );
+
+    if( radius == 0 ) {
+
+      radius = static_cast<size_t>( std::ceil( 3.0 * sigma ) );
+    }
+
+    std::vector<float> w( 2 * radius + 1 );
+    double sum( 0.0 );
+
+    for( size_t t = 0; t < w.size(); ++t ) {
+
+      double x( static_cast<double>( t ) - radius );
+      double value( std::exp( -x * x / ( 2.0 * sigma * sigma ) ) );
+      w[t] = static_cast<float>( value );
+      sum += value;
+    }
+
+    for( size_t t = 0; t < w.size(); ++t ) {
+
+      w[t] = static_cast<float>( w[t] / sum );
+    }
+
+    return kernel( w, w );
+  }
+
+  kernel kernel::box( size_t radius )
+  {
+    std::vector<float> w( 2 * radius + 1, 1.0f / ( 2 * radius + 1 ) );
+    return kernel( w, w );
+  }
+
+  kernel kernel::sobel_x()
+  {
+    static const float smooth[] = { 1.0f, 2.0f, 1.0f };
+    static const float derive[] = { -1.0f, 0.0f, 1.0f };
+
+    return kernel( std::vector<float>( smooth, smooth + 3 ),
+                   std::vector<float>( derive, derive + 3 ) );
+  }
+
+  kernel kernel::sobel_y()
+  {
+    static const float smooth[] = { 1.0f, 2.0f, 1.0f };
+    static const float derive[] = { -1.0f, 0.0f, 1.0f };
+
+    return kernel( std::vector<float>( derive, derive + 3 ),
+                   std::vector<float>( smooth, smooth + 3 ) );
+  }
+
+  bool kernel::is_separable() const
+  {
+    return separable_;
+  }
+
+  size_t kernel::get_radius_x() const
+  {
+    return columns_ / 2;
+  }
+
+  size_t kernel::get_radius_y() const
+  {
+    return lines_ / 2;
+  }
+
+  const std::vector<float>& kernel::get_vertical() const
+  {
+    return vertical_;
+  }
+
+  const std::vector<float>& kernel::get_horizontal() const
+  {
+    return horizontal_;
+  }
+
+  const std::vector<float>& kernel::get_weights() const
+  {
+    return weights_;
+  }
+
+  convolution::convolution( const kernel& k, border_mode border,
+                            bool normalise, double constant )
+    : kernel_( k ), border_( border ), normalise_( normalise ),
+      constant_( static_cast<float>( constant ) ), total_( 0.0f )
+  {
+    std::vector<float> w( coverage( kernel_.get_weights(), normalise_ ) );
+
+    for( size_t t = 0; t < w.size(); ++t ) {
+
+      total_ += w[t];
+    }
+  }
+
+  image32::ptr convolution::apply( const image& input, double nodata,
+                                   size_t threads ) const
+  {
+    utility::profiler::scope profile( "convolution::apply" );
+
+    image32::ptr result(
+      band_sink::create( input, input.get_channels(), nodata )
+    );
+
+    band_sink output( result );
+
+    if( !run( input, output, static_cast<float>( nodata ), threads ) ) {
+
+      result.reset();
+    }
+
+    return result;
+  }
+
+  bool convolution::apply( const image& input, const std::string& filename,
+                           double nodata, size_t threads ) const
+  {
+    utility::profiler::scope profile( "convolution::apply_file" );
+
+    file_sink output( filename, input, input.get_channels(), nodata );
+
+    if( !output.is_open() ) {
+
+      return false;
+    }
+
+    return run( input, output, static_cast<float>( nodata ), threads );
+  }
+
+  bool convolution::run( const image& input, block_sink& output,
+                         float nodata, size_t threads ) const
+  {
+    size_t lines  ( input.get_lines()   );
+    size_t columns( input.get_columns() );
+
+    if( !lines || !columns ) {
+
+      return true;
+    }
+
+    // blocks at least twice the halo keep the extra reads in proportion
+    size_t block_lines( std::max( BLOCK_PIXELS / columns,
+                                  2 * kernel_.get_radius_y() ) );
+    block_lines = std::max( block_lines, static_cast<size_t>( 1 ) );
+
+    size_t blocks( ( lines + block_lines - 1 ) / block_lines );
+
+    size_t next( 0 );
+    bool ok( true );
+    boost::mutex mutex;
+
+    utility::thread_pool::global().run(
+      boost::bind( &convolution::run_blocks, this, &input, &output, nodata,
+                   &next, blocks, block_lines, &ok, &mutex ),
+      utility::thread_pool::get_threads( threads, blocks )
+    );
+
+    return ok;
+  }
+
+  void convolution::run_blocks( const image* input, block_sink* output,
+                                float nodata, size_t* next, size_t blocks,
+                                size_t block_lines, bool* ok,
+                                boost::mutex* mutex ) const
+  {
+    long lines  ( input->get_lines()   );
+    long columns( input->get_columns() );
+
+    size_t rx( kernel_.get_radius_x() );
+    size_t ry( kernel_.get_radius_y() );
+
+    // padded block: the block lines and columns with the halo around them
+    size_t width ( columns + 2 * rx );
+    size_t height( block_lines + 2 * ry );
+
+    std::vector<float> raw( height * columns );
+    std::vector<float> values( height * width );
+    std::vector<float> mask( height * width );
+
+    std::vector<float> h_values;
+    std::vector<float> h_mask;
+
+    if( kernel_.is_separable() ) {
+
+      h_values.resize( height * columns );
+      h_mask.resize( height * columns );
+    }
+
+    std::vector<float> out_values( block_lines * columns );
+    std::vector<float> out_mask( block_lines * columns );
+
+    std::vector<float> horizontal(
+      coverage( kernel_.get_horizontal(), normalise_ )
+    );
+    std::vector<float> vertical( coverage( kernel_.get_vertical(), normalise_ ) );
+    std::vector<float> weights( coverage( kernel_.get_weights(), normalise_ ) );
+
+    for( ;; ) {
+
+      size_t b;
+
+      {
+        boost::lock_guard<boost::mutex> lock( *mutex );
+
+        if( !*ok || ( *next >= blocks ) ) {
+
+          return;
+        }
+
+        b = ( *next )++;
+      }
+
+      long l1( b * block_lines );
+      long l2( std::min( l1 + static_cast<long>( block_lines ), lines ) );
+
+      size_t n_lines( l2 - l1 );
+      size_t n_padded( n_lines + 2 * ry );
+
+      // lines read: the block and its halo, within the image
+      long r1( std::max( l1 - static_cast<long>( ry ), 0L ) );
+      long r2( std::min( l2 + static_cast<long>( ry ), lines ) );
+
+      for( size_t k = 1; k <= input->get_channels(); ++k ) {
+
+        if( !input->read_window( k, r1, 0, r2, columns, &raw[0] ) ) {
+
+          boost::lock_guard<boost::mutex> lock( *mutex );
+          *ok = false;
+          return;
+        }
+
+        float nd( static_cast<float>( input->get_nodata( k ) ) );
+
+        for( size_t r = 0; r < n_padded; ++r ) {
+
+          float* v_ptr( &values[r * width] );
+          float* m_ptr( &mask[r * width] );
+
+          long source( map( l1 - static_cast<long>( ry ) + r, lines ) );
+
+          if( source < 0 ) {
+
+            std::fill_n( v_ptr, width, ( border_ == Nodata ) ? 0.0f
+                                                             : constant_ );
+            std::fill_n( m_ptr, width, ( border_ == Nodata ) ? 0.0f : 1.0f );
+            continue;
+          }
+
+          source = std::min( std::max( source, r1 ), r2 - 1 );
+
+          const float* line_ptr( &raw[( source - r1 ) * columns] );
+
+          for( long c = 0; c < static_cast<long>( width ); ++c ) {
+
+            long j( map( c - static_cast<long>( rx ), columns ) );
+
+            float value( ( j < 0 ) ? constant_ : line_ptr[j] );
+            bool valid( ( j >= 0 ) ? ( value == value ) && ( value != nd )
+                                   : ( border_ != Nodata ) );
+
+            v_ptr[c] = valid ? value : 0.0f;
+            m_ptr[c] = valid ? 1.0f : 0.0f;
+          }
+        }
+
+        if( kernel_.is_separable() ) {
+
+          const std::vector<float>& h( kernel_.get_horizontal() );
+
+          for( size_t r = 0; r < n_padded; ++r ) {
+
+            correlate( &values[r * width], &h[0], h.size(),
+                       &h_values[r * columns], columns );
+            correlate( &mask[r * width], &horizontal[0], h.size(),
+                       &h_mask[r * columns], columns );
+          }
+
+          const std::vector<float>& v( kernel_.get_vertical() );
+
+          for( size_t i = 0; i < n_lines; ++i ) {
+
+            float* ov_ptr( &out_values[i * columns] );
+            float* om_ptr( &out_mask[i * columns] );
+
+            std::fill_n( ov_ptr, columns, 0.0f );
+            std::fill_n( om_ptr, columns, 0.0f );
+
+            for( size_t t = 0; t < v.size(); ++t ) {
+
+              accumulate( &h_values[( i + t ) * columns], v[t], ov_ptr,
+                          columns );
+              accumulate( &h_mask[( i + t ) * columns], vertical[t], om_ptr,
+                          columns );
+            }
+          }
+
+        } else {
+
+          const std::vector<float>& w( kernel_.get_weights() );
+          size_t taps( 2 * rx + 1 );
+
+          for( size_t i = 0; i < n_lines; ++i ) {
+
+            float* ov_ptr( &out_values[i * columns] );
+            float* om_ptr( &out_mask[i * columns] );
+
+            std::fill_n( ov_ptr, columns, 0.0f );
+            std::fill_n( om_ptr, columns, 0.0f );
+
+            for( size_t a = 0; a < 2 * ry + 1; ++a ) {
+
+              for( size_t t = 0; t < taps; ++t ) {
+
+                accumulate( &values[( i + a ) * width + t], w[a * taps + t],
+                            ov_ptr, columns );
+                accumulate( &mask[( i + a ) * width + t],
+                            weights[a * taps + t], om_ptr, columns );
+              }
+            }
+          }
+        }
+
+        // a tap count is exact, a weight sum only up to rounding
+        const float full( normalise_ ? total_ * ( 1.0f - 1e-6f )
+                                     : total_ - 0.5f );
+
+        for( size_t i = 0; i < n_lines; ++i ) {
+
+          float* ov_ptr( &out_values[i * columns] );
+          const float* om_ptr( &out_mask[i * columns] );
+          const float* centre_ptr( &mask[( i + ry ) * width + rx] );
+
+          for( long j = 0; j < columns; ++j ) {
+
+            float covered( om_ptr[j] );
+
+            if( ( centre_ptr[j] == 0.0f ) || ( covered <= 0.0f ) ) {
+
+              ov_ptr[j] = nodata;
+
+            } else if( covered < full ) {
+
+              ov_ptr[j] = normalise_ ? ov_ptr[j] * ( total_ / covered )
+                                     : nodata;
+            }
+          }
+        }
+
+        if( !output->write( k, l1, l2, &out_values[0] ) ) {
+
+          boost::lock_guard<boost::mutex> lock( *mutex );
+          *ok = false;
+          return;
+        }
+      }
+    }
+  }
+
+  long convolution::map( long index, long size ) const
+  {
+    if( ( index >= 0 ) && ( index < size ) ) {
+
+      return index;
+    }
+
+    switch( border_ ) {
+
+      case Replicate:
+        return ( index < 0 ) ? 0 : size - 1;
+
+      case Reflect: {
+
+        long period( 2 * ( size - 1 ) );
+
+        if( period == 0 ) {
+
+          return 0;
+        }
+
+        index = std::labs( index ) % period;
+        return ( index < size ) ? index : period - index;
+      }
+
+      default:
+        return -1;
+    }
+  }
+
+}
@@ -0,0 +1,118 @@
+#ifndef CANVAS_CONVOLUTION_HPP
+#define CANVAS_CONVOLUTION_HPP
+
+#include <canvas/block_sink.hpp>
+#include <canvas/image32.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // Weights of a filter with odd sizes, centred on the pixel, applied as
+  // given (not flipped). Separable kernels are the outer product of a
+  // vertical and a horizontal factor and run as two 1-D passes.
+  class kernel {
+
+  public:
+    kernel( const std::vector<float>& vertical,
+            const std::vector<float>& horizontal );
+
+    // lines x columns weights, line by line
+    kernel( size_t lines, size_t columns, const std::vector<float>& weights );
+
+    // radius 0 means ceil( 3 sigma )
+    static kernel gaussian( double sigma, size_t radius = 0 );
+
+    static kernel box( size_t radius );
+
+    // gradients along columns (x) and lines (y)
+    static kernel sobel_x();
+
+    static kernel sobel_y();
+
+    bool is_separable() const;
+
+    size_t get_radius_x() const;
+
+    size_t get_radius_y() const;
+
+    const std::vector<float>& get_vertical() const;
+
+    const std::vector<float>& get_horizontal() const;
+
+    // all weights line by line, the outer product if separable
+    const std::vector<float>& get_weights() const;
+
+  private:
+    bool separable_;
+
+    size_t lines_;
+
+    size_t columns_;
+
+    std::vector<float> vertical_;
+
+    std::vector<float> horizontal_;
+
+    std::vector<float> weights_;
+
+  };
+
+  // Convolution of every band of an image, computed over blocks of lines
+  // (with the halo lines read around them) by several threads. Only the
+  // blocks being filtered are held in memory, so images that do not fit
+  // can be filtered from their dataset into a file.
+  //
+  // Nodata pixels do not contribute. With normalisation the sum is rescaled
+  // by the share of absolute kernel weight that fell on valid pixels;
+  // without it any nodata neighbour makes the result nodata. Pixels that
+  // are nodata themselves stay nodata.
+  class convolution {
+
+  public:
+    // outside the image: a constant value, the nearest edge pixel, the
+    // image mirrored about its edge pixels, or nodata
+    enum border_mode { Constant=0, Replicate=1, Reflect=2, Nodata=3 };
+
+    // pixels filtered together, per thread
+    static const size_t BLOCK_PIXELS = 65536;
+
+    convolution( const kernel& k, border_mode border = Reflect,
+                 bool normalise = true, double constant = 0.0 );
+
+    image32::ptr apply( const image& input, double nodata = -9999.0,
+                        size_t threads = 0 ) const;
+
+    bool apply( const image& input, const std::string& filename,
+                double nodata = -9999.0, size_t threads = 0 ) const;
+
+  private:
+    bool run( const image& input, block_sink& output, float nodata,
+              size_t threads ) const;
+
+    void run_blocks( const image* input, block_sink* output, float nodata,
+                     size_t* next, size_t blocks, size_t block_lines,
+                     bool* ok, boost::mutex* mutex ) const;
+
+    // index inside [0, size) for index outside it, -1 if there is none
+    long map( long index, long size ) const;
+
+    kernel kernel_;
+
+    border_mode border_;
+
+    bool normalise_;
+
+    float constant_;
+
+    // coverage of a pixel with only valid neighbours
+    float total_;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef CANVAS_HISTOGRAM_HPP
+#define CANVAS_HISTOGRAM_HPP
+
+#include <boost/assert.hpp>
+#include <boost/cstdint.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace canvas {
+
+  // Counts of every value of an 8 or 16 bit unsigned band.
+  template <typename num_type>
+  class histogram {
+
+  public:
+    static const size_t BINS = size_t( 1 ) << ( 8 * sizeof( num_type ) );
+
+    histogram() : counts_( BINS, 0 ), total_( 0 )
+    {
+    }
+
+    void add( const num_type* first, const num_type* last )
+    {
+      boost::uint64_t* counts( &counts_[0] );
+
+      for( const num_type* it = first; it != last; ++it ) {
+
+        ++counts[*it];
+      }
+
+      total_ += last - first;
+    }
+
+    // drops the counts of a value, the nodata value once all are added
+    void discard( double value )
+    {
+      if( ( value >= 0.0 ) && ( value < BINS ) &&
+          ( std::floor( value ) == value ) ) {
+
+        boost::uint64_t& count( counts_[static_cast<size_t>( value )] );
+        total_ -= count;
+        count = 0;
+      }
+    }
+
+    void merge( const histogram& other )
+    {
+      for( size_t v = 0; v < BINS; ++v ) {
+
+        counts_[v] += other.counts_[v];
+      }
+
+      total_ += other.total_;
+    }
+
+    boost::uint64_t get_count( num_type value ) const
+    {
+      return counts_[value];
+    }
+
+    boost::uint64_t get_total() const
+    {
+      return total_;
+    }
+
+    // smallest value with at least fraction of the counts at or below it,
+    // the minimum for 0 (and 0 if nothing was counted)
+    num_type percentile( double fraction ) const
+    {
+      BOOST_ASSERT( ( fraction >= 0.0 ) && ( fraction <= 1.0 ) );
+
+      double target( fraction * total_ );
+      boost::uint64_t cumulative( 0 );
+
+      for( size_t v = 0; v < BINS; ++v ) {
+
+        cumulative += counts_[v];
+
+        if( cumulative && ( cumulative >= target ) ) {
+
+          return static_cast<num_type>( v );
+        }
+      }
+
+      return 0;
+    }
+
+  private:
+    std::vector<boost::uint64_t> counts_;
+
+    boost::uint64_t total_;
+
+  };
+
+}
+
+#endif
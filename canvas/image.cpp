@@ -1,15 +1,357 @@
 
 #include <canvas/image.hpp>
+#include <canvas/block_reader.hpp>
+#include <canvas/image_factory.hpp>
+
+#include <utility/memory_budget.hpp>
+#include <utility/thread_pool.hpp>
 
 #include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/once.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
 
 namespace canvas {
 
+  namespace {
+
+    void set_gdal_cache( const boost::uint64_t& bytes )
+    {
+      GDALSetCacheMax64( static_cast<GIntBig>( bytes ) );
+    }
+
+    boost::once_flag cache_handler_once = BOOST_ONCE_INIT;
+
+    void install_cache_handler()
+    {
+      utility::memory_budget::set_cache_handler( &set_gdal_cache );
+    }
+
+    // every image is a client of the memory budget, which sizes GDAL's
+    // block cache to the share of the budget left for it
+    void register_image()
+    {
+      boost::call_once( &install_cache_handler, cache_handler_once );
+      utility::memory_budget::register_client();
+    }
+
+    // pixels a corner of an overlap may be off a pixel edge by rounding
+    const double EDGE_TOLERANCE = 1e-6;
+
+    // the pixel edge below position, or above it with up, within
+    // [0, limit]
+    size_t edge( double position, bool up, size_t limit )
+    {
+      double e( up ? std::ceil( position - EDGE_TOLERANCE )
+                   : std::floor( position + EDGE_TOLERANCE ) );
+
+      return static_cast<size_t>(
+        std::min( std::max( e, 0.0 ), static_cast<double>( limit ) )
+      );
+    }
+
+    // lines of the overlap per block and thread in detect_changes
+    const size_t CHANGE_BLOCK_PIXELS = 65536;
+
+    // lines read at a time by build_validity
+    const size_t VALIDITY_BLOCK_PIXELS = 1048576;
+
+    // values rounded and clamped to the range of num_type
+    template <typename num_type>
+    void store( const std::vector<float>& values, num_type* target )
+    {
+      float top( std::numeric_limits<num_type>::max() );
+
+      for( size_t i = 0; i < values.size(); ++i ) {
+
+        float v( ( values[i] == values[i] ) ? values[i] + 0.5f : 0.0f );
+        v = std::min( std::max( v, 0.0f ), top );
+        target[i] = static_cast<num_type>( v );
+      }
+    }
+
+    // shared by the threads of image::read_bands
+    struct strip_job {
+
+      // empty to read through dataset under io_mutex
+      std::string filename;
+
+      GDALDataset* dataset;
+
+      boost::mutex* io_mutex;
+
+      size_t l1;
+
+      size_t c1;
+
+      size_t l2;
+
+      size_t c2;
+
+      GDALDataType type;
+
+      const std::vector<void*>* buffers;
+
+      size_t strip_lines;
+
+      size_t strips;
+
+      // strips of every band, and the next one to read
+      size_t tasks;
+
+      size_t next;
+
+      bool ok;
+
+      boost::mutex mutex;
+
+    };
+
+    // strips taken in turn, band by band, until none are left; a worker
+    // opens its own dataset once for all the strips it reads
+    void read_strips( strip_job* job )
+    {
+      GDALDataset* dataset( job->dataset );
+
+      if( !job->filename.empty() ) {
+
+        dataset = ( GDALDataset* ) GDALOpen( job->filename.c_str(),
+                                             GA_ReadOnly );
+      }
+
+      bool ok( dataset != NULL );
+      size_t columns( job->c2 - job->c1 );
+      size_t line_bytes( columns * GDALGetDataTypeSizeBytes( job->type ) );
+
+      while( ok ) {
+
+        size_t task;
+
+        {
+          boost::lock_guard<boost::mutex> lock( job->mutex );
+
+          if( !job->ok || ( job->next >= job->tasks ) ) {
+
+            break;
+          }
+
+          task = job->next++;
+        }
+
+        size_t band_number( task / job->strips + 1 );
+        size_t l1( job->l1 + ( task % job->strips ) * job->strip_lines );
+        size_t l2( std::min( l1 + job->strip_lines, job->l2 ) );
+
+        char* out( static_cast<char*>( ( *job->buffers )[band_number - 1] )
+                   + ( l1 - job->l1 ) * line_bytes );
+
+        GDALRasterBand* b_handle = dataset->GetRasterBand( band_number );
+
+        // the shared dataset is read by one thread at a time
+        boost::unique_lock<boost::mutex> lock( *job->io_mutex,
+                                               boost::defer_lock );
+
+        if( job->filename.empty() ) {
+
+          lock.lock();
+        }
+
+        CPLErr e = image::raster_io( b_handle, GF_Read, job->c1, l1,
+                                     columns, l2 - l1, out, columns,
+                                     l2 - l1, job->type, 0, 0 );
+
+        ok = ( e == CE_None );
+      }
+
+      if( dataset && !job->filename.empty() ) {
+
+        GDALClose( dataset );
+      }
+
+      if( !ok ) {
+
+        boost::lock_guard<boost::mutex> lock( job->mutex );
+        job->ok = false;
+      }
+    }
+
+    // shared by the threads of image::detect_changes
+    struct change_job {
+
+      const image* first;
+
+      const image* second;
+
+      image::window t_w;
+
+      image::window o_w;
+
+      std::vector<float> thresholds;
+
+      change_mask* mask;
+
+      size_t block_lines;
+
+      size_t blocks;
+
+      size_t next;
+
+      bool ok;
+
+      boost::mutex mutex;
+
+      // sums of the changed differences, merged from every thread
+      std::vector<double> sum;
+
+      std::vector<double> sum2;
+
+    };
+
+    void detect_blocks( change_job* job )
+    {
+      size_t columns( job->t_w.c2 - job->t_w.c1 );
+      size_t lines  ( job->t_w.l2 - job->t_w.l1 );
+      size_t channels( job->first->get_channels() );
+
+      std::vector<float> a( job->block_lines * columns );
+      std::vector<float> b( job->block_lines * columns );
+
+      std::vector<change_mask::band_stats> stats( channels );
+      std::vector<double> sum( channels, 0.0 );
+      std::vector<double> sum2( channels, 0.0 );
+
+      std::vector<validity_mask::const_ptr> valid1( channels );
+      std::vector<validity_mask::const_ptr> valid2( channels );
+
+      for( size_t k = 1; k <= channels; ++k ) {
+
+        valid1[k - 1] = job->first->get_validity( k );
+        valid2[k - 1] = job->second->get_validity( k );
+      }
+
+      for( ;; ) {
+
+        size_t block;
+
+        {
+          boost::lock_guard<boost::mutex> lock( job->mutex );
+
+          if( !job->ok || ( job->next >= job->blocks ) ) {
+
+            break;
+          }
+
+          block = job->next++;
+        }
+
+        size_t l1( block * job->block_lines );
+        size_t l2( std::min( l1 + job->block_lines, lines ) );
+
+        for( size_t k = 1; k <= channels; ++k ) {
+
+          const validity_mask* m1( valid1[k - 1].get() );
+          const validity_mask* m2( valid2[k - 1].get() );
+
+          // blocks without a valid pixel in either image are not read
+          if( ( m1 && !m1->any( job->t_w.l1 + l1, job->t_w.c1,
+                                job->t_w.l1 + l2, job->t_w.c2 ) ) ||
+              ( m2 && !m2->any( job->o_w.l1 + l1, job->o_w.c1,
+                                job->o_w.l1 + l2, job->o_w.c2 ) ) ) {
+
+            continue;
+          }
+
+          if( !job->first->read_window( k, job->t_w.l1 + l1, job->t_w.c1,
+                                        job->t_w.l1 + l2, job->t_w.c2,
+                                        &a[0] ) ||
+              !job->second->read_window( k, job->o_w.l1 + l1, job->o_w.c1,
+                                         job->o_w.l1 + l2, job->o_w.c2,
+                                         &b[0] ) ) {
+
+            boost::lock_guard<boost::mutex> lock( job->mutex );
+            job->ok = false;
+            return;
+          }
+
+          float nd1( static_cast<float>( job->first->get_nodata( k ) ) );
+          float nd2( static_cast<float>( job->second->get_nodata( k ) ) );
+          float threshold( job->thresholds[k - 1] );
+
+          change_mask::band_stats& s( stats[k - 1] );
+
+          const float* a_ptr( &a[0] );
+          const float* b_ptr( &b[0] );
+
+          for( size_t i = l1; i < l2; ++i ) {
+
+            boost::uint64_t* line_ptr( job->mask->get_line( i ) );
+
+            for( size_t j = 0; j < columns; ++j, ++a_ptr, ++b_ptr ) {
+
+              if( ( *a_ptr == nd1 ) || ( *b_ptr == nd2 ) ) {
+
+                continue;
+              }
+
+              ++s.valid;
+
+              double d( std::fabs( *a_ptr - *b_ptr ) );
+
+              if( d > threshold ) {
+
+                s.minimum = s.changed ? std::min( s.minimum, d ) : d;
+                s.maximum = s.changed ? std::max( s.maximum, d ) : d;
+                ++s.changed;
+
+                sum[k - 1]  += d;
+                sum2[k - 1] += d * d;
+
+                line_ptr[j / 64] |=
+                  static_cast<boost::uint64_t>( 1 ) << ( j % 64 );
+              }
+            }
+          }
+        }
+      }
+
+      boost::lock_guard<boost::mutex> lock( job->mutex );
+
+      for( size_t k = 1; k <= channels; ++k ) {
+
+        change_mask::band_stats& total( job->mask->get_stats( k ) );
+        const change_mask::band_stats& s( stats[k - 1] );
+
+        if( s.changed ) {
+
+          total.minimum = total.changed ? std::min( total.minimum, s.minimum )
+                                        : s.minimum;
+          total.maximum = total.changed ? std::max( total.maximum, s.maximum )
+                                        : s.maximum;
+        }
+
+        total.valid   += s.valid;
+        total.changed += s.changed;
+
+        job->sum[k - 1]  += sum[k - 1];
+        job->sum2[k - 1] += sum2[k - 1];
+      }
+    }
+
+  }
+
   image::image( const size_t& lines,
                 const size_t& columns,
                 const size_t& channels )
-    : lines_( lines ), columns_( columns ), channels_( channels ), dataset_( 0 )
+    : lines_( lines ), columns_( columns ), channels_( channels ),
+      dataset_( 0 ), loaded_( false )
   {
+    register_image();
+
     BOOST_ASSERT( channels_ > 0 );
     nodata_.reset( new double[channels_] );
     BOOST_ASSERT( nodata_ != 0 );
@@ -19,8 +361,11 @@ namespace canvas {
   }
 
   image::image( const std::string& filename )
+    : loaded_( false )
   {
-    GDALAllRegister();
+    register_image();
+
+    image_factory::register_drivers();
 
     dataset_ = ( GDALDataset* ) GDALOpen( filename.c_str(), GA_ReadOnly );
 
@@ -30,42 +375,27 @@ namespace canvas {
       return;
     }
 
-    lines_    = dataset_->GetRasterXSize();
-    columns_  = dataset_->GetRasterYSize();
-    channels_ = dataset_->GetRasterCount();
+    filename_ = filename;
 
-    nodata_.reset( new double[channels_] );
-    double* nodata_ptr( nodata_.get() );
-    BOOST_ASSERT( nodata_ptr != 0 );
-
-    GDALRasterBand* band_handle;
-    int fetch;
-
-    for( size_t k = 1; k <= channels_; ++k, ++nodata_ptr ) {
+    set_description( image_factory::describe( filename, dataset_ ) );
 
-       band_handle = dataset_->GetRasterBand( k );
-       double null( band_handle->GetNoDataValue( &fetch ) );
-       *nodata_ptr = fetch ? null : 0.0;
-    }
-
-    if( dataset_->GetProjectionRef() != NULL ) {
+    driver_[".tif"] = "GTiff";
+    driver_[".img"] = "HFA";
 
-      double tmp[6];
+  }
 
-      if( dataset_->GetGeoTransform( tmp ) == CE_None ) {
+  image::image( GDALDataset* dataset, const std::string& filename,
+                const description& d )
+    : dataset_( dataset ), filename_( filename ), loaded_( false )
+  {
+    register_image();
 
-        double pixel_size( tmp[1] );
-        CGAL::Bbox_2 bb( tmp[0], tmp[3] - pixel_size * lines_,
-                         tmp[0] + pixel_size * columns_, tmp[3] );
-        std::string proj_tag( dataset_->GetProjectionRef() );
+    BOOST_ASSERT( dataset_ != NULL );
 
-        md_.reset( new metadata( pixel_size, bb, proj_tag ) );
-      }
-    }
+    set_description( d );
 
     driver_[".tif"] = "GTiff";
     driver_[".img"] = "HFA";
-
   }
 
   image::~image()
@@ -74,6 +404,8 @@ namespace canvas {
 
       GDALClose( dataset_ );
     }
+
+    utility::memory_budget::unregister_client();
   }
 
   const size_t& image::get_lines() const
@@ -98,53 +430,21 @@ namespace canvas {
     return nodata_[band_number - 1];
   }
 
+  void image::set_nodata( size_t band_number, const double& nodata )
+  {
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    nodata_[band_number - 1] = nodata;
+    validity_.clear();
+  }
+
   image::pixel_type image::get_pixel_type( const std::string& filename )
   {
     boost::filesystem::path p( filename );
 
     BOOST_ASSERT( p.is_file() );
 
-    try {
-
-      GDALAllRegister();
-
-      GDALDataset* dataset = ( GDALDataset* ) GDALOpen( filename.c_str(),
-                                                        GA_ReadOnly );
-
-      if( dataset == NULL ) {
-
-        std::cerr << "Unable to open image " << filename << std::endl;
-        return Undefined;
-      }
-
-      std::map<GDALDataType,pixel_type> type;
-
-      type[GDT_Byte] = Byte;
-      type[GDT_UInt16] = UInt16;
-      type[GDT_Float32] = Float32;
-
-      std::list<pixel_type> result;
-
-      int channels( dataset->GetRasterCount() );
-
-      for( size_t k = 1; k <= channels; ++k ) {
-
-        result.push_back(
-          type[dataset->GetRasterBand( k )->GetRasterDataType()]
-        );
-      }
-
-      result.sort();
-      result.unique();
-
-      return ( result.size() == 1 ) ? result.front() : Mixed;
-
-    } catch( ... ) {
-
-      std::cerr << "Unknown exception" << std::endl;
-    }
-
-    return Undefined;
+    return image_factory::get_pixel_type( filename );
   }
 
   boost::shared_ptr<image::metadata> image::get_metadata() const
@@ -152,6 +452,11 @@ namespace canvas {
     return md_;
   }
 
+  void image::set_metadata( const boost::shared_ptr<metadata>& md )
+  {
+    md_ = md;
+  }
+
   void image::display_info( const std::string& tag ) const
   {
     std::cout << tag << std::endl;
@@ -218,6 +523,389 @@ namespace canvas {
                   ( bb.ymax() - y ) / pixel_size );
   }
 
+  bool image::compute_overlap( const image& other, window& t_w,
+                               window& o_w ) const
+  {
+    boost::shared_ptr<metadata> t_md( this->get_metadata() );
+    boost::shared_ptr<metadata> o_md( other.get_metadata() );
+
+    if( !t_md || !o_md ) {
+
+      return false;
+    }
+
+    const CGAL::Bbox_2& t_bb( t_md->get<1>() );
+    const CGAL::Bbox_2& o_bb( o_md->get<1>() );
+
+    if( ( t_md->get<0>() != o_md->get<0>() ) ||
+        ( t_md->get<2>() != o_md->get<2>() ) ||
+          !CGAL::do_overlap( t_bb, o_bb ) ) {
+
+      return false;
+    }
+
+    double x[] = { t_bb.xmin(), t_bb.xmax(), o_bb.xmin(), o_bb.xmax() };
+    double y[] = { t_bb.ymin(), t_bb.ymax(), o_bb.ymin(), o_bb.ymax() };
+
+    std::sort( x, x + 4 );
+    std::sort( y, y + 4 );
+
+    Kernel::Point_2 ul( x[1], y[2] );
+    Kernel::Point_2 lr( x[2], y[1] );
+
+    pixel t_ul( this->compute_position( ul ) );
+    pixel t_lr( this->compute_position( lr ) );
+    pixel o_ul( other.compute_position( ul ) );
+    pixel o_lr( other.compute_position( lr ) );
+
+    t_w.l1 = edge( t_ul.get<1>(), false, lines_ );
+    t_w.c1 = edge( t_ul.get<0>(), false, columns_ );
+    t_w.l2 = edge( t_lr.get<1>(), true, lines_ );
+    t_w.c2 = edge( t_lr.get<0>(), true, columns_ );
+
+    o_w.l1 = edge( o_ul.get<1>(), false, other.get_lines() );
+    o_w.c1 = edge( o_ul.get<0>(), false, other.get_columns() );
+    o_w.l2 = edge( o_lr.get<1>(), true, other.get_lines() );
+    o_w.c2 = edge( o_lr.get<0>(), true, other.get_columns() );
+
+    // the pixels of both windows must match one to one
+    if( ( t_w.l2 - t_w.l1 != o_w.l2 - o_w.l1 ) ||
+        ( t_w.c2 - t_w.c1 != o_w.c2 - o_w.c1 ) ) {
+
+      std::cerr << "The overlap is not on the grid of both images"
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  change_mask::ptr image::detect_changes(
+    const image& other, const std::vector<double>& thresholds,
+    size_t threads ) const
+  {
+    utility::profiler::scope profile( "image::detect_changes" );
+
+    change_mask::ptr result;
+
+    BOOST_ASSERT( thresholds.size() == channels_ );
+    BOOST_ASSERT( other.get_channels() == channels_ );
+
+    change_job job;
+
+    if( !compute_overlap( other, job.t_w, job.o_w ) ) {
+
+      return result;
+    }
+
+    size_t lines  ( job.t_w.l2 - job.t_w.l1 );
+    size_t columns( job.t_w.c2 - job.t_w.c1 );
+
+    result.reset( new change_mask( lines, columns, channels_ ) );
+
+    if( !lines || !columns ) {
+
+      return result;
+    }
+
+    job.first  = this;
+    job.second = &other;
+    job.thresholds.assign( thresholds.begin(), thresholds.end() );
+    job.mask = result.get();
+    job.block_lines = std::max( CHANGE_BLOCK_PIXELS / columns,
+                                static_cast<size_t>( 1 ) );
+    job.blocks = ( lines + job.block_lines - 1 ) / job.block_lines;
+    job.next = 0;
+    job.ok = true;
+    job.sum.assign( channels_, 0.0 );
+    job.sum2.assign( channels_, 0.0 );
+
+    utility::thread_pool::global().run(
+      boost::bind( &detect_blocks, &job ),
+      utility::thread_pool::get_threads( threads, job.blocks )
+    );
+
+    if( !job.ok ) {
+
+      result.reset();
+      return result;
+    }
+
+    for( size_t k = 1; k <= channels_; ++k ) {
+
+      change_mask::band_stats& s( result->get_stats( k ) );
+
+      if( s.changed ) {
+
+        double n( static_cast<double>( s.changed ) );
+
+        s.mean = job.sum[k - 1] / n;
+        s.variance = ( n > 1.0 )
+          ? ( job.sum2[k - 1] - job.sum[k - 1] * s.mean ) / ( n - 1.0 ) : 0.0;
+      }
+    }
+
+    return result;
+  }
+
+  CPLErr image::raster_io( GDALRasterBand* b_handle, GDALRWFlag flag,
+                           int x_off, int y_off, int x_size, int y_size,
+                           void* buffer, int buf_x_size, int buf_y_size,
+                           GDALDataType type, GSpacing pixel_space,
+                           GSpacing line_space, GDALRasterIOExtraArg* extra )
+  {
+    if( !utility::profiler::enabled() ) {
+
+      return b_handle->RasterIO( flag, x_off, y_off, x_size, y_size, buffer,
+                                 buf_x_size, buf_y_size, type,
+                                 pixel_space, line_space, extra );
+    }
+
+    boost::int64_t start( utility::profiler::now() );
+
+    CPLErr e = b_handle->RasterIO( flag, x_off, y_off, x_size, y_size, buffer,
+                                   buf_x_size, buf_y_size, type,
+                                   pixel_space, line_space, extra );
+
+    boost::uint64_t bytes( static_cast<boost::uint64_t>( buf_x_size )
+                         * buf_y_size * GDALGetDataTypeSizeBytes( type ) );
+
+    utility::profiler::raster_io( start, bytes, flag == GF_Write );
+
+    return e;
+  }
+
+  bool image::read_bands( size_t l1, size_t c1, size_t l2, size_t c2,
+                          GDALDataType type,
+                          const std::vector<void*>& buffers,
+                          size_t threads ) const
+  {
+    utility::profiler::scope profile( "image::read_bands" );
+
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+    BOOST_ASSERT( buffers.size() <= channels_ );
+
+    if( dataset_ == NULL ) {
+
+      return false;
+    }
+
+    strip_job job;
+    job.dataset = dataset_;
+    job.io_mutex = &io_mutex_;
+    job.l1 = l1;
+    job.c1 = c1;
+    job.l2 = l2;
+    job.c2 = c2;
+    job.type = type;
+    job.buffers = &buffers;
+    job.strip_lines = std::max( STRIP_PIXELS / ( c2 - c1 ),
+                                static_cast<size_t>( 1 ) );
+    job.strips = ( l2 - l1 + job.strip_lines - 1 ) / job.strip_lines;
+    job.tasks = buffers.size() * job.strips;
+    job.next = 0;
+    job.ok = true;
+
+    // threads of several strips each open the file again, and a single
+    // thread reads through the open dataset
+    threads = utility::thread_pool::get_threads( threads,
+                                                 job.tasks / THREAD_STRIPS );
+
+    if( threads > 1 ) {
+
+      job.filename = filename_;
+    }
+
+    utility::thread_pool::global().run(
+      boost::bind( &read_strips, &job ), threads
+    );
+
+    return job.ok;
+  }
+
+  bool image::read_reduced( size_t l1, size_t c1, size_t l2, size_t c2,
+                            size_t lines, size_t columns, GDALDataType type,
+                            GDALRIOResampleAlg resampling,
+                            const std::vector<void*>& buffers ) const
+  {
+    utility::profiler::scope profile( "image::read_reduced" );
+
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+    BOOST_ASSERT( ( lines > 0 ) && ( columns > 0 ) );
+    BOOST_ASSERT( buffers.size() <= channels_ );
+
+    if( dataset_ == NULL ) {
+
+      for( size_t k = 0; k < buffers.size(); ++k ) {
+
+        if( !reduce_band( k + 1, l1, c1, l2, c2, lines, columns, type,
+                          resampling, buffers[k] ) ) {
+
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // GDAL reads from the overview closest to the buffer size, if any
+    GDALRasterIOExtraArg extra;
+    INIT_RASTERIO_EXTRA_ARG( extra );
+    extra.eResampleAlg = resampling;
+
+    boost::lock_guard<boost::mutex> lock( io_mutex_ );
+
+    for( size_t k = 0; k < buffers.size(); ++k ) {
+
+      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+
+      CPLErr e = raster_io( b_handle, GF_Read, c1, l1, c2 - c1, l2 - l1,
+                            buffers[k], columns, lines, type, 0, 0,
+                            &extra );
+
+      if( e != CE_None ) {
+
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool image::reduce_band( size_t band_number, size_t l1, size_t c1,
+                           size_t l2, size_t c2, size_t lines,
+                           size_t columns, GDALDataType type,
+                           GDALRIOResampleAlg resampling,
+                           void* buffer ) const
+  {
+    size_t width( c2 - c1 );
+    double y_step( static_cast<double>( l2 - l1 ) / lines );
+    double x_step( static_cast<double>( width ) / columns );
+
+    bool nearest( resampling == GRIORA_NearestNeighbour );
+    float nd( static_cast<float>( nodata_[band_number - 1] ) );
+
+    std::vector<float> values;
+    std::vector<float> line( columns );
+
+    for( size_t r = 0; r < lines; ++r ) {
+
+      // source lines of the output line, its centre line when nearest
+      size_t a( l1 + static_cast<size_t>( r * y_step ) );
+      size_t b( std::max( l1 + static_cast<size_t>( ( r + 1 ) * y_step ),
+                          a + 1 ) );
+
+      if( nearest ) {
+
+        a = l1 + static_cast<size_t>( ( r + 0.5 ) * y_step );
+        b = a + 1;
+      }
+
+      values.resize( ( b - a ) * width );
+
+      if( !read_window( band_number, a, c1, b, c2, &values[0] ) ) {
+
+        return false;
+      }
+
+      for( size_t c = 0; c < columns; ++c ) {
+
+        size_t j1( static_cast<size_t>( c * x_step ) );
+        size_t j2( std::max( static_cast<size_t>( ( c + 1 ) * x_step ),
+                             j1 + 1 ) );
+
+        if( nearest ) {
+
+          line[c] = values[static_cast<size_t>( ( c + 0.5 ) * x_step )];
+          continue;
+        }
+
+        // the mean of the valid pixels of the box, nodata without any
+        double sum( 0.0 );
+        size_t n( 0 );
+
+        for( size_t i = 0; i < b - a; ++i ) {
+
+          for( size_t j = j1; j < j2; ++j ) {
+
+            float v( values[i * width + j] );
+
+            if( ( v == v ) && ( v != nd ) ) {
+
+              sum += v;
+              ++n;
+            }
+          }
+        }
+
+        line[c] = n ? static_cast<float>( sum / n ) : nd;
+      }
+
+      size_t offset( r * columns );
+
+      switch( type ) {
+
+      case GDT_Byte:
+        store( line, static_cast<boost::uint8_t*>( buffer ) + offset );
+        break;
+
+      case GDT_UInt16:
+        store( line, static_cast<boost::uint16_t*>( buffer ) + offset );
+        break;
+
+      default:
+        BOOST_ASSERT( type == GDT_Float32 );
+        std::copy( line.begin(), line.end(),
+                   static_cast<float*>( buffer ) + offset );
+      }
+    }
+
+    return true;
+  }
+
+  boost::shared_ptr<image::metadata> image::get_window_metadata(
+    size_t l1, size_t c1, size_t l2, size_t c2, size_t lines,
+    size_t columns ) const
+  {
+    boost::shared_ptr<metadata> result;
+
+    if( md_ ) {
+
+      double pixel_size( md_->get<0>() );
+      const CGAL::Bbox_2& bb( md_->get<1>() );
+
+      CGAL::Bbox_2 window( bb.xmin() + c1 * pixel_size,
+                           bb.ymax() - l2 * pixel_size,
+                           bb.xmin() + c2 * pixel_size,
+                           bb.ymax() - l1 * pixel_size );
+
+      // pixels are taken square, from the reduction of the columns
+      result.reset( new metadata(
+        pixel_size * ( c2 - c1 ) / columns, window, md_->get<2>()
+      ) );
+    }
+
+    return result;
+  }
+
+  void image::get_preview_size( size_t size, size_t& lines,
+                                size_t& columns ) const
+  {
+    BOOST_ASSERT( size > 0 );
+
+    double scale( std::min( static_cast<double>( size ) /
+                              std::max( std::max( lines_, columns_ ),
+                                        static_cast<size_t>( 1 ) ),
+                            1.0 ) );
+
+    lines = std::max( static_cast<size_t>( lines_ * scale + 0.5 ),
+                      static_cast<size_t>( 1 ) );
+    columns = std::max( static_cast<size_t>( columns_ * scale + 0.5 ),
+                        static_cast<size_t>( 1 ) );
+  }
+
   bool image::is_valid( const pixel& px ) const
   {
     boost::shared_array<double> g( px.get<2>() );
@@ -240,4 +928,145 @@ namespace canvas {
     return false;
   }
 
+  bool image::build_validity( bool per_band )
+  {
+    utility::profiler::scope profile( "image::build_validity" );
+
+    validity_.clear();
+
+    std::vector<validity_mask::ptr> masks;
+    masks.push_back( validity_mask::ptr(
+      new validity_mask( lines_, columns_ )
+    ) );
+
+    if( !lines_ || !columns_ ) {
+
+      validity_ = masks;
+      return true;
+    }
+
+    size_t block_lines( std::max( VALIDITY_BLOCK_PIXELS / columns_,
+                                  static_cast<size_t>( 1 ) ) );
+
+    std::vector<boost::uint8_t> bytes;
+
+    for( size_t k = 1; k <= channels_; ++k ) {
+
+      validity_mask::ptr mask( new validity_mask( lines_, columns_ ) );
+
+      // masks derived from nodata by GDAL would ignore set_nodata
+      GDALRasterBand* m_handle( 0 );
+
+      if( dataset_ != NULL ) {
+
+        GDALRasterBand* b_handle = dataset_->GetRasterBand( k );
+
+        if( !( b_handle->GetMaskFlags() & ( GMF_ALL_VALID | GMF_NODATA ) ) ) {
+
+          m_handle = b_handle->GetMaskBand();
+          bytes.resize( block_lines * columns_ );
+        }
+      }
+
+      float nd( static_cast<float>( nodata_[k - 1] ) );
+
+      if( m_handle ) {
+
+        for( size_t l1 = 0; l1 < lines_; l1 += block_lines ) {
+
+          size_t l2( std::min( l1 + block_lines, lines_ ) );
+
+          boost::lock_guard<boost::mutex> lock( io_mutex_ );
+
+          CPLErr e = raster_io( m_handle, GF_Read, 0, l1, columns_, l2 - l1,
+                                &bytes[0], columns_, l2 - l1, GDT_Byte,
+                                0, 0 );
+
+          if( e != CE_None ) {
+
+            return false;
+          }
+
+          for( size_t i = l1; i < l2; ++i ) {
+
+            mask->set_line( i, &bytes[( i - l1 ) * columns_] );
+          }
+        }
+
+      } else {
+
+        // the next blocks are read while the masks of this one are set
+        window w = { 0, 0, lines_, columns_ };
+        block_reader reader( *this, k, w, block_lines );
+
+        while( const block_reader::block* b = reader.next() ) {
+
+          const float* values( b->get_values( 0 ) );
+
+          for( size_t i = b->get_l1(); i < b->get_l2(); ++i ) {
+
+            mask->set_line( i, values + ( i - b->get_l1() ) * columns_, nd );
+          }
+        }
+
+        if( !reader.is_valid() ) {
+
+          return false;
+        }
+      }
+
+      if( k == 1 ) {
+
+        *masks[0] = *mask;
+
+      } else {
+
+        masks[0]->intersect( *mask );
+      }
+
+      if( per_band ) {
+
+        masks.push_back( mask );
+      }
+    }
+
+    validity_ = masks;
+
+    return true;
+  }
+
+  validity_mask::const_ptr image::get_validity( size_t band_number ) const
+  {
+    BOOST_ASSERT( band_number <= channels_ );
+
+    if( band_number < validity_.size() ) {
+
+      return validity_[band_number];
+    }
+
+    return validity_mask::const_ptr();
+  }
+
+  void image::clear_validity()
+  {
+    validity_.clear();
+  }
+
+  void image::set_description( const description& d )
+  {
+    lines_    = d.lines;
+    columns_  = d.columns;
+    channels_ = d.channels;
+
+    BOOST_ASSERT( d.nodata.size() == channels_ );
+    nodata_.reset( new double[channels_] );
+    std::copy( d.nodata.begin(), d.nodata.end(), nodata_.get() );
+
+    // the description may be shared with other images through the cache
+    if( d.md ) {
+
+      md_.reset( new metadata( *d.md ) );
+    }
+  }
+
 }
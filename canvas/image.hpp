@@ -2,13 +2,18 @@
 #ifndef CANVAS_IMAGE_HPP
 #define CANVAS_IMAGE_HPP
 
+#include <canvas/change_mask.hpp>
+#include <canvas/validity_mask.hpp>
+
 #include <utility/mapped_memory.hpp>
+#include <utility/profiler.hpp>
 
 #include <boost/tuple/tuple.hpp>
 
 #include <boost/scoped_array.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/utility.hpp>
 
 #include <CGAL/Bbox_2.h>
@@ -41,6 +46,38 @@ namespace canvas {
       std::string                       // projection reference tag
     > metadata;
 
+    // lines [l1, l2) and columns [c1, c2)
+    struct window {
+
+      size_t l1;
+
+      size_t c1;
+
+      size_t l2;
+
+      size_t c2;
+
+    };
+
+    // what is read from the header of a file when it is opened
+    struct description {
+
+      size_t lines;
+
+      size_t columns;
+
+      size_t channels;
+
+      // type shared by the bands, Mixed or Undefined otherwise
+      pixel_type type;
+
+      std::vector<double> nodata;
+
+      // empty without a geotransform
+      boost::shared_ptr<metadata> md;
+
+    };
+
     typedef boost::tuple<
       double,                           // x coordinate
       double,                           // y coordinate
@@ -65,10 +102,22 @@ namespace canvas {
 
     const double& get_nodata( size_t band_number ) const;
 
+    void set_nodata( size_t band_number, const double& nodata );
+
+    // see image_factory::get_pixel_type
     static pixel_type get_pixel_type( const std::string& filename );
 
     boost::shared_ptr<metadata> get_metadata() const;
 
+    void set_metadata( const boost::shared_ptr<metadata>& md );
+
+    // the metadata of the window [l1, l2) x [c1, c2) as an image of lines x
+    // columns, empty without metadata
+    boost::shared_ptr<metadata> get_window_metadata( size_t l1, size_t c1,
+                                                     size_t l2, size_t c2,
+                                                     size_t lines,
+                                                     size_t columns ) const;
+
     void display_info( const std::string& tag = "" ) const;
 
     bool contains( const Kernel::Point_2& p ) const;
@@ -77,14 +126,86 @@ namespace canvas {
 
     pixel compute_position( const Kernel::Point_2& p ) const;
 
+    // windows of this image and of other covering their overlap, false if
+    // they do not overlap, differ in pixel size or projection, or are not
+    // on the same grid
+    bool compute_overlap( const image& other, window& t_w,
+                          window& o_w ) const;
+
+    // pixels of the overlap where the absolute difference in any band
+    // exceeds its threshold, with per band statistics of the changes,
+    // computed block by block without a difference image
+    change_mask::ptr detect_changes( const image& other,
+                                     const std::vector<double>& thresholds,
+                                     size_t threads = 0 ) const;
+
     virtual boost::shared_array<double> compute_values(
       const pixel& px ) const = 0;
 
     bool is_valid( const pixel& px ) const;
 
+    // builds and keeps masks of the pixels valid in each band, and of those
+    // valid in every band, from the GDAL mask band where the dataset has an
+    // explicit mask or alpha band and by comparing with nodata otherwise.
+    // They describe the data when built and are dropped by set_nodata.
+    bool build_validity( bool per_band = true );
+
+    // empty unless built, band 0 for the pixels valid in every band
+    validity_mask::const_ptr get_validity( size_t band_number = 0 ) const;
+
+    void clear_validity();
+
+    // values of the window [l1, l2) x [c1, c2) of a band as floats, line by
+    // line, from the bands in memory if allocated and the dataset otherwise
+    virtual bool read_window( size_t band_number, size_t l1, size_t c1,
+                              size_t l2, size_t c2, float* buffer ) const = 0;
+
     virtual void write( const std::string& filename ) = 0;
 
+    // GDALRasterBand::RasterIO, counted and timed when profiling is enabled
+    static CPLErr raster_io( GDALRasterBand* b_handle, GDALRWFlag flag,
+                             int x_off, int y_off, int x_size, int y_size,
+                             void* buffer, int buf_x_size, int buf_y_size,
+                             GDALDataType type, GSpacing pixel_space,
+                             GSpacing line_space,
+                             GDALRasterIOExtraArg* extra = 0 );
+
   protected:
+    // takes dataset, opened read-only from filename and described by d
+    image( GDALDataset* dataset, const std::string& filename,
+           const description& d );
+
+    // lines read at a time by read_bands, per band and thread
+    static const size_t STRIP_PIXELS = 4194304;
+
+    // strips a thread of read_bands reads at least, since each opens the
+    // file again
+    static const size_t THREAD_STRIPS = 4;
+
+    // window [l1, l2) x [c1, c2) of every band into buffers, one per band
+    // with lines of c2 - c1 values of type, in strips read by threads of
+    // the shared pool; each thread opens the file again so that GDAL
+    // decodes the strips in parallel, and dataset_ is used under io_mutex_
+    // when there is no file or too few strips to share
+    bool read_bands( size_t l1, size_t c1, size_t l2, size_t c2,
+                     GDALDataType type, const std::vector<void*>& buffers,
+                     size_t threads = 0 ) const;
+
+    // window [l1, l2) x [c1, c2) of every band reduced to lines x columns
+    // into buffers, one per band. GDAL decimates the dataset with the
+    // resampling method, from the overview closest to the size when the
+    // file has overviews; without a dataset the bands are reduced from
+    // read_window by nearest neighbour or, for any other method, by the
+    // mean of the valid pixels of each box.
+    bool read_reduced( size_t l1, size_t c1, size_t l2, size_t c2,
+                       size_t lines, size_t columns, GDALDataType type,
+                       GDALRIOResampleAlg resampling,
+                       const std::vector<void*>& buffers ) const;
+
+    // the size of the image reduced to fit size x size, keeping its aspect
+    void get_preview_size( size_t size, size_t& lines,
+                           size_t& columns ) const;
+
     size_t lines_;
 
     size_t columns_;
@@ -97,8 +218,29 @@ namespace canvas {
 
     GDALDataset* dataset_;
 
+    // dataset_ was opened read-only from it, empty otherwise
+    std::string filename_;
+
+    // the bands hold the values of dataset_: set by load() and load_lazy(),
+    // so that read_window reads allocated bands only once they are filled
+    bool loaded_;
+
     std::map<std::string,std::string> driver_;
 
+    // serialises access to dataset_, which GDAL does not make thread-safe
+    mutable boost::mutex io_mutex_;
+
+    // all bands first, then each band if built per band
+    std::vector<validity_mask::ptr> validity_;
+
+  private:
+    void set_description( const description& d );
+
+    bool reduce_band( size_t band_number, size_t l1, size_t c1, size_t l2,
+                      size_t c2, size_t lines, size_t columns,
+                      GDALDataType type, GDALRIOResampleAlg resampling,
+                      void* buffer ) const;
+
   };
 
 }
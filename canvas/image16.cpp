@@ -1,10 +1,65 @@
 
 #include <canvas/image16.hpp>
+#include <canvas/raster_cache.hpp>
+
+#include <utility/thread_pool.hpp>
 
 #include <boost/assert.hpp>
+#include <boost/bind.hpp>
+
+#include <iostream>
 
 namespace canvas {
 
+  namespace {
+
+    // pixels read per block when the histograms come from the dataset
+    const size_t HISTOGRAM_BLOCK_PIXELS = 1048576;
+
+    // pixels per task of compute_difference
+    const size_t DIFFERENCE_GRAIN = 1048576;
+
+    // shared by the threads of compute_difference
+    struct difference_job {
+
+      std::vector<const boost::uint16_t*> first;
+
+      std::vector<const boost::uint16_t*> second;
+
+      std::vector<boost::uint16_t*> result;
+
+      std::vector<double> first_nodata;
+
+      std::vector<double> second_nodata;
+
+    };
+
+    // pixels [first, last) of every band
+    void difference_pixels( const difference_job* job, size_t first,
+                            size_t last )
+    {
+      for( size_t k = 0; k < job->result.size(); ++k ) {
+
+        const boost::uint16_t* r1_b_ptr( job->first[k] + first );
+        const boost::uint16_t* r2_b_ptr( job->second[k] + first );
+        boost::uint16_t* r_b_ptr( job->result[k] + first );
+
+        const double& r1_nd( job->first_nodata[k] );
+        const double& r2_nd( job->second_nodata[k] );
+
+        for( size_t n = first; n < last; ++n, ++r1_b_ptr, ++r2_b_ptr,
+                                              ++r_b_ptr ) {
+
+          if( ( *r1_b_ptr != r1_nd ) && ( *r2_b_ptr != r2_nd ) ) {
+
+            *r_b_ptr = abs( *r1_b_ptr - *r2_b_ptr );
+          }
+        }
+      }
+    }
+
+  }
+
   image16::image16( const size_t& lines,
                     const size_t& columns,
                     const size_t& channels ) : image( lines, columns, channels )
@@ -16,17 +71,29 @@ namespace canvas {
   {
   }
 
+  image16::image16( GDALDataset* dataset, const std::string& filename,
+                    const description& d )
+    : image( dataset, filename, d )
+  {
+  }
+
   image16::~image16()
   {
+    detach_lazy_bands();
   }
 
   void image16::allocate( bool fill )
   {
+    utility::profiler::scope profile( "image16::allocate" );
+
     if( bands_.empty() || ( bands_.size() != channels_ ) ) {
 
       boost::uint64_t pixels( lines_ * columns_ );
 
       bands_.clear();
+      lazy_.clear();
+      loaded_ = false;
+      packed_.clear();
 
       if( fill ) {
 
@@ -51,36 +118,66 @@ namespace canvas {
 
   void image16::load()
   {
-    boost::uint64_t pixels( lines_ * columns_ );
+    utility::profiler::scope profile( "image16::load" );
 
-    boost::uint16_t* buffer = static_cast<boost::uint16_t*>(
-      CPLMalloc( pixels * sizeof( boost::uint16_t ) )
-    );
+    BOOST_ASSERT( bands_.size() == channels_ );
 
-    std::vector<band_ptr>::iterator b_it = bands_.begin();
+    lazy_.clear();
 
-    for( size_t k = 0; k < channels_; ++k, ++b_it ) {
+    // mapped from the raster cache when it holds the file as it is
+    if( raster_cache::map( filename_, *this, bands_ ) ) {
 
-      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+      loaded_ = true;
+      return;
+    }
 
-      size_t x_size( b_handle->GetXSize() );
-      size_t y_size( b_handle->GetYSize() );
+    std::vector<void*> buffers;
 
-      BOOST_ASSERT( ( x_size * y_size ) == pixels );
+    for( size_t k = 0; k < channels_; ++k ) {
 
-      CPLErr e = b_handle->RasterIO( GF_Read, 0, 0,
-        x_size, y_size, buffer, x_size, y_size, GDT_UInt16, 0, 0 );
+      buffers.push_back( bands_[k]->get() );
+    }
 
-      BOOST_ASSERT( e == CE_None );
+    // a failed read is neither marked loaded nor cached
+    if( !read_bands( 0, 0, lines_, columns_, GDT_UInt16, buffers ) ) {
 
-      std::copy( buffer, buffer + pixels, ( *b_it )->get() );
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return;
     }
 
-    CPLFree( buffer );
+    loaded_ = true;
+    raster_cache::write( filename_, *this, bands_ );
+  }
+
+  void image16::load_lazy()
+  {
+    utility::profiler::scope profile( "image16::load_lazy" );
+
+    BOOST_ASSERT( dataset_ != NULL );
+
+    allocate();
+    lazy_.clear();
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+
+      BOOST_ASSERT( static_cast<size_t>( b_handle->GetXSize() ) == columns_ );
+      BOOST_ASSERT( static_cast<size_t>( b_handle->GetYSize() ) == lines_ );
+
+      lazy_.push_back( lazy_ptr(
+        new lazy( b_handle, GDT_UInt16, lines_, columns_, bands_[k],
+                  io_mutex_ )
+      ) );
+    }
+
+    loaded_ = true;
   }
 
   image16::ptr image16::load( size_t l1, size_t c1, size_t l2, size_t c2 ) const
   {
+    utility::profiler::scope profile( "image16::load_window" );
+
     BOOST_ASSERT( l1 < l2 );
     BOOST_ASSERT( c1 < c2 );
 
@@ -93,28 +190,84 @@ namespace canvas {
     image16::ptr region( new image16( lines, columns, channels_ ) );
     region->allocate();
 
+    std::vector<void*> buffers;
+
     for( size_t k = 0; k < channels_; ++k ) {
 
-      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+      buffers.push_back( region->get_band( k + 1 )->get() );
+      region->set_nodata( k + 1, nodata_[k] );
+    }
 
-      band_ptr b_ptr( region->get_band( k + 1 ) );
+    if( !read_bands( l1, c1, l2, c2, GDT_UInt16, buffers ) ) {
 
-      CPLErr e = b_handle->RasterIO( GF_Read, c1, l1, columns, lines,
-        b_ptr->get(), columns, lines, GDT_UInt16, 0, 0 );
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      region.reset();
+    }
 
-      BOOST_ASSERT( e == CE_None );
+    return region;
+  }
+
+  image16::ptr image16::load( size_t l1, size_t c1, size_t l2, size_t c2,
+                              size_t lines, size_t columns,
+                              GDALRIOResampleAlg resampling ) const
+  {
+    utility::profiler::scope profile( "image16::load_reduced" );
+
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+    image16::ptr region( new image16( lines, columns, channels_ ) );
+    region->allocate();
+    region->set_metadata( get_window_metadata( l1, c1, l2, c2, lines,
+                                               columns ) );
+
+    std::vector<void*> buffers;
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      buffers.push_back( region->get_band( k + 1 )->get() );
+      region->set_nodata( k + 1, nodata_[k] );
+    }
+
+    if( !read_reduced( l1, c1, l2, c2, lines, columns, GDT_UInt16,
+                       resampling, buffers ) ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      region.reset();
     }
 
     return region;
   }
 
+  image16::ptr image16::load_preview( size_t size,
+                                      GDALRIOResampleAlg resampling ) const
+  {
+    size_t lines, columns;
+    get_preview_size( size, lines, columns );
+
+    return load( 0, 0, lines_, columns_, lines, columns, resampling );
+  }
+
   void image16::write( const std::string& filename )
   {
+    utility::profiler::scope profile( "image16::write" );
+
+    // tiles not read yet come from the dataset closed below
+    if( !pin_lazy_bands() ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return;
+    }
+
+    detach_lazy_bands();
+
     if( dataset_ != NULL ) {
 
       GDALClose( dataset_ );
     }
 
+    filename_.clear();
+
     CPLErr e;
 
     boost::filesystem::path p( filename );
@@ -126,6 +279,9 @@ namespace canvas {
     dataset_ = driver->Create( filename.c_str(), columns_, lines_, channels_,
                                GDT_Float32, NULL );
 
+    // the bands are what the new dataset holds
+    loaded_ = true;
+
     const CGAL::Bbox_2& bb( md_->get<1>() );
     double transform[] = { bb.xmin(), md_->get<0>(), 0.0,
                            bb.ymax(), 0.0, md_->get<0>() };
@@ -136,16 +292,17 @@ namespace canvas {
     e = dataset_->SetProjection( md_->get<2>().c_str() );
     BOOST_ASSERT( e == CE_None );
 
-    std::vector<band_ptr>::const_iterator b_it = bands_.begin();
-
-    for( size_t k = 0; k < channels_; ++k, ++b_it ) {
+    for( size_t k = 0; k < channels_; ++k ) {
 
       GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
 
       b_handle->SetNoDataValue( nodata_[k] );
 
-      e = b_handle->RasterIO( GF_Write, 0, 0, columns_, lines_,
-            ( *b_it )->get(), columns_, lines_, GDT_UInt16, 0, 0 );
+      // decoded one band at a time if packed
+      band_ptr data( get_band( k + 1 ) );
+
+      e = raster_io( b_handle, GF_Write, 0, 0, columns_, lines_,
+            data->get(), columns_, lines_, GDT_UInt16, 0, 0 );
 
       BOOST_ASSERT( e == CE_None );
     }
@@ -153,6 +310,8 @@ namespace canvas {
 
   boost::shared_array<double> image16::compute_values( const pixel& px ) const
   {
+    utility::profiler::scope profile( "image16::compute_values" );
+
     boost::shared_array<double> g( new double[channels_] );
     const double* nodata_ptr( nodata_.get() );
     std::copy( nodata_ptr, nodata_ptr + channels_, g.get() );
@@ -180,7 +339,7 @@ namespace canvas {
         GDALRasterBand* b_handle = dataset_->GetRasterBand( k );
 
         float buffer[4];
-        CPLErr e = b_handle->RasterIO( GF_Read, j, i, 2, 2,
+        CPLErr e = raster_io( b_handle, GF_Read, j, i, 2, 2,
                                        buffer, 2, 2, GDT_UInt16, 0, 0 );
 
         BOOST_ASSERT( e == CE_None );
@@ -200,96 +359,314 @@ namespace canvas {
     return g;
   }
 
+  void image16::pack( size_t cache_tiles )
+  {
+    utility::profiler::scope profile( "image16::pack" );
+
+    BOOST_ASSERT( bands_.size() == channels_ );
+
+    if( !pin_lazy_bands() ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return;
+    }
+
+    lazy_.clear();
+    packed_.clear();
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      packed_.push_back( packed_ptr(
+        new packed( bands_[k]->get(), lines_, columns_, cache_tiles )
+      ) );
+
+      // released band by band, so that only one is ever held twice
+      bands_[k].reset();
+    }
+
+    bands_.clear();
+  }
+
+  void image16::unpack()
+  {
+    utility::profiler::scope profile( "image16::unpack" );
+
+    if( packed_.empty() ) {
+
+      return;
+    }
+
+    bands_.clear();
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      bands_.push_back( packed_[k]->unpack() );
+      packed_[k].reset();
+    }
+
+    packed_.clear();
+  }
+
+  bool image16::is_packed() const
+  {
+    return !packed_.empty();
+  }
+
   image16::band_ptr image16::get_band( size_t band_number ) const
   {
     BOOST_ASSERT( band_number >= 1 );
     BOOST_ASSERT( band_number <= channels_ );
+
+    if( !packed_.empty() ) {
+
+      return packed_[band_number - 1]->unpack();
+    }
+
+    if( !lazy_.empty() && !lazy_[band_number - 1]->pin_all() ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+    }
+
     return bands_[band_number - 1];
   }
 
-  image16::ptr image16::compute_difference( const image16& other ) const
+  image16::lazy_ptr image16::get_lazy_band( size_t band_number ) const
   {
-    image16::ptr result;
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    return lazy_.empty() ? lazy_ptr() : lazy_[band_number - 1];
+  }
+
+  image16::packed_ptr image16::get_packed_band( size_t band_number ) const
+  {
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    return packed_.empty() ? packed_ptr() : packed_[band_number - 1];
+  }
+
+  bool image16::read_window( size_t band_number, size_t l1, size_t c1,
+                             size_t l2, size_t c2, float* buffer ) const
+  {
+    return read_values( band_number, l1, c1, l2, c2, buffer, GDT_Float32 );
+  }
+
+  bool image16::read_window( size_t band_number, size_t l1, size_t c1,
+                             size_t l2, size_t c2,
+                             boost::uint16_t* buffer ) const
+  {
+    return read_values( band_number, l1, c1, l2, c2, buffer, GDT_UInt16 );
+  }
+
+  template <typename out_type>
+  bool image16::read_values( size_t band_number, size_t l1, size_t c1,
+                             size_t l2, size_t c2, out_type* buffer,
+                             GDALDataType gdal_type ) const
+  {
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
 
-    boost::shared_ptr<metadata> t_md( this->get_metadata() );
-    boost::shared_ptr<metadata> o_md( other.get_metadata() );
+    size_t columns( c2 - c1 );
 
-    if( t_md && o_md ) {
+    if( !packed_.empty() ) {
 
-      const CGAL::Bbox_2& t_bb( t_md->get<1>() );
-      const CGAL::Bbox_2& o_bb( o_md->get<1>() );
+      packed_[band_number - 1]->read( l1, c1, l2, c2, buffer );
+      return true;
+    }
 
-      if( ( t_md->get<0>() == o_md->get<0>() ) &&
-          ( t_md->get<2>() == o_md->get<2>() ) &&
-            CGAL::do_overlap( t_bb, o_bb ) ) {
+    if( holds_values() ) {
 
-        double x[] = { t_bb.xmin(), t_bb.xmax(), o_bb.xmin(), o_bb.xmax() };
-        double y[] = { t_bb.ymin(), t_bb.ymax(), o_bb.ymin(), o_bb.ymax() };
+      const boost::uint16_t* data_ptr( lazy_.empty()
+        ? bands_[band_number - 1]->get()
+        : lazy_[band_number - 1]->pin( l1, c1, l2, c2 ) );
 
-        std::sort( x, x + 4 );
-        std::sort( y, y + 4 );
+      if( data_ptr == NULL ) {
 
-        CGAL::Bbox_2 i_bb( x[1], y[1], x[2], y[2] );
+        return false;
+      }
 
-        Kernel::Point_2 ul( x[1], y[2] );
-        Kernel::Point_2 lr( x[2], y[1] );
+      for( size_t i = l1; i < l2; ++i, buffer += columns ) {
 
-        pixel t_ul( this->compute_position( ul ) );
-        pixel t_lr( this->compute_position( lr ) );
-        pixel o_ul( other.compute_position( ul ) );
-        pixel o_lr( other.compute_position( lr ) );
+        const boost::uint16_t* line_ptr( data_ptr + i * columns_ + c1 );
+        std::copy( line_ptr, line_ptr + columns, buffer );
+      }
 
-        size_t t_l1( std::floor( t_ul.get<1>() ) );
-        size_t t_c1( std::floor( t_ul.get<0>() ) );
+      return true;
+    }
 
-        size_t t_l2( std::ceil( t_lr.get<1>() ) );
-        size_t t_c2( std::ceil( t_lr.get<0>() ) );
+    if( dataset_ == NULL ) {
 
-        size_t o_l1( std::floor( o_ul.get<1>() ) );
-        size_t o_c1( std::floor( o_ul.get<0>() ) );
+      return false;
+    }
 
-        size_t o_l2( std::ceil( o_lr.get<1>() ) );
-        size_t o_c2( std::ceil( o_lr.get<0>() ) );
+    boost::lock_guard<boost::mutex> lock( io_mutex_ );
 
-        size_t lines( t_l2 - t_l1 );
-        BOOST_ASSERT( lines == ( o_l2 - o_l1 ) );
+    GDALRasterBand* b_handle = dataset_->GetRasterBand( band_number );
 
-        size_t columns( t_c2 - t_c1 );
-        BOOST_ASSERT( columns == ( o_c2 - o_c1 ) );
+    CPLErr e = raster_io( b_handle, GF_Read, c1, l1, columns, l2 - l1,
+                          buffer, columns, l2 - l1, gdal_type, 0, 0 );
 
-        image16::ptr r1( this->load( t_l1, t_c1, t_l2, t_c2 ) );
-        image16::ptr r2( other.load( o_l1, o_c1, o_l2, o_c2 ) );
+    return ( e == CE_None );
+  }
 
-        result.reset( new image16( lines, columns, channels_ ) );
-        result->allocate( true );
+  bool image16::holds_values() const
+  {
+    return !bands_.empty() && ( loaded_ || ( dataset_ == NULL ) );
+  }
 
-        boost::uint64_t pixels( lines * columns );
+  bool image16::pin_lazy_bands() const
+  {
+    for( size_t k = 0; k < lazy_.size(); ++k ) {
 
-        for( size_t k = 1; k <= channels_; ++k ) {
+      if( !lazy_[k]->pin_all() ) {
 
-          band_ptr r1_b( r1->get_band( k ) );
-          band_ptr r2_b( r2->get_band( k ) );
+        return false;
+      }
+    }
 
-          const boost::uint16_t* r1_b_ptr( r1_b->get() );
-          const boost::uint16_t* r2_b_ptr( r2_b->get() );
+    return true;
+  }
 
-          band_ptr r_b( result->get_band( k ) );
-          boost::uint16_t* r_b_ptr( r_b->get() );
+  void image16::detach_lazy_bands()
+  {
+    for( size_t k = 0; k < lazy_.size(); ++k ) {
 
-          const double& r1_nd( r1->get_nodata( k ) );
-          const double& r2_nd( r2->get_nodata( k ) );
+      lazy_[k]->detach();
+    }
 
-          for( boost::uint64_t n = 0; n < pixels; ++n,
-                                                  ++r1_b_ptr,
-                                                  ++r2_b_ptr, ++r_b_ptr ) {
+    lazy_.clear();
+  }
 
-            if( ( *r1_b_ptr != r1_nd ) && ( *r2_b_ptr != r2_nd ) ) {
+  std::vector<image16::histogram>
+  image16::compute_histograms( size_t step ) const
+  {
+    utility::profiler::scope profile( "image16::compute_histograms" );
 
-              *r_b_ptr = abs( *r1_b_ptr - *r2_b_ptr );
-            }
-          }
+    BOOST_ASSERT( step >= 1 );
+
+    std::vector<histogram> result( channels_ );
+
+    if( holds_values() || !packed_.empty() ) {
+
+      for( size_t k = 0; k < channels_; ++k ) {
+
+        // held for the loop: a packed band is decoded into a new copy
+        band_ptr data( get_band( k + 1 ) );
+        const boost::uint16_t* data_ptr( data->get() );
+
+        for( size_t i = 0; i < lines_; i += step ) {
+
+          result[k].add( data_ptr + i * columns_,
+                         data_ptr + ( i + 1 ) * columns_ );
+        }
+
+        result[k].discard( nodata_[k] );
+      }
+
+      return result;
+    }
+
+    BOOST_ASSERT( dataset_ != NULL );
+
+    // blocks of whole multiples of step lines, read decimated by GDAL
+    size_t block_lines( std::max( HISTOGRAM_BLOCK_PIXELS / columns_,
+                                  static_cast<size_t>( 1 ) ) );
+    block_lines = ( ( block_lines + step - 1 ) / step ) * step;
+
+    std::vector<boost::uint16_t> buffer( ( block_lines / step ) * columns_ );
+
+    boost::lock_guard<boost::mutex> lock( io_mutex_ );
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+
+      for( size_t l1 = 0; l1 < lines_; l1 += block_lines ) {
+
+        size_t lines( std::min( block_lines, lines_ - l1 ) );
+        size_t buffer_lines( ( lines + step - 1 ) / step );
+
+        CPLErr e = raster_io( b_handle, GF_Read, 0, l1, columns_, lines,
+                              &buffer[0], columns_, buffer_lines, GDT_UInt16,
+                              0, 0 );
+
+        if( e != CE_None ) {
+
+          std::cerr << "Unable to read image " << filename_ << std::endl;
+          return std::vector<histogram>();
         }
+
+        result[k].add( &buffer[0], &buffer[0] + buffer_lines * columns_ );
+      }
+
+      result[k].discard( nodata_[k] );
+    }
+
+    return result;
+  }
+
+  std::vector<boost::uint16_t> image16::estimate_noise( double percentile,
+                                                        size_t step ) const
+  {
+    std::vector<histogram> histograms( compute_histograms( step ) );
+
+    std::vector<boost::uint16_t> noise;
+
+    if( histograms.empty() ) {
+
+      return noise;
+    }
+
+    noise.reserve( channels_ );
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      noise.push_back( histograms[k].percentile( percentile ) );
+    }
+
+    return noise;
+  }
+
+  image16::ptr image16::compute_difference( const image16& other ) const
+  {
+    utility::profiler::scope profile( "image16::compute_difference" );
+
+    image16::ptr result;
+
+    window t_w, o_w;
+
+    if( this->compute_overlap( other, t_w, o_w ) ) {
+
+      size_t lines( t_w.l2 - t_w.l1 );
+      size_t columns( t_w.c2 - t_w.c1 );
+
+      image16::ptr r1( this->load( t_w.l1, t_w.c1, t_w.l2, t_w.c2 ) );
+      image16::ptr r2( other.load( o_w.l1, o_w.c1, o_w.l2, o_w.c2 ) );
+
+      if( !r1 || !r2 ) {
+
+        return result;
       }
+
+      result.reset( new image16( lines, columns, channels_ ) );
+      result->allocate( true );
+
+      difference_job job;
+
+      for( size_t k = 1; k <= channels_; ++k ) {
+
+        job.first.push_back( r1->get_band( k )->get() );
+        job.second.push_back( r2->get_band( k )->get() );
+        job.result.push_back( result->get_band( k )->get() );
+        job.first_nodata.push_back( r1->get_nodata( k ) );
+        job.second_nodata.push_back( r2->get_nodata( k ) );
+      }
+
+      utility::thread_pool::global().parallel_for(
+        0, lines * columns, DIFFERENCE_GRAIN,
+        boost::bind( &difference_pixels, &job, _1, _2 )
+      );
     }
 
     return result;
@@ -2,7 +2,10 @@
 #ifndef CANVAS_IMAGE16_HPP
 #define CANVAS_IMAGE16_HPP
 
+#include <canvas/histogram.hpp>
 #include <canvas/image.hpp>
+#include <canvas/lazy_band.hpp>
+#include <canvas/packed_band.hpp>
 
 namespace canvas {
 
@@ -17,6 +20,16 @@ namespace canvas {
 
     typedef boost::shared_ptr<band> band_ptr;
 
+    typedef canvas::lazy_band<boost::uint16_t> lazy;
+
+    typedef boost::shared_ptr<lazy> lazy_ptr;
+
+    typedef canvas::packed_band<boost::uint16_t> packed;
+
+    typedef boost::shared_ptr<packed> packed_ptr;
+
+    typedef canvas::histogram<boost::uint16_t> histogram;
+
     image16( const size_t& lines,
              const size_t& columns,
              const size_t& channels = 1 );
@@ -29,19 +42,92 @@ namespace canvas {
 
     void load();
 
+    // allocates the bands and reads each tile on first access
+    void load_lazy();
+
+    // empty, like the loads below, if the file cannot be read
     image16::ptr load( size_t l1, size_t c1, size_t l2, size_t c2 ) const;
 
+    // the window reduced to lines x columns and georeferenced, decimated
+    // by GDAL from the closest overview of the file when it has overviews
+    image16::ptr load( size_t l1, size_t c1, size_t l2, size_t c2,
+                       size_t lines, size_t columns,
+                       GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
+    // the whole image reduced to fit size x size pixels
+    image16::ptr load_preview(
+      size_t size, GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
     void write( const std::string& filename );
 
     boost::shared_array<double> compute_values( const pixel& px ) const;
 
+    bool read_window( size_t band_number, size_t l1, size_t c1,
+                      size_t l2, size_t c2, float* buffer ) const;
+
+    // the window as stored, without conversion
+    bool read_window( size_t band_number, size_t l1, size_t c1,
+                      size_t l2, size_t c2, boost::uint16_t* buffer ) const;
+
+    // compresses the bands in memory and releases them: read_window then
+    // decodes tiles on demand, keeping cache_tiles of each band decoded
+    void pack( size_t cache_tiles = packed::CACHE_TILES );
+
+    // decodes the packed bands back into memory
+    void unpack();
+
+    bool is_packed() const;
+
+    // the whole band, read first if it is lazy; a decoded copy if the image
+    // is packed, where changes to it are not kept
     band_ptr get_band( size_t band_number ) const;
 
+    // empty unless pack() was called
+    packed_ptr get_packed_band( size_t band_number ) const;
+
+    // empty unless load_lazy() was called
+    lazy_ptr get_lazy_band( size_t band_number ) const;
+
+    // the bands are allocated and hold the values of the image, read on
+    // access if they are lazy; false for packed images
+    bool holds_values() const;
+
+    // histograms of the valid values of every band, from every step-th
+    // line; none if the file cannot be read
+    std::vector<histogram> compute_histograms( size_t step = 1 ) const;
+
+    // per band dark object values: the given percentile of the valid values
+    // (their minimum for 0), from every step-th line; none if the file
+    // cannot be read
+    std::vector<boost::uint16_t> estimate_noise( double percentile = 0.0,
+                                                 size_t step = 1 ) const;
+
     image16::ptr compute_difference( const image16& other ) const;
 
   private:
+    friend class image_factory;
+
+    image16( GDALDataset* dataset, const std::string& filename,
+             const description& d );
+
     std::vector<band_ptr> bands_;
 
+    std::vector<lazy_ptr> lazy_;
+
+    std::vector<packed_ptr> packed_;
+
+    // false if a tile of a lazy band cannot be read
+    bool pin_lazy_bands() const;
+
+    // before the dataset is closed
+    void detach_lazy_bands();
+
+    // read_window into buffer, from the dataset as gdal_type
+    template <typename out_type>
+    bool read_values( size_t band_number, size_t l1, size_t c1, size_t l2,
+                      size_t c2, out_type* buffer,
+                      GDALDataType gdal_type ) const;
+
   };
 
 }
@@ -1,11 +1,171 @@
 
 #include <canvas/image32.hpp>
+#include <canvas/raster_cache.hpp>
+
+#include <utility/thread_pool.hpp>
 
 #include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/filesystem.hpp>
 
+#include <iostream>
+
 namespace canvas {
 
+  namespace {
+
+    // pixels per task of compute_difference
+    const size_t DIFFERENCE_GRAIN = 1048576;
+
+    // shared by the threads of compute_difference
+    struct difference_job {
+
+      std::vector<const float*> first;
+
+      std::vector<const float*> second;
+
+      std::vector<float*> result;
+
+      std::vector<double> first_nodata;
+
+      std::vector<double> second_nodata;
+
+    };
+
+    // pixels [first, last) of every band
+    void difference_pixels( const difference_job* job, size_t first,
+                            size_t last )
+    {
+      for( size_t k = 0; k < job->result.size(); ++k ) {
+
+        const float* r1_b_ptr( job->first[k] + first );
+        const float* r2_b_ptr( job->second[k] + first );
+        float* r_b_ptr( job->result[k] + first );
+
+        const double& r1_nd( job->first_nodata[k] );
+        const double& r2_nd( job->second_nodata[k] );
+
+        for( size_t n = first; n < last; ++n, ++r1_b_ptr, ++r2_b_ptr,
+                                              ++r_b_ptr ) {
+
+          if( ( *r1_b_ptr != r1_nd ) && ( *r2_b_ptr != r2_nd ) ) {
+
+            *r_b_ptr = *r1_b_ptr - *r2_b_ptr;
+          }
+        }
+      }
+    }
+
+
+    // pixels per task of compute_stats
+    const size_t STATS_GRAIN = 1048576;
+
+    // sums of a band, merged from every thread of compute_stats
+    struct stats_job {
+
+      const float* px;
+
+      size_t columns;
+
+      double nd;
+
+      validity_mask::const_ptr valid;
+
+      double sgg;
+
+      double sg;
+
+      double n;
+
+      double l;
+
+      double u;
+
+      boost::mutex mutex;
+
+    };
+
+    // lines [first, last) of a band
+    void stats_lines( stats_job* job, size_t first, size_t last )
+    {
+      double sgg( 0.0 ), sg( 0.0 ), n( 0.0 );
+
+      double l( std::numeric_limits<double>::max() );
+      double u( std::numeric_limits<double>::min() );
+
+      size_t columns( job->columns );
+
+      if( job->valid ) {
+
+        // words of invalid pixels are skipped whole
+        size_t words( job->valid->get_words_per_line() );
+
+        for( size_t i = first; i < last; ++i ) {
+
+          const boost::uint64_t* w_ptr( job->valid->get_line( i ) );
+          const float* line_ptr( job->px + i * columns );
+
+          for( size_t w = 0; w < words; ++w ) {
+
+            boost::uint64_t word( w_ptr[w] );
+
+            for( size_t j = w * 64; word; ++j, word >>= 1 ) {
+
+              if( word & 1 ) {
+
+                double g( line_ptr[j] );
+
+                l = std::min( l, g );
+                u = std::max( u, g );
+
+                sgg += g * g;
+                sg  += g;
+                ++n;
+              }
+            }
+          }
+        }
+
+      } else {
+
+        const float* px( job->px + first * columns );
+        boost::uint64_t pixels( ( last - first ) * columns );
+
+        for( boost::uint64_t p = 0; p < pixels; ++p, ++px ) {
+
+          double g( *px );
+
+          if( g != job->nd ) {
+
+            if( l > g ) {
+
+              l = g;
+            }
+
+            if( u < g ) {
+
+              u = g;
+            }
+
+            sgg += g * g;
+            sg  += g;
+            ++n;
+          }
+        }
+      }
+
+      boost::lock_guard<boost::mutex> lock( job->mutex );
+
+      job->l = std::min( job->l, l );
+      job->u = std::max( job->u, u );
+      job->sgg += sgg;
+      job->sg += sg;
+      job->n += n;
+    }
+
+  }
+
   image32::image32( const size_t& lines,
                     const size_t& columns,
                     const size_t& channels ) : image( lines, columns, channels )
@@ -17,17 +177,28 @@ namespace canvas {
   {
   }
 
+  image32::image32( GDALDataset* dataset, const std::string& filename,
+                    const description& d )
+    : image( dataset, filename, d )
+  {
+  }
+
   image32::~image32()
   {
+    detach_lazy_bands();
   }
 
   void image32::allocate( bool fill )
   {
+    utility::profiler::scope profile( "image32::allocate" );
+
     if( bands_.empty() || ( bands_.size() != channels_ ) ) {
 
       boost::uint64_t pixels( lines_ * columns_ );
 
       bands_.clear();
+      lazy_.clear();
+      loaded_ = false;
 
       if( fill ) {
 
@@ -52,28 +223,66 @@ namespace canvas {
 
   void image32::load()
   {
-    boost::uint64_t pixels( lines_ * columns_ );
+    utility::profiler::scope profile( "image32::load" );
 
-    std::vector<band_ptr>::iterator b_it = bands_.begin();
+    BOOST_ASSERT( bands_.size() == channels_ );
 
-    for( size_t k = 0; k < channels_; ++k, ++b_it ) {
+    lazy_.clear();
 
-      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+    // mapped from the raster cache when it holds the file as it is
+    if( raster_cache::map( filename_, *this, bands_ ) ) {
 
-      size_t x_size( b_handle->GetXSize() );
-      size_t y_size( b_handle->GetYSize() );
+      loaded_ = true;
+      return;
+    }
 
-      BOOST_ASSERT( ( x_size * y_size ) == pixels );
+    std::vector<void*> buffers;
 
-      CPLErr e = b_handle->RasterIO( GF_Read, 0, 0, x_size, y_size,
-        ( *b_it )->get(), x_size, y_size, GDT_Float32, 0, 0 );
+    for( size_t k = 0; k < channels_; ++k ) {
 
-      BOOST_ASSERT( e == CE_None );
+      buffers.push_back( bands_[k]->get() );
+    }
+
+    // a failed read is neither marked loaded nor cached
+    if( !read_bands( 0, 0, lines_, columns_, GDT_Float32, buffers ) ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return;
     }
+
+    loaded_ = true;
+    raster_cache::write( filename_, *this, bands_ );
+  }
+
+  void image32::load_lazy()
+  {
+    utility::profiler::scope profile( "image32::load_lazy" );
+
+    BOOST_ASSERT( dataset_ != NULL );
+
+    allocate();
+    lazy_.clear();
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+
+      BOOST_ASSERT( static_cast<size_t>( b_handle->GetXSize() ) == columns_ );
+      BOOST_ASSERT( static_cast<size_t>( b_handle->GetYSize() ) == lines_ );
+
+      lazy_.push_back( lazy_ptr(
+        new lazy( b_handle, GDT_Float32, lines_, columns_, bands_[k],
+                  io_mutex_ )
+      ) );
+    }
+
+    loaded_ = true;
   }
 
   image32::ptr image32::load( size_t l1, size_t c1, size_t l2, size_t c2 ) const
   {
+    utility::profiler::scope profile( "image32::load_window" );
+
     BOOST_ASSERT( l1 < l2 );
     BOOST_ASSERT( c1 < c2 );
 
@@ -86,28 +295,84 @@ namespace canvas {
     image32::ptr region( new image32( lines, columns, channels_ ) );
     region->allocate();
 
+    std::vector<void*> buffers;
+
     for( size_t k = 0; k < channels_; ++k ) {
 
-      GDALRasterBand* b_handle = dataset_->GetRasterBand( k + 1 );
+      buffers.push_back( region->get_band( k + 1 )->get() );
+      region->set_nodata( k + 1, nodata_[k] );
+    }
 
-      band_ptr b_ptr( region->get_band( k + 1 ) );
+    if( !read_bands( l1, c1, l2, c2, GDT_Float32, buffers ) ) {
 
-      CPLErr e = b_handle->RasterIO( GF_Read, c1, l1, columns, lines,
-        b_ptr->get(), columns, lines, GDT_Float32, 0, 0 );
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      region.reset();
+    }
 
-      BOOST_ASSERT( e == CE_None );
+    return region;
+  }
+
+  image32::ptr image32::load( size_t l1, size_t c1, size_t l2, size_t c2,
+                              size_t lines, size_t columns,
+                              GDALRIOResampleAlg resampling ) const
+  {
+    utility::profiler::scope profile( "image32::load_reduced" );
+
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+    image32::ptr region( new image32( lines, columns, channels_ ) );
+    region->allocate();
+    region->set_metadata( get_window_metadata( l1, c1, l2, c2, lines,
+                                               columns ) );
+
+    std::vector<void*> buffers;
+
+    for( size_t k = 0; k < channels_; ++k ) {
+
+      buffers.push_back( region->get_band( k + 1 )->get() );
+      region->set_nodata( k + 1, nodata_[k] );
+    }
+
+    if( !read_reduced( l1, c1, l2, c2, lines, columns, GDT_Float32,
+                       resampling, buffers ) ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      region.reset();
     }
 
     return region;
   }
 
+  image32::ptr image32::load_preview( size_t size,
+                                      GDALRIOResampleAlg resampling ) const
+  {
+    size_t lines, columns;
+    get_preview_size( size, lines, columns );
+
+    return load( 0, 0, lines_, columns_, lines, columns, resampling );
+  }
+
   void image32::write( const std::string& filename )
   {
+    utility::profiler::scope profile( "image32::write" );
+
+    // tiles not read yet come from the dataset closed below
+    if( !pin_lazy_bands() ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return;
+    }
+
+    detach_lazy_bands();
+
     if( dataset_ != NULL ) {
 
       GDALClose( dataset_ );
     }
 
+    filename_.clear();
+
     CPLErr e;
 
     boost::filesystem::path p( filename );
@@ -119,6 +384,9 @@ namespace canvas {
     dataset_ = driver->Create( filename.c_str(), columns_, lines_, channels_,
                                GDT_Float32, NULL );
 
+    // the bands are what the new dataset holds
+    loaded_ = true;
+
     const CGAL::Bbox_2& bb( md_->get<1>() );
     double transform[] = { bb.xmin(), md_->get<0>(), 0.0,
                            bb.ymax(), 0.0, md_->get<0>() };
@@ -137,7 +405,7 @@ namespace canvas {
 
       b_handle->SetNoDataValue( nodata_[k] );
 
-      e = b_handle->RasterIO( GF_Write, 0, 0, columns_, lines_,
+      e = raster_io( b_handle, GF_Write, 0, 0, columns_, lines_,
             ( *b_it )->get(), columns_, lines_, GDT_Float32, 0, 0 );
 
       BOOST_ASSERT( e == CE_None );
@@ -146,6 +414,8 @@ namespace canvas {
 
   boost::shared_array<double> image32::compute_values( const pixel& px ) const
   {
+    utility::profiler::scope profile( "image32::compute_values" );
+
     boost::shared_array<double> g( new double[channels_] );
     const double* nodata_ptr( nodata_.get() );
     std::copy( nodata_ptr, nodata_ptr + channels_, g.get() );
@@ -173,7 +443,7 @@ namespace canvas {
         GDALRasterBand* b_handle = dataset_->GetRasterBand( k );
 
         float buffer[4];
-        CPLErr e = b_handle->RasterIO( GF_Read, j, i, 2, 2,
+        CPLErr e = raster_io( b_handle, GF_Read, j, i, 2, 2,
                                        buffer, 2, 2, GDT_Float32, 0, 0 );
 
         BOOST_ASSERT( e == CE_None );
@@ -227,92 +497,134 @@ namespace canvas {
   {
     BOOST_ASSERT( band_number >= 1 );
     BOOST_ASSERT( band_number <= channels_ );
+
+    if( !lazy_.empty() && !lazy_[band_number - 1]->pin_all() ) {
+
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+    }
+
     return bands_[band_number - 1];
   }
 
-  image32::ptr image32::compute_difference( const image32& other ) const
+  image32::lazy_ptr image32::get_lazy_band( size_t band_number ) const
   {
-    image32::ptr result;
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    return lazy_.empty() ? lazy_ptr() : lazy_[band_number - 1];
+  }
 
-    boost::shared_ptr<metadata> t_md( this->get_metadata() );
-    boost::shared_ptr<metadata> o_md( other.get_metadata() );
+  bool image32::read_window( size_t band_number, size_t l1, size_t c1,
+                             size_t l2, size_t c2, float* buffer ) const
+  {
+    BOOST_ASSERT( band_number >= 1 );
+    BOOST_ASSERT( band_number <= channels_ );
+    BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
 
-    if( t_md && o_md ) {
+    size_t columns( c2 - c1 );
 
-      const CGAL::Bbox_2& t_bb( t_md->get<1>() );
-      const CGAL::Bbox_2& o_bb( o_md->get<1>() );
+    if( holds_values() ) {
 
-      if( ( t_md->get<0>() == o_md->get<0>() ) &&
-          ( t_md->get<2>() == o_md->get<2>() ) &&
-            CGAL::do_overlap( t_bb, o_bb ) ) {
+      const float* data_ptr( lazy_.empty()
+        ? bands_[band_number - 1]->get()
+        : lazy_[band_number - 1]->pin( l1, c1, l2, c2 ) );
 
-        double x[] = { t_bb.xmin(), t_bb.xmax(), o_bb.xmin(), o_bb.xmax() };
-        double y[] = { t_bb.ymin(), t_bb.ymax(), o_bb.ymin(), o_bb.ymax() };
+      if( data_ptr == NULL ) {
 
-        std::sort( x, x + 4 );
-        std::sort( y, y + 4 );
+        return false;
+      }
 
-        CGAL::Bbox_2 i_bb( x[1], y[1], x[2], y[2] );
+      for( size_t i = l1; i < l2; ++i, buffer += columns ) {
 
-        Kernel::Point_2 ul( x[1], y[2] );
-        Kernel::Point_2 lr( x[2], y[1] );
+        const float* line_ptr( data_ptr + i * columns_ + c1 );
+        std::copy( line_ptr, line_ptr + columns, buffer );
+      }
 
-        pixel t_ul( this->compute_position( ul ) );
-        pixel t_lr( this->compute_position( lr ) );
-        pixel o_ul( other.compute_position( ul ) );
-        pixel o_lr( other.compute_position( lr ) );
+      return true;
+    }
 
-        size_t t_l1( std::floor( t_ul.get<1>() ) );
-        size_t t_c1( std::floor( t_ul.get<0>() ) );
+    if( dataset_ == NULL ) {
 
-        size_t t_l2( std::ceil( t_lr.get<1>() ) );
-        size_t t_c2( std::ceil( t_lr.get<0>() ) );
+      return false;
+    }
 
-        size_t o_l1( std::floor( o_ul.get<1>() ) );
-        size_t o_c1( std::floor( o_ul.get<0>() ) );
+    boost::lock_guard<boost::mutex> lock( io_mutex_ );
 
-        size_t o_l2( std::ceil( o_lr.get<1>() ) );
-        size_t o_c2( std::ceil( o_lr.get<0>() ) );
+    GDALRasterBand* b_handle = dataset_->GetRasterBand( band_number );
 
-        size_t lines( t_l2 - t_l1 );
-        BOOST_ASSERT( lines == ( o_l2 - o_l1 ) );
+    CPLErr e = raster_io( b_handle, GF_Read, c1, l1, columns, l2 - l1,
+                          buffer, columns, l2 - l1, GDT_Float32, 0, 0 );
 
-        size_t columns( t_c2 - t_c1 );
-        BOOST_ASSERT( columns == ( o_c2 - o_c1 ) );
+    return ( e == CE_None );
+  }
 
-        image32::ptr r1( this->load( t_l1, t_c1, t_l2, t_c2 ) );
-        image32::ptr r2( other.load( o_l1, o_c1, o_l2, o_c2 ) );
+  bool image32::holds_values() const
+  {
+    return !bands_.empty() && ( loaded_ || ( dataset_ == NULL ) );
+  }
 
-        result.reset( new image32( lines, columns, channels_ ) );
-        result->allocate( true );
+  bool image32::pin_lazy_bands() const
+  {
+    for( size_t k = 0; k < lazy_.size(); ++k ) {
 
-        boost::uint64_t pixels( lines * columns );
+      if( !lazy_[k]->pin_all() ) {
 
-        for( size_t k = 1; k <= channels_; ++k ) {
+        return false;
+      }
+    }
 
-          band_ptr r1_b( r1->get_band( k ) );
-          band_ptr r2_b( r2->get_band( k ) );
+    return true;
+  }
 
-          const float* r1_b_ptr( r1_b->get() );
-          const float* r2_b_ptr( r2_b->get() );
+  void image32::detach_lazy_bands()
+  {
+    for( size_t k = 0; k < lazy_.size(); ++k ) {
 
-          band_ptr r_b( result->get_band( k ) );
-          float* r_b_ptr( r_b->get() );
+      lazy_[k]->detach();
+    }
 
-          const double& r1_nd( r1->get_nodata( k ) );
-          const double& r2_nd( r2->get_nodata( k ) );
+    lazy_.clear();
+  }
 
-          for( boost::uint64_t n = 0; n < pixels; ++n,
-                                                  ++r1_b_ptr,
-                                                  ++r2_b_ptr, ++r_b_ptr ) {
+  image32::ptr image32::compute_difference( const image32& other ) const
+  {
+    utility::profiler::scope profile( "image32::compute_difference" );
 
-            if( ( *r1_b_ptr != r1_nd ) && ( *r2_b_ptr != r2_nd ) ) {
+    image32::ptr result;
 
-              *r_b_ptr = *r1_b_ptr - *r2_b_ptr;
-            }
-          }
-        }
+    window t_w, o_w;
+
+    if( this->compute_overlap( other, t_w, o_w ) ) {
+
+      size_t lines( t_w.l2 - t_w.l1 );
+      size_t columns( t_w.c2 - t_w.c1 );
+
+      image32::ptr r1( this->load( t_w.l1, t_w.c1, t_w.l2, t_w.c2 ) );
+      image32::ptr r2( other.load( o_w.l1, o_w.c1, o_w.l2, o_w.c2 ) );
+
+      if( !r1 || !r2 ) {
+
+        return result;
       }
+
+      result.reset( new image32( lines, columns, channels_ ) );
+      result->allocate( true );
+
+      difference_job job;
+
+      for( size_t k = 1; k <= channels_; ++k ) {
+
+        job.first.push_back( r1->get_band( k )->get() );
+        job.second.push_back( r2->get_band( k )->get() );
+        job.result.push_back( result->get_band( k )->get() );
+        job.first_nodata.push_back( r1->get_nodata( k ) );
+        job.second_nodata.push_back( r2->get_nodata( k ) );
+      }
+
+      utility::thread_pool::global().parallel_for(
+        0, lines * columns, DIFFERENCE_GRAIN,
+        boost::bind( &difference_pixels, &job, _1, _2 )
+      );
     }
 
     return result;
@@ -320,6 +632,8 @@ namespace canvas {
 
   image32::stats image32::compute_stats() const
   {
+    utility::profiler::scope profile( "image32::compute_stats" );
+
     std::vector<double> minimum;
     minimum.reserve( 4 );
 
@@ -332,48 +646,40 @@ namespace canvas {
     std::vector<double> variance;
     variance.reserve( 4 );
 
-    boost::uint64_t pixels( lines_ * columns_ );
-    std::vector<band_ptr>::const_iterator b_it = bands_.begin();
-
-    for( size_t k = 0; k < channels_; ++k, ++b_it ) {
-
-      double sgg( 0.0 ), sg( 0.0 ), n( 0.0 );
-
-      double l( std::numeric_limits<double>::max() );
-      double u( std::numeric_limits<double>::min() );
-
-      double nd( get_nodata( k + 1 ) );
-
-      const float* px( ( *b_it )->get() );
-
-      for( boost::uint64_t p = 0; p < pixels; ++p, ++px ) {
-
-        double g( *px );
-
-        if( g != nd ) {
+    if( !pin_lazy_bands() ) {
 
-          if( l > g ) {
+      std::cerr << "Unable to read image " << filename_ << std::endl;
+      return stats( minimum, maximum, mean, variance );
+    }
 
-            l = g;
-          }
+    size_t grain( std::max( STATS_GRAIN / std::max( columns_,
+                                                    static_cast<size_t>( 1 ) ),
+                            static_cast<size_t>( 1 ) ) );
 
-          if( u < g ) {
+    for( size_t k = 0; k < channels_; ++k ) {
 
-            u = g;
-          }
+      stats_job job;
+      job.px = bands_[k]->get();
+      job.columns = columns_;
+      job.nd = get_nodata( k + 1 );
+      job.valid = get_validity( k + 1 );
+      job.sgg = 0.0;
+      job.sg = 0.0;
+      job.n = 0.0;
+      job.l = std::numeric_limits<double>::max();
+      job.u = std::numeric_limits<double>::min();
 
-          sgg += g * g;
-          sg  += g;
-          ++n;
-        }
-      }
+      utility::thread_pool::global().parallel_for(
+        0, lines_, grain, boost::bind( &stats_lines, &job, _1, _2 )
+      );
 
-      minimum.push_back( l );
-      maximum.push_back( u );
+      minimum.push_back( job.l );
+      maximum.push_back( job.u );
 
-      mean.push_back( sg/ n );
+      mean.push_back( job.sg / job.n );
 
-      variance.push_back( sgg - ( sg * mean.back() ) / ( n - 1.0 ) );
+      variance.push_back( job.sgg - ( job.sg * mean.back() )
+                          / ( job.n - 1.0 ) );
     }
 
     return stats( minimum, maximum, mean, variance );
@@ -3,6 +3,7 @@
 #define CANVAS_IMAGE32_HPP
 
 #include <canvas/image.hpp>
+#include <canvas/lazy_band.hpp>
 
 namespace canvas {
 
@@ -17,6 +18,10 @@ namespace canvas {
 
     typedef boost::shared_ptr<band> band_ptr;
 
+    typedef canvas::lazy_band<float> lazy;
+
+    typedef boost::shared_ptr<lazy> lazy_ptr;
+
     typedef boost::tuple<
       std::vector<double>,  // minimum
       std::vector<double>,  // maximum
@@ -36,21 +41,59 @@ namespace canvas {
 
     void load();
 
+    // allocates the bands and reads each tile on first access
+    void load_lazy();
+
+    // empty, like the loads below, if the file cannot be read
     image32::ptr load( size_t l1, size_t c1, size_t l2, size_t c2 ) const;
 
+    // the window reduced to lines x columns and georeferenced, decimated
+    // by GDAL from the closest overview of the file when it has overviews
+    image32::ptr load( size_t l1, size_t c1, size_t l2, size_t c2,
+                       size_t lines, size_t columns,
+                       GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
+    // the whole image reduced to fit size x size pixels
+    image32::ptr load_preview(
+      size_t size, GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
     void write( const std::string& filename );
 
     boost::shared_array<double> compute_values( const pixel& px ) const;
 
+    bool read_window( size_t band_number, size_t l1, size_t c1,
+                      size_t l2, size_t c2, float* buffer ) const;
+
+    // the whole band, read first if it is lazy
     band_ptr get_band( size_t band_number ) const;
 
+    // empty unless load_lazy() was called
+    lazy_ptr get_lazy_band( size_t band_number ) const;
+
+    // the bands are allocated and hold the values of the image, read on
+    // access if they are lazy
+    bool holds_values() const;
+
     image32::ptr compute_difference( const image32& other ) const;
 
     stats compute_stats() const;
 
   private:
+    friend class image_factory;
+
+    image32( GDALDataset* dataset, const std::string& filename,
+             const description& d );
+
     std::vector<band_ptr> bands_;
 
+    std::vector<lazy_ptr> lazy_;
+
+    // false if a tile of a lazy band cannot be read
+    bool pin_lazy_bands() const;
+
+    // before the dataset is closed
+    void detach_lazy_bands();
+
   };
 
 }
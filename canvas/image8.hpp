@@ -2,7 +2,10 @@
 #ifndef CANVAS_IMAGE8_HPP
 #define CANVAS_IMAGE8_HPP
 
+#include <canvas/histogram.hpp>
 #include <canvas/image.hpp>
+#include <canvas/lazy_band.hpp>
+#include <canvas/packed_band.hpp>
 
 namespace canvas {
 
@@ -17,6 +20,16 @@ namespace canvas {
 
     typedef boost::shared_ptr<band> band_ptr;
 
+    typedef canvas::lazy_band<boost::uint8_t> lazy;
+
+    typedef boost::shared_ptr<lazy> lazy_ptr;
+
+    typedef canvas::packed_band<boost::uint8_t> packed;
+
+    typedef boost::shared_ptr<packed> packed_ptr;
+
+    typedef canvas::histogram<boost::uint8_t> histogram;
+
     image8( const size_t& lines,
             const size_t& columns,
             const size_t& channels = 1 );
@@ -29,22 +42,93 @@ namespace canvas {
 
     void load();
 
+    // allocates the bands and reads each tile on first access
+    void load_lazy();
+
+    // empty, like the loads below, if the file cannot be read
     image8::ptr load( size_t l1, size_t c1, size_t l2, size_t c2 ) const;
 
+    // the window reduced to lines x columns and georeferenced, decimated
+    // by GDAL from the closest overview of the file when it has overviews
+    image8::ptr load( size_t l1, size_t c1, size_t l2, size_t c2,
+                      size_t lines, size_t columns,
+                      GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
+    // the whole image reduced to fit size x size pixels
+    image8::ptr load_preview(
+      size_t size, GDALRIOResampleAlg resampling = GRIORA_Average ) const;
+
     void write( const std::string& filename );
 
     boost::shared_array<double> compute_values( const pixel& px ) const;
 
+    bool read_window( size_t band_number, size_t l1, size_t c1,
+                      size_t l2, size_t c2, float* buffer ) const;
+
+    // compresses the bands in memory and releases them: read_window then
+    // decodes tiles on demand, keeping cache_tiles of each band decoded
+    void pack( size_t cache_tiles = packed::CACHE_TILES );
+
+    // decodes the packed bands back into memory
+    void unpack();
+
+    bool is_packed() const;
+
+    // the whole band, read first if it is lazy; a decoded copy if the image
+    // is packed, where changes to it are not kept
     band_ptr get_band( size_t band_number ) const;
 
+    // empty unless pack() was called
+    packed_ptr get_packed_band( size_t band_number ) const;
+
+    // empty unless load_lazy() was called
+    lazy_ptr get_lazy_band( size_t band_number ) const;
+
+    // the bands are allocated and hold the values of the image, read on
+    // access if they are lazy; false for packed images
+    bool holds_values() const;
+
+    // histograms of the valid values of every band, from every step-th
+    // line; none if the file cannot be read
+    std::vector<histogram> compute_histograms( size_t step = 1 ) const;
+
+    // per band dark object values: the given percentile of the valid values
+    // (their minimum for 0), from every step-th line; none if the file
+    // cannot be read
+    std::vector<boost::uint8_t> estimate_noise( double percentile = 0.0,
+                                                size_t step = 1 ) const;
+
     image8::ptr remove_additive_noise(
       const std::vector<boost::uint8_t>& noise ) const;
 
+    // estimate_noise followed by the correction, keeping the metadata and
+    // nodata values. Without the bands in memory, each band is read from
+    // the dataset once, block by block, and corrected in memory once it is
+    // counted, or as it is read when step > 1 leaves the estimate to a
+    // decimated read; empty if the file cannot be read
+    image8::ptr remove_additive_noise( double percentile,
+                                       size_t step = 1 ) const;
+
     image8::ptr compute_difference( const image8& other ) const;
 
   private:
+    friend class image_factory;
+
+    image8( GDALDataset* dataset, const std::string& filename,
+            const description& d );
+
     std::vector<band_ptr> bands_;
 
+    std::vector<lazy_ptr> lazy_;
+
+    std::vector<packed_ptr> packed_;
+
+    // false if a tile of a lazy band cannot be read
+    bool pin_lazy_bands() const;
+
+    // before the dataset is closed
+    void detach_lazy_bands();
+
     class predicate {
 
     public:
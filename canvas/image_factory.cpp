@@ -0,0 +1,275 @@
+#include <canvas/image_factory.hpp>
+#include <canvas/image8.hpp>
+#include <canvas/image16.hpp>
+#include <canvas/image32.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+
+#include <ctime>
+#include <iostream>
+#include <map>
+
+namespace canvas {
+
+  namespace {
+
+    // modification time and size of a file
+    struct stamp {
+
+      std::time_t mtime;
+
+      boost::uintmax_t size;
+
+    };
+
+    // false for paths that are not files, such as GDAL virtual paths
+    bool get_stamp( const std::string& filename, stamp& s )
+    {
+      boost::system::error_code e;
+      boost::filesystem::path p( filename );
+
+      s.mtime = boost::filesystem::last_write_time( p, e );
+
+      if( e ) {
+
+        return false;
+      }
+
+      s.size = boost::filesystem::file_size( p, e );
+
+      return !e;
+    }
+
+    struct cache_entry {
+
+      stamp s;
+
+      image::description d;
+
+    };
+
+    struct cache {
+
+      boost::mutex mutex;
+
+      std::map<std::string,cache_entry> entries;
+
+    };
+
+    cache& get_cache()
+    {
+      static cache c;
+      return c;
+    }
+
+    // description cached for filename as stamped by s
+    bool find( const std::string& filename, const stamp& s,
+               image::description& d )
+    {
+      cache& c( get_cache() );
+      boost::lock_guard<boost::mutex> lock( c.mutex );
+
+      std::map<std::string,cache_entry>::const_iterator it(
+        c.entries.find( filename )
+      );
+
+      if( ( it == c.entries.end() ) || ( it->second.s.mtime != s.mtime ) ||
+          ( it->second.s.size != s.size ) ) {
+
+        return false;
+      }
+
+      d = it->second.d;
+
+      return true;
+    }
+
+    boost::once_flag drivers_once = BOOST_ONCE_INIT;
+
+    void register_all()
+    {
+      GDALAllRegister();
+    }
+
+    image::pixel_type get_type( GDALDataType type )
+    {
+      switch( type ) {
+
+      case GDT_Byte:
+        return image::Byte;
+
+      case GDT_UInt16:
+        return image::UInt16;
+
+      case GDT_Float32:
+        return image::Float32;
+
+      default:
+        return image::Undefined;
+      }
+    }
+
+  }
+
+  image::ptr image_factory::open( const std::string& filename )
+  {
+    utility::profiler::scope profile( "image_factory::open" );
+
+    register_drivers();
+
+    GDALDataset* dataset = ( GDALDataset* ) GDALOpen( filename.c_str(),
+                                                      GA_ReadOnly );
+
+    if( dataset == NULL ) {
+
+      std::cerr << "Unable to open image " << filename << std::endl;
+      return image::ptr();
+    }
+
+    image::description d( describe( filename, dataset ) );
+
+    // the image takes the dataset
+    switch( d.type ) {
+
+    case image::Byte:
+      return image::ptr( new image8( dataset, filename, d ) );
+
+    case image::UInt16:
+      return image::ptr( new image16( dataset, filename, d ) );
+
+    case image::Float32:
+      return image::ptr( new image32( dataset, filename, d ) );
+
+    default:
+      break;
+    }
+
+    std::cerr << "Unsupported pixel type in " << filename << std::endl;
+    GDALClose( dataset );
+
+    return image::ptr();
+  }
+
+  image::pixel_type image_factory::get_pixel_type(
+    const std::string& filename )
+  {
+    image::description d;
+    stamp s;
+
+    if( get_stamp( filename, s ) && find( filename, s, d ) ) {
+
+      return d.type;
+    }
+
+    register_drivers();
+
+    GDALDataset* dataset = ( GDALDataset* ) GDALOpen( filename.c_str(),
+                                                      GA_ReadOnly );
+
+    if( dataset == NULL ) {
+
+      std::cerr << "Unable to open image " << filename << std::endl;
+      return image::Undefined;
+    }
+
+    d = describe( filename, dataset );
+    GDALClose( dataset );
+
+    return d.type;
+  }
+
+  image::description image_factory::describe( const std::string& filename,
+                                              GDALDataset* dataset )
+  {
+    BOOST_ASSERT( dataset != NULL );
+
+    image::description d;
+
+    // stamped before reading, so that a later change is not hidden
+    stamp s;
+    bool stamped( get_stamp( filename, s ) );
+
+    if( stamped && find( filename, s, d ) ) {
+
+      return d;
+    }
+
+    d.lines    = dataset->GetRasterYSize();
+    d.columns  = dataset->GetRasterXSize();
+    d.channels = dataset->GetRasterCount();
+    d.type     = image::Undefined;
+
+    for( size_t k = 1; k <= d.channels; ++k ) {
+
+      GDALRasterBand* band_handle = dataset->GetRasterBand( k );
+
+      int fetch;
+      double null( band_handle->GetNoDataValue( &fetch ) );
+      d.nodata.push_back( fetch ? null : 0.0 );
+
+      image::pixel_type type( get_type(
+        band_handle->GetRasterDataType()
+      ) );
+
+      if( k == 1 ) {
+
+        d.type = type;
+
+      } else if( type != d.type ) {
+
+        d.type = ( ( type == image::Undefined ) ||
+                   ( d.type == image::Undefined ) ) ? image::Undefined
+                                                    : image::Mixed;
+      }
+    }
+
+    if( dataset->GetProjectionRef() != NULL ) {
+
+      double tmp[6];
+
+      if( dataset->GetGeoTransform( tmp ) == CE_None ) {
+
+        double pixel_size( tmp[1] );
+        CGAL::Bbox_2 bb( tmp[0], tmp[3] - pixel_size * d.lines,
+                         tmp[0] + pixel_size * d.columns, tmp[3] );
+        std::string proj_tag( dataset->GetProjectionRef() );
+
+        d.md.reset( new image::metadata( pixel_size, bb, proj_tag ) );
+      }
+    }
+
+    if( stamped ) {
+
+      cache& c( get_cache() );
+      boost::lock_guard<boost::mutex> lock( c.mutex );
+
+      if( c.entries.size() >= CACHE_ENTRIES ) {
+
+        c.entries.clear();
+      }
+
+      cache_entry& entry( c.entries[filename] );
+      entry.s = s;
+      entry.d = d;
+    }
+
+    return d;
+  }
+
+  void image_factory::register_drivers()
+  {
+    boost::call_once( &register_all, drivers_once );
+  }
+
+  void image_factory::clear_cache()
+  {
+    cache& c( get_cache() );
+    boost::lock_guard<boost::mutex> lock( c.mutex );
+
+    c.entries.clear();
+  }
+
+}
@@ -0,0 +1,41 @@
+#ifndef CANVAS_IMAGE_FACTORY_HPP
+#define CANVAS_IMAGE_FACTORY_HPP
+
+#include <canvas/image.hpp>
+
+#include <string>
+
+namespace canvas {
+
+  // Opens files once as the image type of their bands. The description of
+  // every file opened is cached by path and kept while the modification
+  // time and size of the file do not change, so that opening many tiles
+  // again neither queries each band nor opens them to find their type.
+  class image_factory {
+
+  public:
+    // descriptions kept before the cache is emptied
+    static const size_t CACHE_ENTRIES = 65536;
+
+    // an image8, image16 or image32 on the file opened once, empty if it
+    // cannot be opened or its bands do not share a supported type
+    static image::ptr open( const std::string& filename );
+
+    // type of the bands, opening the file only if it is not in the cache
+    static image::pixel_type get_pixel_type( const std::string& filename );
+
+    // description of dataset, opened from filename, from the cache when the
+    // file did not change
+    static image::description describe( const std::string& filename,
+                                        GDALDataset* dataset );
+
+    // GDAL drivers, registered once per process
+    static void register_drivers();
+
+    static void clear_cache();
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,506 @@
+#include <canvas/image_stack.hpp>
+
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace canvas {
+
+  namespace {
+
+    // fraction of a pixel by which an image may be off the grid of the
+    // first, for rounding in the georeferencing
+    const double GRID_TOLERANCE = 1e-3;
+
+    // true if offset, in pixels, is a whole number of them
+    bool is_whole( double offset )
+    {
+      return std::fabs( offset - std::floor( offset + 0.5 ) ) <=
+             GRID_TOLERANCE;
+    }
+
+    // the pixel edge nearest to position
+    size_t round_position( double position )
+    {
+      return static_cast<size_t>( std::max( std::floor( position + 0.5 ),
+                                            0.0 ) );
+    }
+
+    // one value per pixel of a block from the valid values of its vector
+    bool reduce_block( image_stack::statistic s, block_sink* output,
+                       float nodata, const image_stack::block& b )
+    {
+      size_t n( b.get_images() );
+
+      std::vector<float> result( b.size() );
+      std::vector<float> valid;
+      valid.reserve( n );
+
+      for( size_t p = 0; p < b.size(); ++p ) {
+
+        const float* v( b.get_vector( p ) );
+
+        valid.clear();
+
+        for( size_t k = 0; k < n; ++k ) {
+
+          if( b.is_valid( k, v[k] ) ) {
+
+            valid.push_back( v[k] );
+          }
+        }
+
+        if( valid.empty() ) {
+
+          result[p] = ( s == image_stack::Count ) ? 0.0f : nodata;
+          continue;
+        }
+
+        double sum( 0.0 ), sum2( 0.0 );
+
+        switch( s ) {
+
+        case image_stack::Count:
+
+          result[p] = valid.size();
+          break;
+
+        case image_stack::Mean:
+        case image_stack::Variance:
+
+          for( size_t k = 0; k < valid.size(); ++k ) {
+
+            sum += valid[k];
+          }
+
+          if( s == image_stack::Mean ) {
+
+            result[p] = sum / valid.size();
+            break;
+          }
+
+          for( size_t k = 0; k < valid.size(); ++k ) {
+
+            double d( valid[k] - sum / valid.size() );
+            sum2 += d * d;
+          }
+
+          result[p] = ( valid.size() > 1 ) ? sum2 / ( valid.size() - 1 ) : 0.0;
+          break;
+
+        case image_stack::Minimum:
+
+          result[p] = *std::min_element( valid.begin(), valid.end() );
+          break;
+
+        case image_stack::Maximum:
+
+          result[p] = *std::max_element( valid.begin(), valid.end() );
+          break;
+
+        case image_stack::Median:
+
+          {
+            // the mean of the two middle values for an even count
+            size_t m( valid.size() / 2 );
+            std::nth_element( valid.begin(), valid.begin() + m, valid.end() );
+            double median( valid[m] );
+
+            if( !( valid.size() % 2 ) ) {
+
+              median = 0.5 * ( median +
+                *std::max_element( valid.begin(), valid.begin() + m ) );
+            }
+
+            result[p] = median;
+          }
+          break;
+        }
+      }
+
+      return output->write( b.get_band(), b.get_l1(), b.get_l2(),
+                            &result[0] );
+    }
+
+  }
+
+  size_t image_stack::block::get_band() const
+  {
+    return band_;
+  }
+
+  size_t image_stack::block::get_l1() const
+  {
+    return l1_;
+  }
+
+  size_t image_stack::block::get_l2() const
+  {
+    return l2_;
+  }
+
+  size_t image_stack::block::get_columns() const
+  {
+    return columns_;
+  }
+
+  size_t image_stack::block::size() const
+  {
+    return ( l2_ - l1_ ) * columns_;
+  }
+
+  size_t image_stack::block::get_images() const
+  {
+    return images_;
+  }
+
+  // shared by the threads of for_each_block
+  struct image_stack::job {
+
+    const block_function* f;
+
+    size_t block_lines;
+
+    size_t blocks;
+
+    // 0 for every band
+    size_t band_number;
+
+    // blocks of every band, band by band
+    size_t tasks;
+
+    size_t next;
+
+    bool ok;
+
+    boost::mutex mutex;
+
+  };
+
+  image_stack::image_stack( const std::vector<image::const_ptr>& images )
+    : images_( images ), lines_( 0 ), columns_( 0 ), channels_( 0 ),
+      valid_( false )
+  {
+    if( images_.empty() ) {
+
+      std::cerr << "Empty image stack" << std::endl;
+      return;
+    }
+
+    boost::shared_ptr<image::metadata> md( images_[0]->get_metadata() );
+
+    if( !md ) {
+
+      std::cerr << "Image stack without georeferencing" << std::endl;
+      return;
+    }
+
+    double xmin( md->get<1>().xmin() ), xmax( md->get<1>().xmax() );
+    double ymin( md->get<1>().ymin() ), ymax( md->get<1>().ymax() );
+
+    channels_ = images_[0]->get_channels();
+
+    for( size_t k = 1; k < images_.size(); ++k ) {
+
+      boost::shared_ptr<image::metadata> k_md( images_[k]->get_metadata() );
+
+      if( !k_md || ( k_md->get<0>() != md->get<0>() ) ||
+          ( k_md->get<2>() != md->get<2>() ) ||
+          ( images_[k]->get_channels() != channels_ ) ) {
+
+        std::cerr << "Image " << k << " differs from the first in pixel "
+                  << "size, projection or bands" << std::endl;
+        return;
+      }
+
+      const CGAL::Bbox_2& bb( k_md->get<1>() );
+
+      double ps( md->get<0>() );
+
+      if( !is_whole( ( bb.xmin() - md->get<1>().xmin() ) / ps ) ||
+          !is_whole( ( bb.ymax() - md->get<1>().ymax() ) / ps ) ) {
+
+        std::cerr << "Image " << k << " is not on the grid of the first"
+                  << std::endl;
+        return;
+      }
+
+      xmin = std::max( xmin, bb.xmin() );
+      xmax = std::min( xmax, bb.xmax() );
+      ymin = std::max( ymin, bb.ymin() );
+      ymax = std::min( ymax, bb.ymax() );
+    }
+
+    if( ( xmin >= xmax ) || ( ymin >= ymax ) ) {
+
+      std::cerr << "The images of the stack do not overlap" << std::endl;
+      return;
+    }
+
+    Kernel::Point_2 ul( xmin, ymax );
+    Kernel::Point_2 lr( xmax, ymin );
+
+    for( size_t k = 0; k < images_.size(); ++k ) {
+
+      image::pixel k_ul( images_[k]->compute_position( ul ) );
+      image::pixel k_lr( images_[k]->compute_position( lr ) );
+
+      // the corners of the overlap are pixel edges of every image
+      image::window w;
+      w.l1 = round_position( k_ul.get<1>() );
+      w.c1 = round_position( k_ul.get<0>() );
+      w.l2 = std::min( round_position( k_lr.get<1>() ),
+                       images_[k]->get_lines() );
+      w.c2 = std::min( round_position( k_lr.get<0>() ),
+                       images_[k]->get_columns() );
+
+      if( k && ( ( w.l2 - w.l1 != windows_[0].l2 - windows_[0].l1 ) ||
+                 ( w.c2 - w.c1 != windows_[0].c2 - windows_[0].c1 ) ) ) {
+
+        std::cerr << "Image " << k << " is not on the grid of the first"
+                  << std::endl;
+        return;
+      }
+
+      windows_.push_back( w );
+    }
+
+    lines_   = windows_[0].l2 - windows_[0].l1;
+    columns_ = windows_[0].c2 - windows_[0].c1;
+
+    double ps( md->get<0>() );
+    const CGAL::Bbox_2& bb( md->get<1>() );
+    const image::window& w( windows_[0] );
+
+    metadata_.reset( new image::metadata(
+      ps, CGAL::Bbox_2( bb.xmin() + w.c1 * ps, bb.ymax() - w.l2 * ps,
+                        bb.xmin() + w.c2 * ps, bb.ymax() - w.l1 * ps ),
+      md->get<2>()
+    ) );
+
+    valid_ = true;
+  }
+
+  bool image_stack::is_valid() const
+  {
+    return valid_;
+  }
+
+  size_t image_stack::size() const
+  {
+    return images_.size();
+  }
+
+  const image::const_ptr& image_stack::get_image( size_t index ) const
+  {
+    BOOST_ASSERT( index < images_.size() );
+
+    return images_[index];
+  }
+
+  const image::window& image_stack::get_window( size_t index ) const
+  {
+    BOOST_ASSERT( index < windows_.size() );
+
+    return windows_[index];
+  }
+
+  size_t image_stack::get_lines() const
+  {
+    return lines_;
+  }
+
+  size_t image_stack::get_columns() const
+  {
+    return columns_;
+  }
+
+  size_t image_stack::get_channels() const
+  {
+    return channels_;
+  }
+
+  boost::shared_ptr<image::metadata> image_stack::get_metadata() const
+  {
+    return metadata_;
+  }
+
+  bool image_stack::for_each_block( const block_function& f,
+                                    size_t threads,
+                                    size_t band_number ) const
+  {
+    utility::profiler::scope profile( "image_stack::for_each_block" );
+
+    if( !valid_ ) {
+
+      return false;
+    }
+
+    BOOST_ASSERT( band_number <= channels_ );
+
+    if( !lines_ || !columns_ || !channels_ ) {
+
+      return true;
+    }
+
+    job j;
+    j.f = &f;
+    j.block_lines = std::max( BLOCK_PIXELS / columns_,
+                              static_cast<size_t>( 1 ) );
+    j.blocks = ( lines_ + j.block_lines - 1 ) / j.block_lines;
+    j.band_number = band_number;
+    j.tasks = j.blocks * ( band_number ? 1 : channels_ );
+    j.next = 0;
+    j.ok = true;
+
+    utility::thread_pool::global().run(
+      boost::bind( &image_stack::run_blocks, this, &j ),
+      utility::thread_pool::get_threads( threads, j.tasks )
+    );
+
+    return j.ok;
+  }
+
+  void image_stack::run_blocks( const image_stack* self, job* j )
+  {
+    block b;
+    std::vector<float> buffer;
+
+    for( ;; ) {
+
+      size_t task;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( !j->ok || ( j->next >= j->tasks ) ) {
+
+          return;
+        }
+
+        task = j->next++;
+      }
+
+      size_t band_number( j->band_number ? j->band_number
+                                         : task / j->blocks + 1 );
+      size_t l1( ( task % j->blocks ) * j->block_lines );
+      size_t l2( std::min( l1 + j->block_lines, self->lines_ ) );
+
+      if( !self->read_block( band_number, l1, l2, b, buffer ) ||
+          !( *j->f )( b ) ) {
+
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+        j->ok = false;
+        return;
+      }
+    }
+  }
+
+  bool image_stack::read_block( size_t band_number, size_t l1, size_t l2,
+                                block& b, std::vector<float>& buffer ) const
+  {
+    size_t n( images_.size() );
+    size_t pixels( ( l2 - l1 ) * columns_ );
+
+    b.band_ = band_number;
+    b.l1_ = l1;
+    b.l2_ = l2;
+    b.columns_ = columns_;
+    b.images_ = n;
+    b.values_.resize( pixels * n );
+    b.nodata_.resize( n );
+
+    buffer.resize( pixels );
+
+    for( size_t k = 0; k < n; ++k ) {
+
+      const image::window& w( windows_[k] );
+
+      if( !images_[k]->read_window( band_number, w.l1 + l1, w.c1,
+                                    w.l1 + l2, w.c2, &buffer[0] ) ) {
+
+        return false;
+      }
+
+      b.nodata_[k] =
+        static_cast<float>( images_[k]->get_nodata( band_number ) );
+
+      // interleaved, the values of a pixel across the stack side by side
+      float* out( &b.values_[k] );
+
+      for( size_t p = 0; p < pixels; ++p, out += n ) {
+
+        *out = buffer[p];
+      }
+    }
+
+    return true;
+  }
+
+  image32::ptr image_stack::create_reference() const
+  {
+    image32::ptr reference( new image32( lines_, columns_, channels_ ) );
+    reference->set_metadata( metadata_ );
+
+    return reference;
+  }
+
+  image32::ptr image_stack::compute( statistic s, double nodata,
+                                     size_t threads ) const
+  {
+    utility::profiler::scope profile( "image_stack::compute" );
+
+    image32::ptr result;
+
+    if( !valid_ ) {
+
+      return result;
+    }
+
+    result = band_sink::create( *create_reference(), channels_, nodata );
+
+    band_sink output( result );
+
+    if( !compute( s, output, static_cast<float>( nodata ), threads ) ) {
+
+      result.reset();
+    }
+
+    return result;
+  }
+
+  bool image_stack::compute( statistic s, const std::string& filename,
+                             double nodata, size_t threads ) const
+  {
+    utility::profiler::scope profile( "image_stack::compute_file" );
+
+    if( !valid_ ) {
+
+      return false;
+    }
+
+    file_sink output( filename, *create_reference(), channels_, nodata );
+
+    if( !output.is_open() ) {
+
+      return false;
+    }
+
+    return compute( s, output, static_cast<float>( nodata ), threads );
+  }
+
+  bool image_stack::compute( statistic s, block_sink& output, float nodata,
+                             size_t threads ) const
+  {
+    return for_each_block( boost::bind( &reduce_block, s, &output, nodata,
+                                        _1 ), threads );
+  }
+
+}
@@ -0,0 +1,161 @@
+#ifndef CANVAS_IMAGE_STACK_HPP
+#define CANVAS_IMAGE_STACK_HPP
+
+#include <canvas/block_sink.hpp>
+#include <canvas/image32.hpp>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // Images on the same grid (pixel size, projection and pixel alignment)
+  // restricted to the window they all cover, computed once. Blocks of lines
+  // of that window are read from every image of the stack together and
+  // handed to several threads, with the values of each pixel across the
+  // stack side by side, so that operations over all the images, or any
+  // pair of them, take a single pass over the inputs.
+  class image_stack : private boost::noncopyable {
+
+  public:
+    typedef boost::shared_ptr<image_stack> ptr;
+
+    // pixels read together from each image, per thread
+    static const size_t BLOCK_PIXELS = 65536;
+
+    // per pixel statistics over the valid values of the stack
+    enum statistic { Count=0, Mean=1, Minimum=2, Maximum=3, Variance=4,
+                     Median=5 };
+
+    // lines [l1, l2) of the common window for one band, as a vector of the
+    // values of every image per pixel
+    class block {
+
+    public:
+      size_t get_band() const;
+
+      size_t get_l1() const;
+
+      size_t get_l2() const;
+
+      size_t get_columns() const;
+
+      // pixels of the block
+      size_t size() const;
+
+      size_t get_images() const;
+
+      // the values of pixel p (line ( p / columns ) of the block), one per
+      // image in stack order
+      const float* get_vector( size_t p ) const
+      {
+        return &values_[p * images_];
+      }
+
+      float get_nodata( size_t image ) const
+      {
+        return nodata_[image];
+      }
+
+      // neither nodata nor NaN
+      bool is_valid( size_t image, float value ) const
+      {
+        return ( value != nodata_[image] ) && ( value == value );
+      }
+
+    private:
+      friend class image_stack;
+
+      size_t band_;
+
+      size_t l1_;
+
+      size_t l2_;
+
+      size_t columns_;
+
+      size_t images_;
+
+      std::vector<float> values_;
+
+      std::vector<float> nodata_;
+
+    };
+
+    // false to stop the other blocks
+    typedef boost::function<bool( const block& )> block_function;
+
+    // the images must share pixel size, projection and band count; errors
+    // are reported on std::cerr and leave the stack invalid
+    explicit image_stack( const std::vector<image::const_ptr>& images );
+
+    bool is_valid() const;
+
+    // images in the stack
+    size_t size() const;
+
+    const image::const_ptr& get_image( size_t index ) const;
+
+    // the common window in the pixels of an image
+    const image::window& get_window( size_t index ) const;
+
+    size_t get_lines() const;
+
+    size_t get_columns() const;
+
+    size_t get_channels() const;
+
+    // georeferencing of the common window
+    boost::shared_ptr<image::metadata> get_metadata() const;
+
+    // calls f on every block of every band (or of band_number only), from
+    // several threads at once; false if an image could not be read or f
+    // returned false
+    bool for_each_block( const block_function& f, size_t threads = 0,
+                         size_t band_number = 0 ) const;
+
+    // one band per band of the stack, nodata where no image is valid
+    image32::ptr compute( statistic s, double nodata = -9999.0,
+                          size_t threads = 0 ) const;
+
+    bool compute( statistic s, const std::string& filename,
+                  double nodata = -9999.0, size_t threads = 0 ) const;
+
+  private:
+    struct job;
+
+    static void run_blocks( const image_stack* self, job* j );
+
+    bool read_block( size_t band_number, size_t l1, size_t l2, block& b,
+                     std::vector<float>& buffer ) const;
+
+    // an unallocated image with the size and georeferencing of the window
+    image32::ptr create_reference() const;
+
+    bool compute( statistic s, block_sink& output, float nodata,
+                  size_t threads ) const;
+
+    std::vector<image::const_ptr> images_;
+
+    std::vector<image::window> windows_;
+
+    boost::shared_ptr<image::metadata> metadata_;
+
+    size_t lines_;
+
+    size_t columns_;
+
+    size_t channels_;
+
+    bool valid_;
+
+  };
+
+}
+
+#endif
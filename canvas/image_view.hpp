@@ -0,0 +1,255 @@
+#ifndef CANVAS_IMAGE_VIEW_HPP
+#define CANVAS_IMAGE_VIEW_HPP
+
+#include <canvas/image.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // A window of an image8, image16 or image32 with its bands in memory,
+  // seen as an image of its own without copying: line i of a band of the
+  // view starts get_stride() values after line i - 1, in the memory of the
+  // band of the image. The view holds the image and its bands as they are
+  // when it is made, so that changes to their values show through it.
+  // Only the tiles of the window are read from lazy bands; packed images
+  // have no bands to share and must be unpacked first, and make_view gives
+  // no view of them or of images whose bands are not loaded.
+  //
+  // The metadata of the view is that of the window, so that positions and
+  // values are computed relative to it, and operations that read images
+  // through read_window take views in their place.
+  template <typename image_type>
+  class image_view : public image {
+
+  public:
+    typedef boost::shared_ptr<image_view> ptr;
+
+    typedef typename image_type::band band;
+
+    typedef typename image_type::band_ptr band_ptr;
+
+    typedef typename band::value_type num_type;
+
+    image_view( const boost::shared_ptr<const image_type>& source,
+                size_t l1, size_t c1, size_t l2, size_t c2 )
+      : image( l2 - l1, c2 - c1, source->get_channels() ),
+        source_( source ), l1_( l1 ), c1_( c1 ),
+        stride_( source->get_columns() )
+    {
+      BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= source->get_lines() ) );
+      BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= source->get_columns() ) );
+      BOOST_ASSERT( source->holds_values() );
+
+      for( size_t k = 1; k <= channels_; ++k ) {
+
+        typename image_type::lazy_ptr lazy( source->get_lazy_band( k ) );
+
+        if( lazy ) {
+
+          lazy->pin( l1, c1, l2, c2 );
+          bands_.push_back( lazy->get_band() );
+
+        } else {
+
+          bands_.push_back( source->get_band( k ) );
+        }
+
+        nodata_[k - 1] = source->get_nodata( k );
+      }
+
+      md_ = source->get_window_metadata( l1, c1, l2, c2, lines_, columns_ );
+    }
+
+    // the values are those of the image
+    void allocate( bool fill = false )
+    {
+    }
+
+    void load()
+    {
+    }
+
+    // the window as an image of its own
+    void write( const std::string& filename )
+    {
+      image_type copy( lines_, columns_, channels_ );
+      copy.allocate();
+      copy.set_metadata( md_ );
+
+      for( size_t k = 1; k <= channels_; ++k ) {
+
+        const num_type* from( get_values( k ) );
+        num_type* to( copy.get_band( k )->get() );
+
+        for( size_t i = 0; i < lines_; ++i ) {
+
+          std::copy( from + i * stride_, from + i * stride_ + columns_,
+                     to + i * columns_ );
+        }
+
+        copy.set_nodata( k, nodata_[k - 1] );
+      }
+
+      copy.write( filename );
+    }
+
+    // interpolated as by the image, from the values in memory; nodata
+    // outside the view
+    boost::shared_array<double> compute_values( const pixel& px ) const
+    {
+      boost::shared_array<double> g( new double[channels_] );
+      std::copy( nodata_.get(), nodata_.get() + channels_, g.get() );
+
+      const double& x( px.get<0>() );
+      const double& y( px.get<1>() );
+
+      if( ( x < 0.0 ) || ( y < 0.0 ) || ( x >= columns_ ) ||
+          ( y >= lines_ ) ) {
+
+        return g;
+      }
+
+      size_t i( static_cast<size_t>( y ) );
+      size_t j( static_cast<size_t>( x ) );
+
+      double dx( x - j );
+      double dy( y - i );
+
+      // the last line and column of the view are their own neighbours
+      size_t di( ( i + 1 < lines_ ) ? stride_ : 0 );
+      size_t dj( ( j + 1 < columns_ ) ? 1 : 0 );
+
+      for( size_t k = 1; k <= channels_; ++k ) {
+
+        const num_type* v( get_values( k ) + i * stride_ + j );
+
+        float buffer[4];
+        buffer[0] = static_cast<float>( v[0] );
+        buffer[1] = static_cast<float>( v[dj] );
+        buffer[2] = static_cast<float>( v[di] );
+        buffer[3] = static_cast<float>( v[di + dj] );
+
+        float nd( static_cast<float>( nodata_[k - 1] ) );
+
+        if( std::count( buffer, buffer + 4, nd ) == 0 ) {
+
+          double ga( dx * buffer[1] + ( 1.0 - dx ) * buffer[0] );
+          double gb( dx * buffer[3] + ( 1.0 - dx ) * buffer[2] );
+
+          g[k - 1] = dy * gb + ( 1.0 - dy ) * ga;
+        }
+      }
+
+      return g;
+    }
+
+    bool read_window( size_t band_number, size_t l1, size_t c1,
+                      size_t l2, size_t c2, float* buffer ) const
+    {
+      BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+      BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+      const num_type* values( get_values( band_number ) );
+
+      for( size_t i = l1; i < l2; ++i, buffer += c2 - c1 ) {
+
+        const num_type* line( values + i * stride_ );
+        std::copy( line + c1, line + c2, buffer );
+      }
+
+      return true;
+    }
+
+    const boost::shared_ptr<const image_type>& get_source() const
+    {
+      return source_;
+    }
+
+    // first line and column of the view in the image
+    size_t get_line_offset() const
+    {
+      return l1_;
+    }
+
+    size_t get_column_offset() const
+    {
+      return c1_;
+    }
+
+    // values between the starts of consecutive lines
+    size_t get_stride() const
+    {
+      return stride_;
+    }
+
+    // the first value of the view in a band of the image
+    num_type* get_values( size_t band_number ) const
+    {
+      BOOST_ASSERT( ( band_number >= 1 ) && ( band_number <= channels_ ) );
+      return bands_[band_number - 1]->get() + l1_ * stride_ + c1_;
+    }
+
+    // a view of a window of this view, on the same image
+    ptr get_view( size_t l1, size_t c1, size_t l2, size_t c2 ) const
+    {
+      BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+      BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+      return ptr( new image_view( source_, l1_ + l1, c1_ + c1, l1_ + l2,
+                                  c1_ + c2 ) );
+    }
+
+  private:
+    boost::shared_ptr<const image_type> source_;
+
+    size_t l1_;
+
+    size_t c1_;
+
+    size_t stride_;
+
+    std::vector<band_ptr> bands_;
+
+  };
+
+  // a view of the window [l1, l2) x [c1, c2) of source, empty if source
+  // is packed, its bands are not loaded or the window cannot be read
+  template <typename image_type>
+  typename image_view<image_type>::ptr make_view(
+    const boost::shared_ptr<image_type>& source,
+    size_t l1, size_t c1, size_t l2, size_t c2 )
+  {
+    if( !source->holds_values() ) {
+
+      std::cerr << "Unable to view an image without its bands in memory"
+                << std::endl;
+      return typename image_view<image_type>::ptr();
+    }
+
+    // the tiles of lazy bands are read before the view shares them
+    for( size_t k = 1; k <= source->get_channels(); ++k ) {
+
+      typename image_type::lazy_ptr lazy( source->get_lazy_band( k ) );
+
+      if( lazy && !lazy->pin( l1, c1, l2, c2 ) ) {
+
+        std::cerr << "Unable to read the window of the view" << std::endl;
+        return typename image_view<image_type>::ptr();
+      }
+    }
+
+    return typename image_view<image_type>::ptr(
+      new image_view<image_type>( source, l1, c1, l2, c2 )
+    );
+  }
+
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef CANVAS_LAZY_BAND_HPP
+#define CANVAS_LAZY_BAND_HPP
+
+#include <canvas/image.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <algorithm>
+
+namespace canvas {
+
+  // A band whose values are read from the dataset one tile at a time, the
+  // first time a tile is touched, straight into the contiguous (line-major)
+  // band memory. Tiles follow the dataset block layout; blocks of striped
+  // files are grouped into tiles of at least MIN_TILE_BYTES. Reads hold the
+  // mutex guarding the dataset of the image the band belongs to; the flag
+  // of a tile is set with release ordering after its values are read, so
+  // that a thread seeing it set without the mutex also sees the values.
+  // A tile that fails to read stays unread, and pin reports it.
+  //
+  // The band reads through the dataset and the mutex of its image until the
+  // image detaches it, before closing the dataset in write() or when it is
+  // destroyed; tiles not read by then are never read.
+  template <typename num_type>
+  class lazy_band : private boost::noncopyable {
+
+  public:
+    typedef utility::mapped_memory<num_type> band;
+
+    typedef boost::shared_ptr<band> band_ptr;
+
+    static const size_t MIN_TILE_BYTES = 65536;
+
+    lazy_band( GDALRasterBand* b_handle, GDALDataType type,
+               const size_t& lines, const size_t& columns,
+               const band_ptr& data, boost::mutex& mutex )
+      : b_handle_( b_handle ), type_( type ),
+        lines_( lines ), columns_( columns ), data_( data ), pending_( 0 ),
+        mutex_( &mutex )
+    {
+      BOOST_ASSERT( data_ && ( data_->size() == lines_ * columns_ ) );
+
+      int x_block, y_block;
+      b_handle_->GetBlockSize( &x_block, &y_block );
+
+      tile_columns_ = std::min( static_cast<size_t>( x_block ), columns_ );
+      tile_lines_   = std::min( static_cast<size_t>( y_block ), lines_   );
+
+      size_t tile_bytes( tile_lines_ * tile_columns_ * sizeof( num_type ) );
+
+      if( tile_bytes < MIN_TILE_BYTES ) {
+
+        size_t factor( ( MIN_TILE_BYTES + tile_bytes - 1 ) / tile_bytes );
+        tile_lines_ = std::min( tile_lines_ * factor, lines_ );
+      }
+
+      tiles_x_ = ( columns_ + tile_columns_ - 1 ) / tile_columns_;
+      tiles_y_ = ( lines_   + tile_lines_   - 1 ) / tile_lines_;
+
+      size_t tiles( tiles_x_ * tiles_y_ );
+      loaded_.reset( new boost::atomic<bool>[tiles] );
+
+      for( size_t t = 0; t < tiles; ++t ) {
+
+        loaded_[t].store( false, boost::memory_order_relaxed );
+      }
+
+      pending_.store( tiles, boost::memory_order_release );
+    }
+
+    // makes all values of the window [l1, l2) x [c1, c2) available and
+    // returns the start of the band memory; NULL if a tile cannot be read
+    num_type* pin( size_t l1, size_t c1, size_t l2, size_t c2 )
+    {
+      BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+      BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+      if( !is_complete() ) {
+
+        for( size_t ty = l1 / tile_lines_; ty <= ( l2 - 1 ) / tile_lines_;
+             ++ty ) {
+
+          for( size_t tx = c1 / tile_columns_;
+               tx <= ( c2 - 1 ) / tile_columns_; ++tx ) {
+
+            size_t t( ty * tiles_x_ + tx );
+
+            if( !is_loaded( t ) && !load_tile( t ) ) {
+
+              return NULL;
+            }
+          }
+        }
+      }
+
+      return data_->get();
+    }
+
+    // false if a tile cannot be read
+    bool pin_all()
+    {
+      return !lines_ || !columns_ || ( pin( 0, 0, lines_, columns_ ) != NULL );
+    }
+
+    // stops reading from the dataset of the image, which is about to be
+    // closed; not while the band is being read
+    void detach()
+    {
+      b_handle_ = NULL;
+      mutex_ = NULL;
+    }
+
+    const band_ptr& get_band() const
+    {
+      return data_;
+    }
+
+    size_t get_pending_tiles() const
+    {
+      return pending_.load( boost::memory_order_acquire );
+    }
+
+    bool is_complete() const
+    {
+      return ( get_pending_tiles() == 0 );
+    }
+
+  private:
+    bool is_loaded( const size_t& t ) const
+    {
+      return loaded_[t].load( boost::memory_order_acquire );
+    }
+
+    bool load_tile( const size_t& t )
+    {
+      if( mutex_ == NULL ) {
+
+        return false;
+      }
+
+      boost::lock_guard<boost::mutex> lock( *mutex_ );
+
+      if( is_loaded( t ) ) {
+
+        return true;
+      }
+
+      size_t l1( ( t / tiles_x_ ) * tile_lines_ );
+      size_t c1( ( t % tiles_x_ ) * tile_columns_ );
+
+      size_t lines  ( std::min( tile_lines_,   lines_   - l1 ) );
+      size_t columns( std::min( tile_columns_, columns_ - c1 ) );
+
+      num_type* target( data_->get() + l1 * columns_ + c1 );
+
+      CPLErr e = image::raster_io( b_handle_, GF_Read, c1, l1, columns, lines,
+                                   target, columns, lines, type_,
+                                   sizeof( num_type ),
+                                   columns_ * sizeof( num_type ) );
+
+      if( e != CE_None ) {
+
+        return false;
+      }
+
+      loaded_[t].store( true, boost::memory_order_release );
+      pending_.fetch_sub( 1, boost::memory_order_release );
+
+      return true;
+    }
+
+    GDALRasterBand* b_handle_;
+
+    GDALDataType type_;
+
+    size_t lines_;
+
+    size_t columns_;
+
+    band_ptr data_;
+
+    size_t tile_lines_;
+
+    size_t tile_columns_;
+
+    size_t tiles_x_;
+
+    size_t tiles_y_;
+
+    boost::scoped_array<boost::atomic<bool> > loaded_;
+
+    boost::atomic<size_t> pending_;
+
+    boost::mutex* mutex_;
+
+  };
+
+}
+
+#endif
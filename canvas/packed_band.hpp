@@ -0,0 +1,373 @@
+#ifndef CANVAS_PACKED_BAND_HPP
+#define CANVAS_PACKED_BAND_HPP
+
+#include <utility/mapped_memory.hpp>
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <algorithm>
+#include <list>
+#include <vector>
+
+namespace canvas {
+
+  // A band of integers kept compressed in memory, in square tiles of
+  // TILE_SIZE pixels. Every tile stores its minimum as a frame of reference
+  // and its values as offsets from it packed in as many bits as the range
+  // of the tile needs: homogeneous tiles take no bits at all, and 12-bit
+  // data in 16-bit bands at most 12. Tiles are decoded on demand; the last
+  // tiles used are kept decoded, shared by the threads reading the band.
+  template <typename num_type>
+  class packed_band : private boost::noncopyable {
+
+  public:
+    typedef utility::mapped_memory<num_type> band;
+
+    typedef boost::shared_ptr<band> band_ptr;
+
+    static const size_t TILE_SIZE = 64;
+
+    // tiles kept decoded by default
+    static const size_t CACHE_TILES = 64;
+
+    // tiles packed together by a thread
+    static const size_t PACK_GRAIN = 64;
+
+    // packs the lines x columns values of data, line by line
+    packed_band( const num_type* data, size_t lines, size_t columns,
+                 size_t cache_tiles = CACHE_TILES )
+      : lines_( lines ), columns_( columns ),
+        tiles_x_( ( columns + TILE_SIZE - 1 ) / TILE_SIZE ),
+        tiles_y_( ( lines + TILE_SIZE - 1 ) / TILE_SIZE ),
+        cache_tiles_( std::max( cache_tiles, static_cast<size_t>( 1 ) ) )
+    {
+      utility::profiler::scope profile( "packed_band::pack" );
+
+      size_t tiles( tiles_x_ * tiles_y_ );
+
+      references_.resize( tiles );
+      bits_.resize( tiles );
+      offsets_.assign( tiles + 1, 0 );
+
+      // the size of every tile first, then the tiles packed in place
+      utility::thread_pool::global().parallel_for( 0, tiles, PACK_GRAIN,
+        boost::bind( &packed_band::measure_tiles, this, data, _1, _2 ) );
+
+      for( size_t t = 0; t < tiles; ++t ) {
+
+        offsets_[t + 1] += offsets_[t];
+      }
+
+      words_.assign( offsets_[tiles], 0 );
+
+      utility::thread_pool::global().parallel_for( 0, tiles, PACK_GRAIN,
+        boost::bind( &packed_band::pack_tiles, this, data, _1, _2 ) );
+    }
+
+    size_t get_lines() const
+    {
+      return lines_;
+    }
+
+    size_t get_columns() const
+    {
+      return columns_;
+    }
+
+    // bytes taken by the packed values and the tile headers
+    size_t get_bytes() const
+    {
+      return words_.size() * sizeof( boost::uint64_t ) +
+             references_.size() * ( sizeof( num_type ) + 1 ) +
+             offsets_.size() * sizeof( size_t );
+    }
+
+    num_type operator()( size_t i, size_t j ) const
+    {
+      BOOST_ASSERT( ( i < lines_ ) && ( j < columns_ ) );
+
+      size_t t( ( i / TILE_SIZE ) * tiles_x_ + j / TILE_SIZE );
+
+      return ( *get_tile( t ) )[( i % TILE_SIZE ) * get_width( t ) +
+                                j % TILE_SIZE];
+    }
+
+    // values of the window [l1, l2) x [c1, c2) into buffer, line by line,
+    // through the tiles kept decoded
+    template <typename out_type>
+    void read( size_t l1, size_t c1, size_t l2, size_t c2,
+               out_type* buffer ) const
+    {
+      BOOST_ASSERT( ( l1 < l2 ) && ( l2 <= lines_ ) );
+      BOOST_ASSERT( ( c1 < c2 ) && ( c2 <= columns_ ) );
+
+      size_t columns( c2 - c1 );
+
+      for( size_t ty = l1 / TILE_SIZE; ty <= ( l2 - 1 ) / TILE_SIZE; ++ty ) {
+
+        for( size_t tx = c1 / TILE_SIZE; tx <= ( c2 - 1 ) / TILE_SIZE;
+             ++tx ) {
+
+          size_t t( ty * tiles_x_ + tx );
+          size_t width( get_width( t ) );
+
+          tile_ptr values( get_tile( t ) );
+
+          size_t i1( std::max( l1, ty * TILE_SIZE ) );
+          size_t i2( std::min( l2, ty * TILE_SIZE + TILE_SIZE ) );
+          size_t j1( std::max( c1, tx * TILE_SIZE ) );
+          size_t j2( std::min( c2, tx * TILE_SIZE + width ) );
+
+          for( size_t i = i1; i < i2; ++i ) {
+
+            const num_type* from( &( *values )[( i - ty * TILE_SIZE ) * width
+                                               + j1 - tx * TILE_SIZE] );
+
+            std::copy( from, from + ( j2 - j1 ),
+                       buffer + ( i - l1 ) * columns + j1 - c1 );
+          }
+        }
+      }
+    }
+
+    // every value decoded into a new band
+    band_ptr unpack() const
+    {
+      utility::profiler::scope profile( "packed_band::unpack" );
+
+      band_ptr result( new band( lines_ * columns_ ) );
+
+      utility::thread_pool::global().parallel_for( 0, tiles_x_ * tiles_y_,
+        PACK_GRAIN, boost::bind( &packed_band::unpack_tiles, this,
+                                 result->get(), _1, _2 ) );
+
+      return result;
+    }
+
+  private:
+    typedef boost::shared_ptr<std::vector<num_type> > tile_ptr;
+
+    struct cached_tile {
+
+      size_t tile;
+
+      tile_ptr values;
+
+    };
+
+    size_t get_width( size_t t ) const
+    {
+      size_t size( TILE_SIZE );
+      return std::min( size, columns_ - ( t % tiles_x_ ) * size );
+    }
+
+    size_t get_height( size_t t ) const
+    {
+      size_t size( TILE_SIZE );
+      return std::min( size, lines_ - ( t / tiles_x_ ) * size );
+    }
+
+    // start of tile t in data, of columns_ values per line
+    size_t get_origin( size_t t ) const
+    {
+      return ( t / tiles_x_ ) * TILE_SIZE * columns_ +
+             ( t % tiles_x_ ) * TILE_SIZE;
+    }
+
+    void measure_tiles( const num_type* data, size_t first, size_t last )
+    {
+      for( size_t t = first; t < last; ++t ) {
+
+        size_t width( get_width( t ) );
+        size_t height( get_height( t ) );
+        const num_type* origin( data + get_origin( t ) );
+
+        num_type minimum( *origin ), maximum( *origin );
+
+        for( size_t i = 0; i < height; ++i ) {
+
+          const num_type* line( origin + i * columns_ );
+
+          for( size_t j = 0; j < width; ++j ) {
+
+            minimum = std::min( minimum, line[j] );
+            maximum = std::max( maximum, line[j] );
+          }
+        }
+
+        boost::uint32_t range( maximum - minimum );
+        boost::uint8_t bits( 0 );
+
+        while( range >> bits ) {
+
+          ++bits;
+        }
+
+        references_[t] = minimum;
+        bits_[t] = bits;
+        offsets_[t + 1] = ( width * height * bits + 63 ) / 64;
+      }
+    }
+
+    void pack_tiles( const num_type* data, size_t first, size_t last )
+    {
+      for( size_t t = first; t < last; ++t ) {
+
+        size_t bits( bits_[t] );
+
+        if( !bits ) {
+
+          continue;
+        }
+
+        size_t width( get_width( t ) );
+        size_t height( get_height( t ) );
+        const num_type* origin( data + get_origin( t ) );
+        boost::uint64_t* words( &words_[offsets_[t]] );
+        size_t position( 0 );
+
+        for( size_t i = 0; i < height; ++i ) {
+
+          const num_type* line( origin + i * columns_ );
+
+          for( size_t j = 0; j < width; ++j, position += bits ) {
+
+            boost::uint64_t v( line[j] - references_[t] );
+            size_t w( position / 64 ), s( position % 64 );
+
+            words[w] |= v << s;
+
+            if( s + bits > 64 ) {
+
+              words[w + 1] |= v >> ( 64 - s );
+            }
+          }
+        }
+      }
+    }
+
+    // tile t into values, width values per line
+    void decode( size_t t, num_type* values, size_t stride ) const
+    {
+      size_t bits( bits_[t] );
+      size_t width( get_width( t ) );
+      size_t height( get_height( t ) );
+      num_type reference( references_[t] );
+
+      if( !bits ) {
+
+        for( size_t i = 0; i < height; ++i ) {
+
+          std::fill_n( values + i * stride, width, reference );
+        }
+
+        return;
+      }
+
+      const boost::uint64_t* words( &words_[offsets_[t]] );
+      boost::uint64_t mask( ( static_cast<boost::uint64_t>( 1 ) << bits ) - 1 );
+      size_t position( 0 );
+
+      for( size_t i = 0; i < height; ++i ) {
+
+        num_type* line( values + i * stride );
+
+        for( size_t j = 0; j < width; ++j, position += bits ) {
+
+          size_t w( position / 64 ), s( position % 64 );
+          boost::uint64_t v( words[w] >> s );
+
+          if( s + bits > 64 ) {
+
+            v |= words[w + 1] << ( 64 - s );
+          }
+
+          line[j] = static_cast<num_type>( reference + ( v & mask ) );
+        }
+      }
+    }
+
+    void unpack_tiles( num_type* data, size_t first, size_t last ) const
+    {
+      for( size_t t = first; t < last; ++t ) {
+
+        decode( t, data + get_origin( t ), columns_ );
+      }
+    }
+
+    // tile t decoded, from the cache when it is there
+    tile_ptr get_tile( size_t t ) const
+    {
+      {
+        boost::lock_guard<boost::mutex> lock( mutex_ );
+
+        for( typename std::list<cached_tile>::iterator it = cache_.begin();
+             it != cache_.end(); ++it ) {
+
+          if( it->tile == t ) {
+
+            cache_.splice( cache_.begin(), cache_, it );
+            return it->values;
+          }
+        }
+      }
+
+      tile_ptr values( new std::vector<num_type>(
+        get_width( t ) * get_height( t )
+      ) );
+
+      decode( t, &( *values )[0], get_width( t ) );
+
+      cached_tile c;
+      c.tile = t;
+      c.values = values;
+
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+
+      cache_.push_front( c );
+
+      if( cache_.size() > cache_tiles_ ) {
+
+        cache_.pop_back();
+      }
+
+      return values;
+    }
+
+    size_t lines_;
+
+    size_t columns_;
+
+    size_t tiles_x_;
+
+    size_t tiles_y_;
+
+    size_t cache_tiles_;
+
+    // per tile: frame of reference, bits per value and first word
+    std::vector<num_type> references_;
+
+    std::vector<boost::uint8_t> bits_;
+
+    std::vector<size_t> offsets_;
+
+    std::vector<boost::uint64_t> words_;
+
+    // most recently used first
+    mutable std::list<cached_tile> cache_;
+
+    mutable boost::mutex mutex_;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include <canvas/raster_cache.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace canvas {
+
+  namespace {
+
+    struct settings {
+
+      settings()
+      {
+        const char* value( getenv( "CANVAS_RASTER_CACHE" ) );
+
+        if( value ) {
+
+          directory = value;
+        }
+      }
+
+      boost::mutex mutex;
+
+      std::string directory;
+
+    };
+
+    settings& get_settings()
+    {
+      static settings s;
+      return s;
+    }
+
+    // modification time, size and a checksum of the path and of both ends
+    // of a file; empty for paths that are not files, such as GDAL virtual
+    // paths
+    std::vector<boost::uint64_t> get_fingerprint( const std::string& filename )
+    {
+      std::vector<boost::uint64_t> result;
+
+      boost::system::error_code e;
+      boost::filesystem::path p( filename );
+
+      std::time_t mtime( boost::filesystem::last_write_time( p, e ) );
+
+      if( e ) {
+
+        return result;
+      }
+
+      boost::uintmax_t size( boost::filesystem::file_size( p, e ) );
+
+      if( e ) {
+
+        return result;
+      }
+
+      std::ifstream in( filename.c_str(), std::ios::binary );
+
+      if( !in ) {
+
+        return result;
+      }
+
+      utility::columnar::checksum sum;
+      sum.update( filename.data(), filename.size() );
+
+      size_t bytes( raster_cache::FINGERPRINT_BYTES );
+      std::vector<char> buffer( bytes );
+
+      // the start, then the end if the file is longer
+      size_t head( std::min<boost::uintmax_t>( size, bytes ) );
+      size_t tail( std::min<boost::uintmax_t>( size - head, bytes ) );
+
+      if( !in.read( &buffer[0], head ) ) {
+
+        return result;
+      }
+
+      sum.update( &buffer[0], head );
+
+      if( tail ) {
+
+        in.seekg( size - tail );
+
+        if( !in.read( &buffer[0], tail ) ) {
+
+          return result;
+        }
+
+        sum.update( &buffer[0], tail );
+      }
+
+      result.push_back( static_cast<boost::uint64_t>( mtime ) );
+      result.push_back( size );
+      result.push_back( sum.value() );
+
+      return result;
+    }
+
+    std::vector<boost::uint64_t> get_shape( const image& input, int type )
+    {
+      std::vector<boost::uint64_t> result;
+
+      result.push_back( input.get_lines() );
+      result.push_back( input.get_columns() );
+      result.push_back( input.get_channels() );
+      result.push_back( type );
+
+      return result;
+    }
+
+    // equal, or both NaN
+    bool same( double a, double b )
+    {
+      return ( a == b ) || ( ( a != a ) && ( b != b ) );
+    }
+
+    template <typename num_type>
+    bool read_column( const utility::columnar::reader& r, size_t n,
+                      std::vector<num_type>& values )
+    {
+      if( r.get_type( n ) != static_cast<utility::columnar::value_type>(
+            utility::columnar::type_of<num_type>::code ) ) {
+
+        return false;
+      }
+
+      boost::shared_ptr<const utility::mapped_memory<num_type> > m(
+        r.map<num_type>( n )
+      );
+
+      if( !m ) {
+
+        return false;
+      }
+
+      values.assign( m->begin(), m->end() );
+
+      return true;
+    }
+
+  }
+
+  void raster_cache::set_directory( const std::string& directory )
+  {
+    settings& s( get_settings() );
+    boost::lock_guard<boost::mutex> lock( s.mutex );
+
+    s.directory = directory;
+  }
+
+  std::string raster_cache::get_directory()
+  {
+    settings& s( get_settings() );
+    boost::lock_guard<boost::mutex> lock( s.mutex );
+
+    return s.directory;
+  }
+
+  std::string raster_cache::get_sidecar( const std::string& filename )
+  {
+    std::string directory( get_directory() );
+
+    boost::system::error_code e;
+
+    // not for GDAL virtual paths
+    if( directory.empty() || filename.empty() ||
+        !boost::filesystem::is_regular_file( filename, e ) ) {
+
+      return std::string();
+    }
+
+    // the stem for people, a hash of the full path for uniqueness
+    boost::filesystem::path p( boost::filesystem::absolute( filename ) );
+
+    std::ostringstream name;
+    name << p.stem().string() << "."
+         << std::hex << boost::hash<std::string>()( p.string() ) << ".raw";
+
+    return ( boost::filesystem::path( directory ) / name.str() ).string();
+  }
+
+  bool raster_cache::check( const utility::columnar::reader& r,
+                            const std::string& filename, const image& input,
+                            int type )
+  {
+    size_t channels( input.get_channels() );
+
+    if( r.get_columns() != HEADER_COLUMNS + channels ) {
+
+      return false;
+    }
+
+    std::vector<boost::uint64_t> shape, source;
+    std::vector<double> nodata;
+
+    if( !read_column( r, 0, shape ) || !read_column( r, 1, nodata ) ||
+        !read_column( r, 4, source ) ) {
+
+      return false;
+    }
+
+    if( ( shape != get_shape( input, type ) ) ||
+        ( nodata.size() != channels ) ) {
+
+      return false;
+    }
+
+    for( size_t k = 0; k < channels; ++k ) {
+
+      if( !same( nodata[k], input.get_nodata( k + 1 ) ) ) {
+
+        return false;
+      }
+
+      size_t n( HEADER_COLUMNS + k );
+
+      if( ( r.get_type( n ) != type ) || ( r.get_count( n ) !=
+            input.get_lines() * input.get_columns() ) ) {
+
+        return false;
+      }
+    }
+
+    std::vector<boost::uint64_t> fingerprint( get_fingerprint( filename ) );
+
+    return !fingerprint.empty() && ( fingerprint == source );
+  }
+
+  bool raster_cache::write_header( utility::columnar::writer& w,
+                                   const std::string& filename,
+                                   const image& input, int type )
+  {
+    std::vector<boost::uint64_t> fingerprint( get_fingerprint( filename ) );
+
+    if( fingerprint.empty() ) {
+
+      return false;
+    }
+
+    std::vector<double> nodata, georef;
+    std::vector<boost::uint8_t> projection;
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      nodata.push_back( input.get_nodata( k ) );
+    }
+
+    // pixel size and bounding box, empty without a geotransform
+    boost::shared_ptr<image::metadata> md( input.get_metadata() );
+
+    if( md ) {
+
+      const CGAL::Bbox_2& box( md->get<1>() );
+
+      georef.push_back( md->get<0>() );
+      georef.push_back( box.xmin() );
+      georef.push_back( box.ymin() );
+      georef.push_back( box.xmax() );
+      georef.push_back( box.ymax() );
+
+      projection.assign( md->get<2>().begin(), md->get<2>().end() );
+    }
+
+    return w.append( get_shape( input, type ), "shape" ) &&
+           w.append( nodata, "nodata" ) && w.append( georef, "georef" ) &&
+           w.append( projection, "projection" ) &&
+           w.append( fingerprint, "source" );
+  }
+
+  std::string raster_cache::get_temporary( const std::string& sidecar )
+  {
+    boost::system::error_code e;
+    boost::filesystem::path p( sidecar );
+
+    boost::filesystem::create_directories( p.parent_path(), e );
+
+    std::string name( sidecar + ".XXXXXX" );
+    std::vector<char> buffer( name.begin(), name.end() );
+    buffer.push_back( '\0' );
+
+    int fd( mkstemp( &buffer[0] ) );
+
+    if( fd == -1 ) {
+
+      std::cerr << "Unable to write raster cache " << sidecar << std::endl;
+      return std::string();
+    }
+
+    // shared by every user reading the file
+    fchmod( fd, 0644 );
+    close( fd );
+
+    return std::string( &buffer[0] );
+  }
+
+  bool raster_cache::discard( const std::string& temporary )
+  {
+    std::cerr << "Unable to write raster cache " << temporary << std::endl;
+
+    std::remove( temporary.c_str() );
+
+    return false;
+  }
+
+  bool raster_cache::publish( const std::string& temporary,
+                              const std::string& sidecar )
+  {
+    if( std::rename( temporary.c_str(), sidecar.c_str() ) != 0 ) {
+
+      return discard( temporary );
+    }
+
+    return true;
+  }
+
+}
@@ -0,0 +1,165 @@
+#ifndef CANVAS_RASTER_CACHE_HPP
+#define CANVAS_RASTER_CACHE_HPP
+
+#include <canvas/image.hpp>
+
+#include <utility/columnar.hpp>
+#include <utility/mapped_memory.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // Raw copies of the bands of files, kept as columnar sidecars in a local
+  // directory so that loading a file again maps its bands instead of
+  // decoding it. A sidecar holds the type, size, nodata values and
+  // georeference of the image, a fingerprint of the file it was written
+  // from, and every band line by line, each starting on a page boundary.
+  //
+  // The cache is off until a directory is set, or named by the environment
+  // variable CANVAS_RASTER_CACHE. Bands mapped from it are private copies:
+  // their pages are shared with every process mapping the same sidecar
+  // until they are written to, and changes never reach the sidecar.
+  class raster_cache {
+
+  public:
+    // bytes of each end of a file hashed into its fingerprint
+    static const size_t FINGERPRINT_BYTES = 65536;
+
+    // columns of a sidecar before the bands
+    static const size_t HEADER_COLUMNS = 5;
+
+    // empty disables the cache
+    static void set_directory( const std::string& directory );
+
+    static std::string get_directory();
+
+    // the sidecar of filename, empty when the cache is disabled
+    static std::string get_sidecar( const std::string& filename );
+
+    // bands of image, loaded from filename, mapped from its sidecar; false,
+    // leaving bands as they are, if the sidecar is missing or stale
+    template <typename num_type>
+    static bool map(
+      const std::string& filename, const image& input,
+      std::vector<boost::shared_ptr<utility::mapped_memory<num_type> > >&
+        bands )
+    {
+      std::string sidecar( get_sidecar( filename ) );
+
+      if( sidecar.empty() ) {
+
+        return false;
+      }
+
+      utility::columnar::reader r( sidecar );
+
+      if( !r || !check( r, filename, input,
+                        utility::columnar::type_of<num_type>::code ) ) {
+
+        return false;
+      }
+
+      std::vector<boost::shared_ptr<utility::mapped_memory<num_type> > >
+        mapped;
+
+      for( size_t k = 0; k < bands.size(); ++k ) {
+
+        size_t n( HEADER_COLUMNS + k );
+
+        mapped.push_back( boost::shared_ptr<utility::mapped_memory<num_type> >(
+          new utility::mapped_memory<num_type>( sidecar, r.get_offset( n ),
+                                                r.get_count( n ), true, true )
+        ) );
+
+        if( !*mapped.back() ) {
+
+          return false;
+        }
+      }
+
+      bands.swap( mapped );
+
+      return true;
+    }
+
+    // writes the sidecar of filename from the loaded bands of input,
+    // replacing it at once so that readers never see part of it
+    template <typename num_type>
+    static bool write(
+      const std::string& filename, const image& input,
+      const std::vector<boost::shared_ptr<utility::mapped_memory<num_type> > >&
+        bands )
+    {
+      std::string sidecar( get_sidecar( filename ) );
+
+      if( sidecar.empty() ) {
+
+        return false;
+      }
+
+      std::string temporary( get_temporary( sidecar ) );
+
+      if( temporary.empty() ) {
+
+        return false;
+      }
+
+      {
+        utility::columnar::writer w( temporary,
+                                     HEADER_COLUMNS + bands.size() );
+
+        int type( utility::columnar::type_of<num_type>::code );
+
+        if( !w || !write_header( w, filename, input, type ) ) {
+
+          return discard( temporary );
+        }
+
+        for( size_t k = 0; k < bands.size(); ++k ) {
+
+          if( !w.append( *bands[k], "band" ) ) {
+
+            return discard( temporary );
+          }
+        }
+
+        if( !w.close() ) {
+
+          return discard( temporary );
+        }
+      }
+
+      return publish( temporary, sidecar );
+    }
+
+  private:
+    // true if the header of r describes input, of values of the given
+    // columnar type, loaded from filename as it is now
+    static bool check( const utility::columnar::reader& r,
+                       const std::string& filename, const image& input,
+                       int type );
+
+    static bool write_header( utility::columnar::writer& w,
+                              const std::string& filename,
+                              const image& input, int type );
+
+    // a new file next to sidecar, empty if its directory cannot be made
+    static std::string get_temporary( const std::string& sidecar );
+
+    // removes temporary, false
+    static bool discard( const std::string& temporary );
+
+    // renames temporary to sidecar
+    static bool publish( const std::string& temporary,
+                         const std::string& sidecar );
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,523 @@
+#include <canvas/stretch.hpp>
+
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace canvas {
+
+  namespace {
+
+    // shared by the threads of a pass over the blocks of lines of a band
+    struct block_job {
+
+      const image* input;
+
+      const image16* input16;
+
+      size_t band_number;
+
+      size_t lines;
+
+      size_t columns;
+
+      size_t block_lines;
+
+      float nodata;
+
+      bool ok;
+
+      boost::mutex mutex;
+
+      // valid values of image16 bands
+      image16::histogram* counts16;
+
+      // range of the valid values of float bands
+      bool any;
+
+      float minimum;
+
+      float maximum;
+
+      // their histogram, bins of width 1 / inverse from origin
+      std::vector<boost::uint64_t> bins;
+
+      double origin;
+
+      double inverse;
+
+      // conversion, through lut for image16 bands
+      const boost::uint8_t* lut;
+
+      float scale;
+
+      float offset;
+
+      boost::uint8_t* output;
+
+    };
+
+    typedef void ( *block_function )( block_job*, size_t, size_t );
+
+    void fail( block_job* j )
+    {
+      boost::lock_guard<boost::mutex> lock( j->mutex );
+      j->ok = false;
+    }
+
+    void count_values16( block_job* j, size_t first, size_t last )
+    {
+      std::vector<boost::uint16_t> values( j->block_lines * j->columns );
+      image16::histogram counts;
+
+      for( size_t b = first; b < last; ++b ) {
+
+        size_t l1( b * j->block_lines );
+        size_t l2( std::min( l1 + j->block_lines, j->lines ) );
+
+        if( !j->input16->read_window( j->band_number, l1, 0, l2,
+                                      j->columns, &values[0] ) ) {
+
+          fail( j );
+          return;
+        }
+
+        counts.add( &values[0], &values[0] + ( l2 - l1 ) * j->columns );
+      }
+
+      boost::lock_guard<boost::mutex> lock( j->mutex );
+      j->counts16->merge( counts );
+    }
+
+    void find_range( block_job* j, size_t first, size_t last )
+    {
+      std::vector<float> values( j->block_lines * j->columns );
+      bool any( false );
+      float minimum( 0.0f ), maximum( 0.0f );
+
+      for( size_t b = first; b < last; ++b ) {
+
+        size_t l1( b * j->block_lines );
+        size_t l2( std::min( l1 + j->block_lines, j->lines ) );
+
+        if( !j->input->read_window( j->band_number, l1, 0, l2, j->columns,
+                                    &values[0] ) ) {
+
+          fail( j );
+          return;
+        }
+
+        for( size_t i = 0; i < ( l2 - l1 ) * j->columns; ++i ) {
+
+          float v( values[i] );
+
+          if( ( v != v ) || ( v == j->nodata ) ) {
+
+            continue;
+          }
+
+          minimum = any ? std::min( minimum, v ) : v;
+          maximum = any ? std::max( maximum, v ) : v;
+          any = true;
+        }
+      }
+
+      boost::lock_guard<boost::mutex> lock( j->mutex );
+
+      if( any ) {
+
+        j->minimum = j->any ? std::min( j->minimum, minimum ) : minimum;
+        j->maximum = j->any ? std::max( j->maximum, maximum ) : maximum;
+        j->any = true;
+      }
+    }
+
+    void count_bins( block_job* j, size_t first, size_t last )
+    {
+      std::vector<float> values( j->block_lines * j->columns );
+      std::vector<boost::uint64_t> bins( j->bins.size(), 0 );
+      size_t top( bins.size() - 1 );
+
+      for( size_t b = first; b < last; ++b ) {
+
+        size_t l1( b * j->block_lines );
+        size_t l2( std::min( l1 + j->block_lines, j->lines ) );
+
+        if( !j->input->read_window( j->band_number, l1, 0, l2, j->columns,
+                                    &values[0] ) ) {
+
+          fail( j );
+          return;
+        }
+
+        for( size_t i = 0; i < ( l2 - l1 ) * j->columns; ++i ) {
+
+          float v( values[i] );
+
+          if( ( v != v ) || ( v == j->nodata ) ) {
+
+            continue;
+          }
+
+          double bin( ( v - j->origin ) * j->inverse );
+
+          ++bins[std::min( static_cast<size_t>( std::max( bin, 0.0 ) ),
+                           top )];
+        }
+      }
+
+      boost::lock_guard<boost::mutex> lock( j->mutex );
+
+      for( size_t k = 0; k <= top; ++k ) {
+
+        j->bins[k] += bins[k];
+      }
+    }
+
+    void convert16( block_job* j, size_t first, size_t last )
+    {
+      std::vector<boost::uint16_t> values( j->block_lines * j->columns );
+
+      for( size_t b = first; b < last; ++b ) {
+
+        size_t l1( b * j->block_lines );
+        size_t l2( std::min( l1 + j->block_lines, j->lines ) );
+
+        if( !j->input16->read_window( j->band_number, l1, 0, l2,
+                                      j->columns, &values[0] ) ) {
+
+          fail( j );
+          return;
+        }
+
+        const boost::uint16_t* in( &values[0] );
+        boost::uint8_t* out( j->output + l1 * j->columns );
+        const boost::uint8_t* lut( j->lut );
+        size_t n( ( l2 - l1 ) * j->columns );
+
+        for( size_t i = 0; i < n; ++i ) {
+
+          out[i] = lut[in[i]];
+        }
+      }
+    }
+
+    void convert( block_job* j, size_t first, size_t last )
+    {
+      std::vector<float> values( j->block_lines * j->columns );
+
+      for( size_t b = first; b < last; ++b ) {
+
+        size_t l1( b * j->block_lines );
+        size_t l2( std::min( l1 + j->block_lines, j->lines ) );
+
+        if( !j->input->read_window( j->band_number, l1, 0, l2, j->columns,
+                                    &values[0] ) ) {
+
+          fail( j );
+          return;
+        }
+
+        const float* in( &values[0] );
+        boost::uint8_t* out( j->output + l1 * j->columns );
+        float scale( j->scale ), offset( j->offset ), nodata( j->nodata );
+        size_t n( ( l2 - l1 ) * j->columns );
+
+        // without branches, for the compiler to vectorise
+        for( size_t i = 0; i < n; ++i ) {
+
+          float v( in[i] );
+          bool valid( ( v == v ) && ( v != nodata ) );
+
+          float x( valid ? v * scale + offset : 0.0f );
+          x = ( x < 1.0f ) ? 1.0f : x;
+          x = ( x > 255.0f ) ? 255.0f : x;
+
+          out[i] = valid ? static_cast<boost::uint8_t>( x + 0.5f ) : 0;
+        }
+      }
+    }
+
+    // f over the blocks of lines of a band, from threads threads at once
+    bool run_blocks( block_job& j, const image& input, size_t band_number,
+                     size_t threads, block_function f )
+    {
+      j.input = &input;
+      j.band_number = band_number;
+      j.lines = input.get_lines();
+      j.columns = input.get_columns();
+      j.block_lines = std::max( stretch::BLOCK_PIXELS /
+                                  std::max( j.columns,
+                                            static_cast<size_t>( 1 ) ),
+                                static_cast<size_t>( 1 ) );
+      j.nodata = static_cast<float>( input.get_nodata( band_number ) );
+      j.ok = true;
+
+      if( !j.lines || !j.columns ) {
+
+        return true;
+      }
+
+      size_t blocks( ( j.lines + j.block_lines - 1 ) / j.block_lines );
+
+      utility::thread_pool::global().parallel_for( 0, blocks, 1,
+        boost::bind( f, &j, _1, _2 ),
+        utility::thread_pool::get_threads( threads, blocks ) );
+
+      return j.ok;
+    }
+
+    // scale and offset taking [low, high] to [1, 255]
+    void get_map( double low, double high, float& scale, float& offset )
+    {
+      double s( ( high > low ) ? 254.0 / ( high - low ) : 0.0 );
+
+      scale = static_cast<float>( s );
+      offset = static_cast<float>( 1.0 - low * s );
+    }
+
+    image8::ptr create_result( const image& input )
+    {
+      image8::ptr result( new image8( input.get_lines(),
+                                      input.get_columns(),
+                                      input.get_channels() ) );
+      result->allocate();
+      result->set_metadata( input.get_metadata() );
+
+      for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+        result->set_nodata( k, 0.0 );
+      }
+
+      return result;
+    }
+
+  }
+
+  stretch::stretch( const std::vector<double>& low,
+                    const std::vector<double>& high )
+    : low_( low ), high_( high ), valid_( true )
+  {
+    BOOST_ASSERT( low_.size() == high_.size() );
+  }
+
+  stretch::stretch()
+    : valid_( false )
+  {
+  }
+
+  stretch stretch::from_percentiles( const image16& input, double low,
+                                     double high, size_t threads )
+  {
+    utility::profiler::scope profile( "stretch::from_percentiles" );
+
+    BOOST_ASSERT( ( 0.0 <= low ) && ( low <= high ) && ( high <= 1.0 ) );
+
+    std::vector<double> lows, highs;
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      image16::histogram counts;
+
+      block_job j;
+      j.input16 = &input;
+      j.counts16 = &counts;
+
+      if( !run_blocks( j, input, k, threads, &count_values16 ) ) {
+
+        std::cerr << "Unable to read band " << k << std::endl;
+        return stretch();
+      }
+
+      counts.discard( input.get_nodata( k ) );
+
+      if( !counts.get_total() ) {
+
+        std::cerr << "No valid values in band " << k << std::endl;
+        return stretch();
+      }
+
+      lows.push_back( counts.percentile( low ) );
+      highs.push_back( counts.percentile( high ) );
+    }
+
+    return stretch( lows, highs );
+  }
+
+  stretch stretch::from_percentiles( const image& input, double low,
+                                     double high, size_t threads )
+  {
+    utility::profiler::scope profile( "stretch::from_percentiles" );
+
+    BOOST_ASSERT( ( 0.0 <= low ) && ( low <= high ) && ( high <= 1.0 ) );
+
+    std::vector<double> lows, highs;
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      block_job j;
+      j.any = false;
+      j.minimum = j.maximum = 0.0f;
+
+      if( !run_blocks( j, input, k, threads, &find_range ) ) {
+
+        std::cerr << "Unable to read band " << k << std::endl;
+        return stretch();
+      }
+
+      if( !j.any ) {
+
+        std::cerr << "No valid values in band " << k << std::endl;
+        return stretch();
+      }
+
+      double width( ( static_cast<double>( j.maximum ) - j.minimum ) / BINS );
+
+      j.bins.assign( BINS, 0 );
+      j.origin = j.minimum;
+      j.inverse = ( width > 0.0 ) ? 1.0 / width : 0.0;
+
+      if( !run_blocks( j, input, k, threads, &count_bins ) ) {
+
+        std::cerr << "Unable to read band " << k << std::endl;
+        return stretch();
+      }
+
+      boost::uint64_t total( 0 );
+
+      for( size_t b = 0; b < BINS; ++b ) {
+
+        total += j.bins[b];
+      }
+
+      // the lower edge of the low bin and the upper edge of the high one
+      double l_target( low * total ), h_target( high * total );
+      boost::uint64_t cumulative( 0 );
+      size_t l_bin( BINS ), h_bin( BINS );
+
+      for( size_t b = 0; ( b < BINS ) && ( h_bin == BINS ); ++b ) {
+
+        cumulative += j.bins[b];
+
+        if( cumulative && ( cumulative >= l_target ) && ( l_bin == BINS ) ) {
+
+          l_bin = b;
+        }
+
+        if( cumulative && ( cumulative >= h_target ) ) {
+
+          h_bin = b;
+        }
+      }
+
+      lows.push_back( j.minimum + l_bin * width );
+      highs.push_back( std::min( j.minimum + ( h_bin + 1 ) * width,
+                                 static_cast<double>( j.maximum ) ) );
+    }
+
+    return stretch( lows, highs );
+  }
+
+  bool stretch::is_valid() const
+  {
+    return valid_;
+  }
+
+  const std::vector<double>& stretch::get_low() const
+  {
+    return low_;
+  }
+
+  const std::vector<double>& stretch::get_high() const
+  {
+    return high_;
+  }
+
+  image8::ptr stretch::apply( const image16& input, size_t threads ) const
+  {
+    utility::profiler::scope profile( "stretch::apply" );
+
+    if( !valid_ ) {
+
+      std::cerr << "Invalid stretch" << std::endl;
+      return image8::ptr();
+    }
+
+    BOOST_ASSERT( low_.size() == input.get_channels() );
+
+    image8::ptr result( create_result( input ) );
+
+    std::vector<boost::uint8_t> lut( image16::histogram::BINS );
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      float scale, offset;
+      get_map( low_[k - 1], high_[k - 1], scale, offset );
+
+      for( size_t v = 0; v < lut.size(); ++v ) {
+
+        float x( std::min( std::max( v * scale + offset, 1.0f ), 255.0f ) );
+        lut[v] = static_cast<boost::uint8_t>( x + 0.5f );
+      }
+
+      double nodata( input.get_nodata( k ) );
+
+      if( ( nodata >= 0.0 ) && ( nodata < lut.size() ) &&
+          ( std::floor( nodata ) == nodata ) ) {
+
+        lut[static_cast<size_t>( nodata )] = 0;
+      }
+
+      block_job j;
+      j.input16 = &input;
+      j.lut = &lut[0];
+      j.output = result->get_band( k )->get();
+
+      if( !run_blocks( j, input, k, threads, &convert16 ) ) {
+
+        std::cerr << "Unable to read band " << k << std::endl;
+        return image8::ptr();
+      }
+    }
+
+    return result;
+  }
+
+  image8::ptr stretch::apply( const image& input, size_t threads ) const
+  {
+    utility::profiler::scope profile( "stretch::apply" );
+
+    if( !valid_ ) {
+
+      std::cerr << "Invalid stretch" << std::endl;
+      return image8::ptr();
+    }
+
+    BOOST_ASSERT( low_.size() == input.get_channels() );
+
+    image8::ptr result( create_result( input ) );
+
+    for( size_t k = 1; k <= input.get_channels(); ++k ) {
+
+      block_job j;
+      get_map( low_[k - 1], high_[k - 1], j.scale, j.offset );
+      j.output = result->get_band( k )->get();
+
+      if( !run_blocks( j, input, k, threads, &convert ) ) {
+
+        std::cerr << "Unable to read band " << k << std::endl;
+        return image8::ptr();
+      }
+    }
+
+    return result;
+  }
+
+}
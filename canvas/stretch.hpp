@@ -0,0 +1,72 @@
+#ifndef CANVAS_STRETCH_HPP
+#define CANVAS_STRETCH_HPP
+
+#include <canvas/image.hpp>
+#include <canvas/image8.hpp>
+#include <canvas/image16.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+
+namespace canvas {
+
+  // Linear contrast stretch of every band of an image to 8 bits for
+  // display: low and higher values of a band map to 1 and 255, and nodata
+  // or NaN pixels to 0, the nodata value of the result.
+  //
+  // The image is converted in one pass over blocks of lines by several
+  // threads, without holding more than the blocks being converted besides
+  // the result. image16 bands go through a lookup table of every value;
+  // other images through an affine map and clamp written for the compiler
+  // to vectorise.
+  class stretch {
+
+  public:
+    // pixels converted together, per thread
+    static const size_t BLOCK_PIXELS = 1048576;
+
+    // bins of the histograms of float bands
+    static const size_t BINS = 65536;
+
+    // low and high values of every band
+    stretch( const std::vector<double>& low,
+             const std::vector<double>& high );
+
+    // from the given fractions of the valid values of every band, exact
+    // for image16 and to a bin of the range of each band otherwise;
+    // invalid if a band cannot be read or has no valid values
+    static stretch from_percentiles( const image16& input,
+                                     double low = 0.02, double high = 0.98,
+                                     size_t threads = 0 );
+
+    static stretch from_percentiles( const image& input,
+                                     double low = 0.02, double high = 0.98,
+                                     size_t threads = 0 );
+
+    bool is_valid() const;
+
+    const std::vector<double>& get_low() const;
+
+    const std::vector<double>& get_high() const;
+
+    // empty if the stretch is invalid or a block cannot be read
+    image8::ptr apply( const image16& input, size_t threads = 0 ) const;
+
+    image8::ptr apply( const image& input, size_t threads = 0 ) const;
+
+  private:
+    // invalid
+    stretch();
+
+    std::vector<double> low_;
+
+    std::vector<double> high_;
+
+    bool valid_;
+
+  };
+
+}
+
+#endif
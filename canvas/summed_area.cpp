@@ -0,0 +1,438 @@
+#include <canvas/summed_area.hpp>
+
+#include <utility/columnar.hpp>
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace canvas {
+
+  namespace {
+
+    // lines read to estimate the shift
+    const size_t SHIFT_SAMPLE_LINES = 16;
+
+    const char* COLUMN_NAMES[] = { "shape", "shift", "sum", "sum2", "count" };
+
+  }
+
+  // shared by the threads building the tables
+  struct summed_area::job {
+
+    const image* input;
+
+    size_t band_number;
+
+    float nodata;
+
+    utility::mapped_memory<double>* sum;
+
+    utility::mapped_memory<double>* sum2;
+
+    utility::mapped_memory<boost::uint64_t>* count;
+
+    size_t block_lines;
+
+    size_t blocks;
+
+    // 1: prefix sums of each block alone, 2: totals of the blocks above
+    // added to each block
+    int pass;
+
+    // the last line of the tables above each block, for the second pass
+    std::vector<std::vector<double> > carry_sum;
+
+    std::vector<std::vector<double> > carry_sum2;
+
+    std::vector<std::vector<boost::uint64_t> > carry_count;
+
+    size_t next;
+
+    bool ok;
+
+    boost::mutex mutex;
+
+  };
+
+  summed_area::summed_area()
+    : lines_( 0 ), columns_( 0 ), shift_( 0.0 )
+  {
+  }
+
+  summed_area::summed_area( const image& input, size_t band_number,
+                            size_t threads )
+    : lines_( input.get_lines() ), columns_( input.get_columns() ),
+      shift_( 0.0 )
+  {
+    utility::profiler::scope profile( "summed_area::summed_area" );
+
+    BOOST_ASSERT( ( band_number >= 1 ) &&
+                  ( band_number <= input.get_channels() ) );
+
+    size_t stride( columns_ + 1 );
+    boost::uint64_t corners( static_cast<boost::uint64_t>( lines_ + 1 )
+                             * stride );
+
+    boost::shared_ptr<utility::mapped_memory<double> > sum(
+      new utility::mapped_memory<double>( corners )
+    );
+    boost::shared_ptr<utility::mapped_memory<double> > sum2(
+      new utility::mapped_memory<double>( corners )
+    );
+    boost::shared_ptr<utility::mapped_memory<boost::uint64_t> > count(
+      new utility::mapped_memory<boost::uint64_t>( corners )
+    );
+
+    // the first line of corners, above the image
+    std::fill_n( sum->get(), stride, 0.0 );
+    std::fill_n( sum2->get(), stride, 0.0 );
+    std::fill_n( count->get(), stride, 0 );
+
+    job j;
+    j.input = &input;
+    j.band_number = band_number;
+    j.nodata = static_cast<float>( input.get_nodata( band_number ) );
+    j.sum = sum.get();
+    j.sum2 = sum2.get();
+    j.count = count.get();
+
+    if( lines_ && columns_ ) {
+
+      // mean of a few lines spread over the band
+      std::vector<float> line( columns_ );
+      double total( 0.0 );
+      boost::uint64_t n( 0 );
+      size_t step( std::max( lines_ / SHIFT_SAMPLE_LINES,
+                             static_cast<size_t>( 1 ) ) );
+
+      for( size_t i = step / 2; i < lines_; i += step ) {
+
+        if( !input.read_window( band_number, i, 0, i + 1, columns_,
+                                &line[0] ) ) {
+
+          std::cerr << "Unable to read band " << band_number << std::endl;
+          return;
+        }
+
+        for( size_t c = 0; c < columns_; ++c ) {
+
+          if( ( line[c] != j.nodata ) && ( line[c] == line[c] ) ) {
+
+            total += line[c];
+            ++n;
+          }
+        }
+      }
+
+      shift_ = n ? total / n : 0.0;
+
+      j.block_lines = std::max( BLOCK_PIXELS / columns_,
+                                static_cast<size_t>( 1 ) );
+      j.blocks = ( lines_ + j.block_lines - 1 ) / j.block_lines;
+      j.ok = true;
+
+      threads = utility::thread_pool::get_threads( threads, j.blocks );
+
+      for( j.pass = 1; j.ok && ( j.pass <= 2 ); ++j.pass ) {
+
+        if( j.pass == 2 ) {
+
+          if( j.blocks == 1 ) {
+
+            break;
+          }
+
+          // running totals of the last lines of the blocks above
+          j.carry_sum.assign( j.blocks, std::vector<double>( stride, 0.0 ) );
+          j.carry_sum2.assign( j.blocks, std::vector<double>( stride, 0.0 ) );
+          j.carry_count.assign( j.blocks,
+                                std::vector<boost::uint64_t>( stride, 0 ) );
+
+          for( size_t b = 1; b < j.blocks; ++b ) {
+
+            size_t last( std::min( b * j.block_lines, lines_ ) * stride );
+
+            for( size_t c = 0; c < stride; ++c ) {
+
+              j.carry_sum[b][c] = j.carry_sum[b - 1][c] + ( *sum )[last + c];
+              j.carry_sum2[b][c] =
+                j.carry_sum2[b - 1][c] + ( *sum2 )[last + c];
+              j.carry_count[b][c] =
+                j.carry_count[b - 1][c] + ( *count )[last + c];
+            }
+          }
+        }
+
+        j.next = 0;
+
+        utility::thread_pool::global().run(
+          boost::bind( &summed_area::run_blocks, this, &j ), threads
+        );
+      }
+
+      if( !j.ok ) {
+
+        std::cerr << "Unable to read band " << band_number << std::endl;
+        return;
+      }
+    }
+
+    sum_ = sum;
+    sum2_ = sum2;
+    count_ = count;
+  }
+
+  void summed_area::run_blocks( summed_area* self, job* j )
+  {
+    size_t columns( self->columns_ );
+    size_t stride( columns + 1 );
+    double shift( self->shift_ );
+
+    std::vector<float> values;
+
+    if( j->pass == 1 ) {
+
+      values.resize( j->block_lines * columns );
+    }
+
+    for( ;; ) {
+
+      size_t b;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( !j->ok || ( j->next >= j->blocks ) ) {
+
+          return;
+        }
+
+        b = j->next++;
+      }
+
+      size_t l1( b * j->block_lines );
+      size_t l2( std::min( l1 + j->block_lines, self->lines_ ) );
+
+      double* s_ptr( j->sum->get() );
+      double* s2_ptr( j->sum2->get() );
+      boost::uint64_t* n_ptr( j->count->get() );
+
+      if( j->pass == 2 ) {
+
+        if( !b ) {
+
+          continue;
+        }
+
+        const double* cs( &j->carry_sum[b][0] );
+        const double* cs2( &j->carry_sum2[b][0] );
+        const boost::uint64_t* cn( &j->carry_count[b][0] );
+
+        for( size_t i = l1 + 1; i <= l2; ++i ) {
+
+          size_t row( i * stride );
+
+          for( size_t c = 0; c < stride; ++c ) {
+
+            s_ptr[row + c] += cs[c];
+            s2_ptr[row + c] += cs2[c];
+            n_ptr[row + c] += cn[c];
+          }
+        }
+
+        continue;
+      }
+
+      if( !j->input->read_window( j->band_number, l1, 0, l2, columns,
+                                  &values[0] ) ) {
+
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+        j->ok = false;
+        return;
+      }
+
+      for( size_t i = l1; i < l2; ++i ) {
+
+        // corners of line i + 1 from those above, which start again from
+        // zero at the top of each block
+        size_t row( ( i + 1 ) * stride );
+        size_t above( i * stride );
+        bool first( i == l1 );
+
+        const float* v_ptr( &values[( i - l1 ) * columns] );
+
+        double s( 0.0 ), s2( 0.0 );
+        boost::uint64_t n( 0 );
+
+        s_ptr[row] = 0.0;
+        s2_ptr[row] = 0.0;
+        n_ptr[row] = 0;
+
+        for( size_t c = 0; c < columns; ++c ) {
+
+          float v( v_ptr[c] );
+
+          if( ( v != j->nodata ) && ( v == v ) ) {
+
+            double d( v - shift );
+
+            s += d;
+            s2 += d * d;
+            ++n;
+          }
+
+          s_ptr[row + c + 1] = s + ( first ? 0.0 : s_ptr[above + c + 1] );
+          s2_ptr[row + c + 1] = s2 + ( first ? 0.0 : s2_ptr[above + c + 1] );
+          n_ptr[row + c + 1] = n + ( first ? 0 : n_ptr[above + c + 1] );
+        }
+      }
+    }
+  }
+
+  summed_area::ptr summed_area::open( const std::string& filename )
+  {
+    utility::profiler::scope profile( "summed_area::open" );
+
+    ptr result;
+
+    utility::columnar::reader r( filename );
+
+    if( !r || ( r.get_columns() != 5 ) ) {
+
+      return result;
+    }
+
+    for( size_t n = 0; n < 5; ++n ) {
+
+      if( r.get_name( n ) != COLUMN_NAMES[n] ) {
+
+        std::cerr << "Not summed-area tables: " << filename << std::endl;
+        return result;
+      }
+    }
+
+    counts shape( r.map<boost::uint64_t>( 0 ) );
+    sums shift( r.map<double>( 1 ) );
+
+    if( !shape || ( shape->size() != 2 ) || !shift ||
+        ( shift->size() != 1 ) ) {
+
+      return result;
+    }
+
+    ptr tables( new summed_area() );
+    tables->lines_ = ( *shape )[0];
+    tables->columns_ = ( *shape )[1];
+    tables->shift_ = ( *shift )[0];
+    tables->sum_ = r.map<double>( 2 );
+    tables->sum2_ = r.map<double>( 3 );
+    tables->count_ = r.map<boost::uint64_t>( 4 );
+
+    boost::uint64_t corners(
+      static_cast<boost::uint64_t>( tables->lines_ + 1 )
+      * ( tables->columns_ + 1 )
+    );
+
+    if( !tables->sum_ || !tables->sum2_ || !tables->count_ ||
+        ( tables->sum_->size() != corners ) ||
+        ( tables->sum2_->size() != corners ) ||
+        ( tables->count_->size() != corners ) ) {
+
+      std::cerr << "Corrupt summed-area tables: " << filename << std::endl;
+      return result;
+    }
+
+    return tables;
+  }
+
+  bool summed_area::is_valid() const
+  {
+    return ( count_.get() != 0 );
+  }
+
+  size_t summed_area::get_lines() const
+  {
+    return lines_;
+  }
+
+  size_t summed_area::get_columns() const
+  {
+    return columns_;
+  }
+
+  summed_area::window_stats summed_area::compute( size_t l1, size_t c1,
+                                                  size_t l2,
+                                                  size_t c2 ) const
+  {
+    BOOST_ASSERT( is_valid() );
+    BOOST_ASSERT( ( l1 <= l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 <= c2 ) && ( c2 <= columns_ ) );
+
+    size_t stride( columns_ + 1 );
+    window_stats result;
+
+    result.count = corners( *count_, stride, l1, c1, l2, c2 );
+
+    if( !result.count ) {
+
+      result.mean = std::numeric_limits<double>::quiet_NaN();
+      return result;
+    }
+
+    double n( static_cast<double>( result.count ) );
+    double s( corners( *sum_, stride, l1, c1, l2, c2 ) );
+    double s2( corners( *sum2_, stride, l1, c1, l2, c2 ) );
+
+    result.sum = s + n * shift_;
+    result.mean = shift_ + s / n;
+    result.variance = ( result.count > 1 )
+      ? std::max( ( s2 - s * s / n ) / ( n - 1.0 ), 0.0 ) : 0.0;
+
+    return result;
+  }
+
+  boost::uint64_t summed_area::count( size_t l1, size_t c1, size_t l2,
+                                      size_t c2 ) const
+  {
+    BOOST_ASSERT( is_valid() );
+    BOOST_ASSERT( ( l1 <= l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 <= c2 ) && ( c2 <= columns_ ) );
+
+    return corners( *count_, columns_ + 1, l1, c1, l2, c2 );
+  }
+
+  bool summed_area::write( const std::string& filename ) const
+  {
+    utility::profiler::scope profile( "summed_area::write" );
+
+    if( !is_valid() ) {
+
+      return false;
+    }
+
+    utility::columnar::writer w( filename, 5 );
+
+    std::vector<boost::uint64_t> shape;
+    shape.push_back( lines_ );
+    shape.push_back( columns_ );
+
+    std::vector<double> shift( 1, shift_ );
+
+    return w
+      && w.append( shape, COLUMN_NAMES[0] )
+      && w.append( shift, COLUMN_NAMES[1] )
+      && w.append( *sum_, COLUMN_NAMES[2] )
+      && w.append( *sum2_, COLUMN_NAMES[3] )
+      && w.append( *count_, COLUMN_NAMES[4] )
+      && w.close();
+  }
+
+}
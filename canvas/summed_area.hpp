@@ -0,0 +1,110 @@
+#ifndef CANVAS_SUMMED_AREA_HPP
+#define CANVAS_SUMMED_AREA_HPP
+
+#include <canvas/image.hpp>
+
+#include <utility/mapped_memory.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+
+namespace canvas {
+
+  // Summed-area tables of a band: the sums, sums of squares and counts of
+  // the valid pixels above and left of every corner, which answer the
+  // statistics of any window in constant time.
+  //
+  // Tables are built by several threads, each taking the prefix sums of a
+  // block of lines, then the totals of the blocks above are added to each
+  // block. Values are summed less a shift near the band mean, estimated
+  // from a sample of lines, so that the differences of large corner sums
+  // keep their precision. Tables live in mapped memory and can be written
+  // to a columnar file and mapped back without reading it.
+  class summed_area : private boost::noncopyable {
+
+  public:
+    typedef boost::shared_ptr<summed_area> ptr;
+
+    typedef boost::shared_ptr<const utility::mapped_memory<double> > sums;
+
+    typedef boost::shared_ptr<
+      const utility::mapped_memory<boost::uint64_t>
+    > counts;
+
+    // pixels summed together, per thread
+    static const size_t BLOCK_PIXELS = 1048576;
+
+    // of the valid pixels of a window
+    struct window_stats {
+
+      window_stats() : count( 0 ), sum( 0.0 ), mean( 0.0 ), variance( 0.0 )
+      {
+      }
+
+      boost::uint64_t count;
+
+      double sum;
+
+      double mean;                      // NaN without valid pixels
+
+      double variance;                  // sample variance
+
+    };
+
+    // pixels neither nodata nor NaN are valid
+    summed_area( const image& input, size_t band_number = 1,
+                 size_t threads = 0 );
+
+    // maps tables written by write(), empty if the file is not one
+    static ptr open( const std::string& filename );
+
+    bool is_valid() const;
+
+    size_t get_lines() const;
+
+    size_t get_columns() const;
+
+    // lines [l1, l2) and columns [c1, c2)
+    window_stats compute( size_t l1, size_t c1, size_t l2, size_t c2 ) const;
+
+    boost::uint64_t count( size_t l1, size_t c1, size_t l2, size_t c2 ) const;
+
+    bool write( const std::string& filename ) const;
+
+  private:
+    struct job;
+
+    summed_area();
+
+    static void run_blocks( summed_area* self, job* j );
+
+    // a corner table value from the four corners of a window
+    template <typename num_type>
+    static num_type corners( const utility::mapped_memory<num_type>& t,
+                             size_t stride, size_t l1, size_t c1,
+                             size_t l2, size_t c2 )
+    {
+      return t[l2 * stride + c2] - t[l1 * stride + c2]
+           - t[l2 * stride + c1] + t[l1 * stride + c1];
+    }
+
+    size_t lines_;
+
+    size_t columns_;
+
+    double shift_;
+
+    sums sum_;
+
+    sums sum2_;
+
+    counts count_;
+
+  };
+
+}
+
+#endif
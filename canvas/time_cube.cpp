@@ -0,0 +1,470 @@
+#include <canvas/time_cube.hpp>
+
+#include <utility/columnar.hpp>
+#include <utility/compat.hpp>
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+namespace canvas {
+
+  namespace {
+
+    const double SECONDS_PER_DAY = 86400.0;
+
+    const char* COLUMN_NAMES[] = { "shape", "epochs", "georef",
+                                   "projection", "values" };
+
+  }
+
+  // shared by the threads of compute()
+  struct time_cube::job {
+
+    size_t t1;
+
+    size_t t2;
+
+    // days from the mean epoch of [t1, t2)
+    const double* days;
+
+    float nodata;
+
+    float* output[5];
+
+    size_t tiles;
+
+    size_t next;
+
+    boost::mutex mutex;
+
+  };
+
+  time_cube::time_cube()
+    : lines_( 0 ), columns_( 0 ), tiles_( 0 ), times_( 0 )
+  {
+  }
+
+  time_cube::time_cube( const std::vector<image::const_ptr>& scenes,
+                        const std::vector<double>& epochs,
+                        size_t band_number, size_t threads )
+    : lines_( 0 ), columns_( 0 ), tiles_( 0 ), times_( 0 )
+  {
+    utility::profiler::scope profile( "time_cube::time_cube" );
+
+    BOOST_ASSERT( scenes.size() == epochs.size() );
+
+    // scenes in time order, ties in the order given
+    std::vector<std::pair<double, size_t> > order;
+
+    for( size_t k = 0; k < scenes.size(); ++k ) {
+
+      order.push_back( std::make_pair( epochs[k], k ) );
+    }
+
+    std::stable_sort( order.begin(), order.end() );
+
+    std::vector<image::const_ptr> sorted;
+
+    for( size_t k = 0; k < order.size(); ++k ) {
+
+      sorted.push_back( scenes[order[k].second] );
+      epochs_.push_back( order[k].first );
+    }
+
+    image_stack stack( sorted );
+
+    if( !stack.is_valid() ) {
+
+      return;
+    }
+
+    BOOST_ASSERT( ( band_number >= 1 ) &&
+                  ( band_number <= stack.get_channels() ) );
+
+    lines_ = stack.get_lines();
+    columns_ = stack.get_columns();
+    tiles_ = ( columns_ + TILE_SIZE - 1 ) / TILE_SIZE;
+    times_ = sorted.size();
+    metadata_ = stack.get_metadata();
+
+    boost::uint64_t count(
+      static_cast<boost::uint64_t>( ( lines_ + TILE_SIZE - 1 ) / TILE_SIZE )
+      * tiles_ * TILE_SIZE * TILE_SIZE * times_
+    );
+
+    boost::shared_ptr<utility::mapped_memory<float> > cube(
+      new utility::mapped_memory<float>( count )
+    );
+
+    // the padding of the last tiles included
+    std::fill_n( cube->get(), count,
+                 std::numeric_limits<float>::quiet_NaN() );
+
+    if( !stack.for_each_block( boost::bind( &time_cube::store_block, this,
+                                            cube->get(), _1 ),
+                               threads, band_number ) ) {
+
+      std::cerr << "Unable to read the scenes of the cube" << std::endl;
+      return;
+    }
+
+    cube_ = cube;
+  }
+
+  bool time_cube::store_block( float* cube,
+                               const image_stack::block& b ) const
+  {
+    size_t columns( b.get_columns() );
+
+    for( size_t p = 0; p < b.size(); ++p ) {
+
+      const float* v( b.get_vector( p ) );
+      float* series( cube + offset( b.get_l1() + p / columns, p % columns ) );
+
+      for( size_t k = 0; k < times_; ++k ) {
+
+        series[k] = b.is_valid( k, v[k] )
+          ? v[k] : std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+
+    return true;
+  }
+
+  time_cube::ptr time_cube::open( const std::string& filename )
+  {
+    utility::profiler::scope profile( "time_cube::open" );
+
+    ptr result;
+
+    utility::columnar::reader r( filename );
+
+    if( !r || ( r.get_columns() != 5 ) ) {
+
+      return result;
+    }
+
+    for( size_t n = 0; n < 5; ++n ) {
+
+      if( r.get_name( n ) != COLUMN_NAMES[n] ) {
+
+        std::cerr << "Not a time cube: " << filename << std::endl;
+        return result;
+      }
+    }
+
+    boost::shared_ptr<const utility::mapped_memory<boost::uint64_t> > shape(
+      r.map<boost::uint64_t>( 0 )
+    );
+    boost::shared_ptr<const utility::mapped_memory<double> > epochs(
+      r.map<double>( 1 )
+    );
+    boost::shared_ptr<const utility::mapped_memory<double> > georef(
+      r.map<double>( 2 )
+    );
+    boost::shared_ptr<const utility::mapped_memory<boost::uint8_t> >
+      projection( r.map<boost::uint8_t>( 3 ) );
+
+    if( !shape || ( shape->size() != 4 ) || !epochs || !georef ||
+        ( georef->size() != 5 ) || !projection ||
+        ( ( *shape )[3] != TILE_SIZE ) ||
+        ( epochs->size() != ( *shape )[2] ) ) {
+
+      std::cerr << "Corrupt time cube: " << filename << std::endl;
+      return result;
+    }
+
+    ptr cube( new time_cube() );
+    cube->lines_ = ( *shape )[0];
+    cube->columns_ = ( *shape )[1];
+    cube->times_ = ( *shape )[2];
+    cube->tiles_ = ( cube->columns_ + TILE_SIZE - 1 ) / TILE_SIZE;
+    cube->epochs_.assign( epochs->get(), epochs->get() + epochs->size() );
+    cube->metadata_.reset( new image::metadata(
+      ( *georef )[0],
+      CGAL::Bbox_2( ( *georef )[1], ( *georef )[2], ( *georef )[3],
+                    ( *georef )[4] ),
+      std::string( projection->get(),
+                   projection->get() + projection->size() )
+    ) );
+    cube->cube_ = r.map<float>( 4 );
+
+    boost::uint64_t count(
+      static_cast<boost::uint64_t>(
+        ( cube->lines_ + TILE_SIZE - 1 ) / TILE_SIZE
+      ) * cube->tiles_ * TILE_SIZE * TILE_SIZE * cube->times_
+    );
+
+    if( !cube->cube_ || ( cube->cube_->size() != count ) ) {
+
+      std::cerr << "Corrupt time cube: " << filename << std::endl;
+      return result;
+    }
+
+    return cube;
+  }
+
+  bool time_cube::parse_dates( const std::vector<std::string>& dates,
+                               std::vector<double>& epochs )
+  {
+    epochs.resize( dates.size() );
+
+    for( size_t k = 0; k < dates.size(); ++k ) {
+
+      const char* first( dates[k].c_str() );
+
+      if( !utility::parse_timestamp( first, first + dates[k].size(),
+                                     epochs[k] ) ) {
+
+        std::cerr << "Invalid date: " << dates[k] << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool time_cube::is_valid() const
+  {
+    return ( cube_.get() != 0 );
+  }
+
+  size_t time_cube::get_lines() const
+  {
+    return lines_;
+  }
+
+  size_t time_cube::get_columns() const
+  {
+    return columns_;
+  }
+
+  size_t time_cube::get_times() const
+  {
+    return times_;
+  }
+
+  const std::vector<double>& time_cube::get_epochs() const
+  {
+    return epochs_;
+  }
+
+  size_t time_cube::find( double epoch ) const
+  {
+    return std::lower_bound( epochs_.begin(), epochs_.end(), epoch )
+      - epochs_.begin();
+  }
+
+  boost::shared_ptr<image::metadata> time_cube::get_metadata() const
+  {
+    return metadata_;
+  }
+
+  void time_cube::get_window( size_t l1, size_t c1, size_t l2, size_t c2,
+                              size_t t1, size_t t2,
+                              std::vector<float>& result ) const
+  {
+    BOOST_ASSERT( is_valid() );
+    BOOST_ASSERT( ( l1 <= l2 ) && ( l2 <= lines_ ) );
+    BOOST_ASSERT( ( c1 <= c2 ) && ( c2 <= columns_ ) );
+    BOOST_ASSERT( ( t1 <= t2 ) && ( t2 <= times_ ) );
+
+    result.resize( ( l2 - l1 ) * ( c2 - c1 ) * ( t2 - t1 ) );
+
+    float* out( result.empty() ? 0 : &result[0] );
+
+    for( size_t i = l1; i < l2; ++i ) {
+
+      for( size_t j = c1; j < c2; ++j ) {
+
+        const float* series( get_series( i, j ) );
+        out = std::copy( series + t1, series + t2, out );
+      }
+    }
+  }
+
+  image32::ptr time_cube::compute( size_t t1, size_t t2, double nodata,
+                                   size_t threads ) const
+  {
+    utility::profiler::scope profile( "time_cube::compute" );
+
+    image32::ptr result;
+
+    if( !is_valid() ) {
+
+      return result;
+    }
+
+    BOOST_ASSERT( ( t1 <= t2 ) && ( t2 <= times_ ) );
+
+    result.reset( new image32( lines_, columns_, 5 ) );
+    result->allocate();
+    result->set_metadata( metadata_ );
+
+    // times centred on their mean, so that the sums of the slope keep
+    // their precision
+    std::vector<double> days( t2 - t1 + 1 );
+    double mean( 0.0 );
+
+    for( size_t k = t1; k < t2; ++k ) {
+
+      mean += epochs_[k];
+    }
+
+    mean = ( t2 > t1 ) ? mean / ( t2 - t1 ) : 0.0;
+
+    for( size_t k = t1; k < t2; ++k ) {
+
+      days[k - t1] = ( epochs_[k] - mean ) / SECONDS_PER_DAY;
+    }
+
+    job j;
+    j.t1 = t1;
+    j.t2 = t2;
+    j.days = &days[0];
+    j.nodata = static_cast<float>( nodata );
+    j.tiles = ( ( lines_ + TILE_SIZE - 1 ) / TILE_SIZE ) * tiles_;
+    j.next = 0;
+
+    for( size_t k = 0; k < 5; ++k ) {
+
+      result->set_nodata( k + 1, nodata );
+      j.output[k] = result->get_band( k + 1 )->get();
+    }
+
+    utility::thread_pool::global().run(
+      boost::bind( &time_cube::run_tiles, this, &j ),
+      utility::thread_pool::get_threads( threads, j.tiles )
+    );
+
+    return result;
+  }
+
+  image32::ptr time_cube::compute( double nodata, size_t threads ) const
+  {
+    return compute( 0, times_, nodata, threads );
+  }
+
+  void time_cube::run_tiles( const time_cube* self, job* j )
+  {
+    for( ;; ) {
+
+      size_t tile;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( j->next >= j->tiles ) {
+
+          return;
+        }
+
+        tile = j->next++;
+      }
+
+      self->compute_tile( tile, j->t1, j->t2, j->days, j->nodata,
+                          j->output );
+    }
+  }
+
+  void time_cube::compute_tile( size_t tile, size_t t1, size_t t2,
+                                const double* days, float nodata,
+                                float* const* output ) const
+  {
+    size_t l1( ( tile / tiles_ ) * TILE_SIZE );
+    size_t c1( ( tile % tiles_ ) * TILE_SIZE );
+    size_t l2( std::min( l1 + TILE_SIZE, lines_ ) );
+    size_t c2( std::min( c1 + TILE_SIZE, columns_ ) );
+    size_t n( t2 - t1 );
+
+    const float infinity( std::numeric_limits<float>::infinity() );
+
+    for( size_t i = l1; i < l2; ++i ) {
+
+      for( size_t j = c1; j < c2; ++j ) {
+
+        const float* series( get_series( i, j ) + t1 );
+
+        // the invalid values weigh 0, without branches so that the loop
+        // vectorises
+        double count( 0.0 ), sum( 0.0 ), st( 0.0 ), stt( 0.0 ), stv( 0.0 );
+        float minimum( infinity ), maximum( -infinity );
+
+        for( size_t k = 0; k < n; ++k ) {
+
+          float v( series[k] );
+          bool valid( v == v );
+          double w( valid ? 1.0 : 0.0 );
+          double x( valid ? v : 0.0 );
+
+          count += w;
+          sum += x;
+          st += w * days[k];
+          stt += w * days[k] * days[k];
+          stv += x * days[k];
+          minimum = std::min( minimum, valid ? v : infinity );
+          maximum = std::max( maximum, valid ? v : -infinity );
+        }
+
+        size_t p( i * columns_ + j );
+        double d( count * stt - st * st );
+
+        output[Count - 1][p] = count;
+        output[Mean - 1][p] = ( count > 0.0 ) ? sum / count : nodata;
+        output[Minimum - 1][p] = ( count > 0.0 ) ? minimum : nodata;
+        output[Maximum - 1][p] = ( count > 0.0 ) ? maximum : nodata;
+        output[Trend - 1][p] = ( ( count > 1.0 ) && ( d > 0.0 ) )
+          ? ( count * stv - st * sum ) / d : nodata;
+      }
+    }
+  }
+
+  bool time_cube::write( const std::string& filename ) const
+  {
+    utility::profiler::scope profile( "time_cube::write" );
+
+    if( !is_valid() ) {
+
+      return false;
+    }
+
+    utility::columnar::writer w( filename, 5 );
+
+    std::vector<boost::uint64_t> shape;
+    shape.push_back( lines_ );
+    shape.push_back( columns_ );
+    shape.push_back( times_ );
+    shape.push_back( static_cast<boost::uint64_t>( TILE_SIZE ) );
+
+    const CGAL::Bbox_2& bb( metadata_->get<1>() );
+
+    std::vector<double> georef;
+    georef.push_back( metadata_->get<0>() );
+    georef.push_back( bb.xmin() );
+    georef.push_back( bb.ymin() );
+    georef.push_back( bb.xmax() );
+    georef.push_back( bb.ymax() );
+
+    const std::string& tag( metadata_->get<2>() );
+    std::vector<boost::uint8_t> projection( tag.begin(), tag.end() );
+
+    return w
+      && w.append( shape, COLUMN_NAMES[0] )
+      && w.append( epochs_, COLUMN_NAMES[1] )
+      && w.append( georef, COLUMN_NAMES[2] )
+      && w.append( projection, COLUMN_NAMES[3] )
+      && w.append( *cube_, COLUMN_NAMES[4] )
+      && w.close();
+  }
+
+}
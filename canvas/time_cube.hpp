@@ -0,0 +1,135 @@
+#ifndef CANVAS_TIME_CUBE_HPP
+#define CANVAS_TIME_CUBE_HPP
+
+#include <canvas/image32.hpp>
+#include <canvas/image_stack.hpp>
+
+#include <utility/mapped_memory.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+
+namespace canvas {
+
+  // One band of dated scenes on the same grid, restricted to the window
+  // they all cover and ordered by time. Values are kept time-major in
+  // square tiles: the series of a pixel is one contiguous run, and the
+  // series of a tile are stored together, so that temporal queries and
+  // per pixel statistics read memory in order rather than one file per
+  // date. Invalid values are stored as NaN.
+  //
+  // The cube lives in mapped memory and can be written to a columnar file
+  // and mapped back without reading it.
+  class time_cube : private boost::noncopyable {
+
+  public:
+    typedef boost::shared_ptr<time_cube> ptr;
+
+    typedef boost::shared_ptr<const utility::mapped_memory<float> > values;
+
+    // pixels on a side of a tile
+    static const size_t TILE_SIZE = 32;
+
+    // bands of compute()
+    enum statistic { Count=1, Mean=2, Minimum=3, Maximum=4, Trend=5 };
+
+    // epochs in seconds, one per scene; scenes as for image_stack
+    time_cube( const std::vector<image::const_ptr>& scenes,
+               const std::vector<double>& epochs, size_t band_number = 1,
+               size_t threads = 0 );
+
+    // maps a cube written by write(), empty if the file is not one
+    static ptr open( const std::string& filename );
+
+    // epochs of "yyyy-mm-dd hh:mm:ss" timestamps, false at the first one
+    // that does not parse
+    static bool parse_dates( const std::vector<std::string>& dates,
+                             std::vector<double>& epochs );
+
+    bool is_valid() const;
+
+    size_t get_lines() const;
+
+    size_t get_columns() const;
+
+    // scenes in the cube
+    size_t get_times() const;
+
+    // epochs in increasing order
+    const std::vector<double>& get_epochs() const;
+
+    // the first scene at or after epoch, get_times() if none
+    size_t find( double epoch ) const;
+
+    // georeferencing of the cube
+    boost::shared_ptr<image::metadata> get_metadata() const;
+
+    // the get_times() values of pixel (i, j), in time order
+    const float* get_series( size_t i, size_t j ) const
+    {
+      return cube_->get() + offset( i, j );
+    }
+
+    // scenes [t1, t2) of lines [l1, l2) and columns [c1, c2), pixel by
+    // pixel in raster order with the values of each pixel side by side
+    void get_window( size_t l1, size_t c1, size_t l2, size_t c2,
+                     size_t t1, size_t t2, std::vector<float>& result ) const;
+
+    // one band per statistic over scenes [t1, t2): valid observations,
+    // mean, minimum, maximum and the least-squares slope per day; nodata
+    // where there are too few observations
+    image32::ptr compute( size_t t1, size_t t2, double nodata = -9999.0,
+                          size_t threads = 0 ) const;
+
+    image32::ptr compute( double nodata = -9999.0,
+                          size_t threads = 0 ) const;
+
+    bool write( const std::string& filename ) const;
+
+  private:
+    struct job;
+
+    time_cube();
+
+    static void run_tiles( const time_cube* self, job* j );
+
+    // the series of the pixels of a block of the stack, NaN where invalid
+    bool store_block( float* cube, const image_stack::block& b ) const;
+
+    // first value of the series of pixel (i, j)
+    size_t offset( size_t i, size_t j ) const
+    {
+      size_t tile( ( i / TILE_SIZE ) * tiles_ + j / TILE_SIZE );
+
+      return ( tile * TILE_SIZE * TILE_SIZE
+               + ( i % TILE_SIZE ) * TILE_SIZE + j % TILE_SIZE ) * times_;
+    }
+
+    // the statistics of the pixels of a tile into the bands of output
+    void compute_tile( size_t tile, size_t t1, size_t t2,
+                       const double* days, float nodata,
+                       float* const* output ) const;
+
+    size_t lines_;
+
+    size_t columns_;
+
+    // tiles on a line of tiles
+    size_t tiles_;
+
+    size_t times_;
+
+    std::vector<double> epochs_;
+
+    boost::shared_ptr<image::metadata> metadata_;
+
+    values cube_;
+
+  };
+
+}
+
+#endif
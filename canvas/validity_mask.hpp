@@ -0,0 +1,207 @@
+#ifndef CANVAS_VALIDITY_MASK_HPP
+#define CANVAS_VALIDITY_MASK_HPP
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+namespace canvas {
+
+  // One bit per pixel set where it holds data, each line padded to whole
+  // 64 bit words like change_mask, so that kernels can test 64 pixels at a
+  // time and skip windows without any valid pixel.
+  class validity_mask {
+
+  public:
+    typedef boost::shared_ptr<validity_mask> ptr;
+
+    typedef boost::shared_ptr<const validity_mask> const_ptr;
+
+    // all pixels invalid
+    validity_mask( size_t lines, size_t columns )
+      : lines_( lines ), columns_( columns ),
+        words_( ( columns + 63 ) / 64 ), bits_( lines * words_, 0 )
+    {
+    }
+
+    size_t get_lines() const
+    {
+      return lines_;
+    }
+
+    size_t get_columns() const
+    {
+      return columns_;
+    }
+
+    bool get( size_t i, size_t j ) const
+    {
+      return ( bits_[i * words_ + j / 64] >> ( j % 64 ) ) & 1;
+    }
+
+    // words of line i, bit j % 64 of word j / 64 for column j
+    const boost::uint64_t* get_line( size_t i ) const
+    {
+      return &bits_[i * words_];
+    }
+
+    size_t get_words_per_line() const
+    {
+      return words_;
+    }
+
+    // line i from its values, valid where they differ from nodata; the
+    // comparisons of a word are packed without branches so that they
+    // vectorise
+    template <typename num_type>
+    void set_line( size_t i, const num_type* values, num_type nodata )
+    {
+      boost::uint64_t* line_ptr( &bits_[i * words_] );
+      size_t full( columns_ / 64 );
+
+      for( size_t w = 0; w < full; ++w, values += 64 ) {
+
+        boost::uint64_t word( 0 );
+
+        for( size_t b = 0; b < 64; ++b ) {
+
+          word |= static_cast<boost::uint64_t>( values[b] != nodata ) << b;
+        }
+
+        line_ptr[w] = word;
+      }
+
+      if( full < words_ ) {
+
+        boost::uint64_t word( 0 );
+
+        for( size_t b = 0; b < columns_ % 64; ++b ) {
+
+          word |= static_cast<boost::uint64_t>( values[b] != nodata ) << b;
+        }
+
+        line_ptr[full] = word;
+      }
+    }
+
+    // line i from a GDAL mask band, valid where it is not 0
+    void set_line( size_t i, const boost::uint8_t* mask )
+    {
+      set_line( i, mask, static_cast<boost::uint8_t>( 0 ) );
+    }
+
+    // valid in both masks
+    void intersect( const validity_mask& other )
+    {
+      for( size_t k = 0; k < bits_.size(); ++k ) {
+
+        bits_[k] &= other.bits_[k];
+      }
+    }
+
+    // valid pixels
+    boost::uint64_t count() const
+    {
+      boost::uint64_t n( 0 );
+
+      for( size_t k = 0; k < bits_.size(); ++k ) {
+
+        n += __builtin_popcountll( bits_[k] );
+      }
+
+      return n;
+    }
+
+    // valid pixels of lines [l1, l2) and columns [c1, c2)
+    boost::uint64_t count( size_t l1, size_t c1, size_t l2, size_t c2 ) const
+    {
+      boost::uint64_t n( 0 );
+
+      if( ( l1 >= l2 ) || ( c1 >= c2 ) ) {
+
+        return n;
+      }
+
+      size_t first( c1 / 64 );
+      size_t last( ( c2 - 1 ) / 64 );
+
+      for( size_t i = l1; i < l2; ++i ) {
+
+        const boost::uint64_t* line_ptr( &bits_[i * words_] );
+
+        for( size_t w = first; w <= last; ++w ) {
+
+          n += __builtin_popcountll( line_ptr[w] & word_mask( w, c1, c2 ) );
+        }
+      }
+
+      return n;
+    }
+
+    // whether any pixel of the window is valid
+    bool any( size_t l1, size_t c1, size_t l2, size_t c2 ) const
+    {
+      if( ( l1 >= l2 ) || ( c1 >= c2 ) ) {
+
+        return false;
+      }
+
+      size_t first( c1 / 64 );
+      size_t last( ( c2 - 1 ) / 64 );
+
+      for( size_t i = l1; i < l2; ++i ) {
+
+        const boost::uint64_t* line_ptr( &bits_[i * words_] );
+
+        for( size_t w = first; w <= last; ++w ) {
+
+          if( line_ptr[w] & word_mask( w, c1, c2 ) ) {
+
+            return true;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    // whether every pixel of the window is valid
+    bool all( size_t l1, size_t c1, size_t l2, size_t c2 ) const
+    {
+      return count( l1, c1, l2, c2 ) ==
+        static_cast<boost::uint64_t>( l2 - l1 ) * ( c2 - c1 );
+    }
+
+  private:
+    // bits of word w inside columns [c1, c2)
+    static boost::uint64_t word_mask( size_t w, size_t c1, size_t c2 )
+    {
+      boost::uint64_t m( ~static_cast<boost::uint64_t>( 0 ) );
+
+      if( w == c1 / 64 ) {
+
+        m &= m << ( c1 % 64 );
+      }
+
+      if( ( w == ( c2 - 1 ) / 64 ) && ( c2 % 64 ) ) {
+
+        m &= ~static_cast<boost::uint64_t>( 0 ) >> ( 64 - c2 % 64 );
+      }
+
+      return m;
+    }
+
+    size_t lines_;
+
+    size_t columns_;
+
+    size_t words_;
+
+    std::vector<boost::uint64_t> bits_;
+
+  };
+
+}
+
+#endif
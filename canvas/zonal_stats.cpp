@@ -0,0 +1,492 @@
+#include <canvas/zonal_stats.hpp>
+
+#include <utility/profiler.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace canvas {
+
+  namespace {
+
+    // polygon edge in pixel coordinates, lines going down
+    struct edge {
+
+      double top;
+
+      double bottom;
+
+      double column;                    // at the top
+
+      double slope;                     // columns per line
+
+    };
+
+    bool by_top( const edge& a, const edge& b )
+    {
+      return a.top < b.top;
+    }
+
+    // first line (or column) with its centre at or after position, within
+    // [0, size]
+    size_t first_centre( double position, size_t size )
+    {
+      double c( std::ceil( position - 0.5 ) );
+
+      if( c <= 0.0 ) {
+
+        return 0;
+      }
+
+      return std::min( static_cast<size_t>( c ), size );
+    }
+
+    void add_ring( const image& input,
+                   const zonal_stats::polygon& ring,
+                   std::vector<edge>& edges )
+    {
+      size_t n( ring.size() );
+
+      for( size_t k = 0; k < n; ++k ) {
+
+        image::pixel a( input.compute_position( ring.vertex( k ) ) );
+        image::pixel b(
+          input.compute_position( ring.vertex( ( k + 1 ) % n ) )
+        );
+
+        double ca( a.get<0>() ), la( a.get<1>() );
+        double cb( b.get<0>() ), lb( b.get<1>() );
+
+        // horizontal edges cross no line centre of their own
+        if( la == lb ) {
+
+          continue;
+        }
+
+        edge e;
+        e.slope = ( cb - ca ) / ( lb - la );
+
+        if( la < lb ) {
+
+          e.top = la;
+          e.bottom = lb;
+          e.column = ca;
+
+        } else {
+
+          e.top = lb;
+          e.bottom = la;
+          e.column = cb;
+        }
+
+        edges.push_back( e );
+      }
+    }
+
+    void add_ring_bounds( const image& input,
+                          const zonal_stats::polygon& ring,
+                          double& l_min, double& c_min,
+                          double& l_max, double& c_max )
+    {
+      for( size_t k = 0; k < ring.size(); ++k ) {
+
+        image::pixel p( input.compute_position( ring.vertex( k ) ) );
+
+        c_min = std::min( c_min, p.get<0>() );
+        c_max = std::max( c_max, p.get<0>() );
+        l_min = std::min( l_min, p.get<1>() );
+        l_max = std::max( l_max, p.get<1>() );
+      }
+    }
+
+    // pixels [c1, c2) of a line
+    struct span {
+
+      size_t line;
+
+      size_t c1;
+
+      size_t c2;
+
+    };
+
+    // even-odd scanline fill over edges sorted by top, visiting lines in
+    // increasing order
+    class scanline {
+
+    public:
+      explicit scanline( const std::vector<edge>& edges )
+        : edges_( edges ), next_( 0 )
+      {
+      }
+
+      void add_spans( size_t line, size_t c1, size_t c2,
+                      std::vector<span>& spans )
+      {
+        double centre( line + 0.5 );
+
+        while( ( next_ < edges_.size() ) &&
+               ( edges_[next_].top <= centre ) ) {
+
+          active_.push_back( next_++ );
+        }
+
+        crossings_.clear();
+        size_t kept( 0 );
+
+        for( size_t k = 0; k < active_.size(); ++k ) {
+
+          const edge& e( edges_[active_[k]] );
+
+          if( e.bottom <= centre ) {
+
+            continue;
+          }
+
+          active_[kept++] = active_[k];
+          crossings_.push_back( e.column + ( centre - e.top ) * e.slope );
+        }
+
+        active_.resize( kept );
+
+        std::sort( crossings_.begin(), crossings_.end() );
+
+        for( size_t k = 0; k + 1 < crossings_.size(); k += 2 ) {
+
+          span s;
+          s.line = line;
+          s.c1 = std::max( first_centre( crossings_[k], c2 ), c1 );
+          s.c2 = std::max( first_centre( crossings_[k + 1], c2 ), c1 );
+
+          if( s.c1 < s.c2 ) {
+
+            spans.push_back( s );
+          }
+        }
+      }
+
+    private:
+      const std::vector<edge>& edges_;
+
+      size_t next_;
+
+      std::vector<size_t> active_;
+
+      std::vector<double> crossings_;
+
+    };
+
+    bool by_first_line( const std::pair<image::window,size_t>& a,
+                        const std::pair<image::window,size_t>& b )
+    {
+      if( a.first.l1 != b.first.l1 ) {
+
+        return a.first.l1 < b.first.l1;
+      }
+
+      return a.first.c1 < b.first.c1;
+    }
+
+  }
+
+  // shared by the threads of zonal_stats
+  struct zonal_stats::job {
+
+    const image* input;
+
+    const std::vector<polygon_with_holes>* polygons;
+
+    // zone indices by first line
+    std::vector<size_t> order;
+
+    size_t next;
+
+    bool ok;
+
+    boost::mutex mutex;
+
+  };
+
+  zonal_stats::zonal_stats( const image& input,
+                            const std::vector<polygon_with_holes>& zones,
+                            const std::vector<double>& percentiles,
+                            size_t threads )
+    : percentiles_( percentiles ), zones_( zones.size() ), valid_( false )
+  {
+    utility::profiler::scope profile( "zonal_stats::zonal_stats" );
+
+    for( size_t k = 0; k < percentiles_.size(); ++k ) {
+
+      BOOST_ASSERT( ( percentiles_[k] >= 0.0 ) &&
+                    ( percentiles_[k] <= 1.0 ) );
+    }
+
+    if( !input.get_metadata() ) {
+
+      std::cerr << "Zonal statistics need a georeferenced image"
+                << std::endl;
+      return;
+    }
+
+    // windows first, to visit the zones in the order of their lines
+    std::vector<std::pair<image::window,size_t> > windows( zones.size() );
+
+    for( size_t z = 0; z < zones.size(); ++z ) {
+
+      double l_min(  std::numeric_limits<double>::max() );
+      double c_min(  std::numeric_limits<double>::max() );
+      double l_max( -std::numeric_limits<double>::max() );
+      double c_max( -std::numeric_limits<double>::max() );
+
+      add_ring_bounds( input, zones[z].outer_boundary(), l_min, c_min,
+                       l_max, c_max );
+
+      image::window& w( zones_[z].bounds );
+      w.l1 = first_centre( l_min, input.get_lines()   );
+      w.c1 = first_centre( c_min, input.get_columns() );
+      w.l2 = std::max( first_centre( l_max, input.get_lines()   ), w.l1 );
+      w.c2 = std::max( first_centre( c_max, input.get_columns() ), w.c1 );
+
+      zones_[z].bands.resize( input.get_channels() );
+
+      windows[z] = std::make_pair( w, z );
+    }
+
+    std::sort( windows.begin(), windows.end(), by_first_line );
+
+    job j;
+    j.input = &input;
+    j.polygons = &zones;
+    j.next = 0;
+    j.ok = true;
+
+    for( size_t z = 0; z < windows.size(); ++z ) {
+
+      j.order.push_back( windows[z].second );
+    }
+
+    if( zones.empty() ) {
+
+      valid_ = true;
+      return;
+    }
+
+    utility::thread_pool::global().run(
+      boost::bind( &zonal_stats::compute_zones, this, &j ),
+      utility::thread_pool::get_threads( threads, zones.size() )
+    );
+
+    if( !j.ok ) {
+
+      std::cerr << "Unable to read the image" << std::endl;
+      return;
+    }
+
+    valid_ = true;
+  }
+
+  void zonal_stats::compute_zones( zonal_stats* self, job* j )
+  {
+    std::vector<float> buffer;
+    std::vector<std::vector<float> > values( j->input->get_channels() );
+
+    for( ;; ) {
+
+      size_t z;
+
+      {
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+
+        if( !j->ok || ( j->next >= j->order.size() ) ) {
+
+          return;
+        }
+
+        z = j->order[j->next++];
+      }
+
+      if( !self->compute_zone( *j, z, buffer, values ) ) {
+
+        boost::lock_guard<boost::mutex> lock( j->mutex );
+        j->ok = false;
+        return;
+      }
+    }
+  }
+
+  bool zonal_stats::compute_zone( const job& j, size_t index,
+                                  std::vector<float>& buffer,
+                                  std::vector<std::vector<float> >& values )
+  {
+    const image& input( *j.input );
+    const polygon_with_holes& p( ( *j.polygons )[index] );
+    zone& result( zones_[index] );
+    const image::window& w( result.bounds );
+
+    size_t width( w.c2 - w.c1 );
+
+    if( !width || ( w.l1 == w.l2 ) ) {
+
+      return true;
+    }
+
+    std::vector<edge> edges;
+    add_ring( input, p.outer_boundary(), edges );
+
+    for( polygon_with_holes::Hole_const_iterator h = p.holes_begin();
+         h != p.holes_end(); ++h ) {
+
+      add_ring( input, *h, edges );
+    }
+
+    std::sort( edges.begin(), edges.end(), by_top );
+
+    size_t channels( input.get_channels() );
+    bool keep( !percentiles_.empty() );
+
+    std::vector<double> sum( channels, 0.0 );
+    std::vector<double> sum2( channels, 0.0 );
+
+    for( size_t k = 0; k < channels; ++k ) {
+
+      values[k].clear();
+    }
+
+    size_t block_lines( std::max( BLOCK_PIXELS / width,
+                                  static_cast<size_t>( 1 ) ) );
+
+    buffer.resize( std::min( block_lines, w.l2 - w.l1 ) * width );
+
+    scanline fill( edges );
+    std::vector<span> spans;
+
+    for( size_t l1 = w.l1; l1 < w.l2; l1 += block_lines ) {
+
+      size_t l2( std::min( l1 + block_lines, w.l2 ) );
+
+      spans.clear();
+
+      for( size_t i = l1; i < l2; ++i ) {
+
+        fill.add_spans( i, w.c1, w.c2, spans );
+      }
+
+      // blocks of lines outside the zone are not read
+      if( spans.empty() ) {
+
+        continue;
+      }
+
+      for( size_t s = 0; s < spans.size(); ++s ) {
+
+        result.pixels += spans[s].c2 - spans[s].c1;
+      }
+
+      for( size_t k = 1; k <= channels; ++k ) {
+
+        if( !input.read_window( k, l1, w.c1, l2, w.c2, &buffer[0] ) ) {
+
+          return false;
+        }
+
+        float nodata( static_cast<float>( input.get_nodata( k ) ) );
+        band_stats& b( result.bands[k - 1] );
+
+        for( size_t s = 0; s < spans.size(); ++s ) {
+
+          const float* line( &buffer[( spans[s].line - l1 ) * width] );
+
+          for( size_t c = spans[s].c1; c < spans[s].c2; ++c ) {
+
+            double v( line[c - w.c1] );
+
+            if( ( v == nodata ) || ( v != v ) ) {
+
+              continue;
+            }
+
+            if( !b.count ) {
+
+              b.minimum = b.maximum = v;
+
+            } else {
+
+              b.minimum = std::min( b.minimum, v );
+              b.maximum = std::max( b.maximum, v );
+            }
+
+            ++b.count;
+            sum[k - 1] += v;
+            sum2[k - 1] += v * v;
+
+            if( keep ) {
+
+              values[k - 1].push_back( line[c - w.c1] );
+            }
+          }
+        }
+      }
+    }
+
+    for( size_t k = 0; k < channels; ++k ) {
+
+      band_stats& b( result.bands[k] );
+
+      if( !b.count ) {
+
+        continue;
+      }
+
+      b.mean = sum[k] / b.count;
+      b.variance = ( b.count > 1 )
+        ? std::max( ( sum2[k] - sum[k] * b.mean ) / ( b.count - 1 ), 0.0 )
+        : 0.0;
+
+      b.percentiles.resize( percentiles_.size() );
+
+      for( size_t q = 0; q < percentiles_.size(); ++q ) {
+
+        // smallest value with at least the fraction at or below it
+        size_t rank( static_cast<size_t>(
+          std::ceil( percentiles_[q] * b.count ) ) );
+        size_t nth( rank ? rank - 1 : 0 );
+
+        std::nth_element( values[k].begin(), values[k].begin() + nth,
+                          values[k].end() );
+        b.percentiles[q] = values[k][nth];
+      }
+    }
+
+    return true;
+  }
+
+  bool zonal_stats::is_valid() const
+  {
+    return valid_;
+  }
+
+  size_t zonal_stats::size() const
+  {
+    return zones_.size();
+  }
+
+  const zonal_stats::zone& zonal_stats::get_zone( size_t index ) const
+  {
+    BOOST_ASSERT( index < zones_.size() );
+
+    return zones_[index];
+  }
+
+  const std::vector<double>& zonal_stats::get_percentiles() const
+  {
+    return percentiles_;
+  }
+
+}
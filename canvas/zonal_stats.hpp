@@ -0,0 +1,112 @@
+#ifndef CANVAS_ZONAL_STATS_HPP
+#define CANVAS_ZONAL_STATS_HPP
+
+#include <canvas/image.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include <CGAL/Polygon_2.h>
+#include <CGAL/Polygon_with_holes_2.h>
+
+#include <vector>
+
+namespace canvas {
+
+  // Statistics of every band of an image inside each of a set of polygons
+  // in map coordinates. A pixel belongs to a zone when its centre is inside
+  // the outer boundary and outside the holes.
+  //
+  // Zones are rasterised line by line into spans of pixels with a scanline
+  // fill, without a mask, and only the lines and columns they cover are
+  // read, a block of lines at a time. Threads take whole zones, in the order
+  // of their first line so that neighbouring zones are read together.
+  class zonal_stats : private boost::noncopyable {
+
+  public:
+    typedef CGAL::Polygon_2<Kernel> polygon;
+
+    typedef CGAL::Polygon_with_holes_2<Kernel> polygon_with_holes;
+
+    // pixels read together, per thread
+    static const size_t BLOCK_PIXELS = 1048576;
+
+    // of the valid (not nodata) pixels of a band in a zone
+    struct band_stats {
+
+      band_stats() : count( 0 ), minimum( 0.0 ), maximum( 0.0 ),
+                     mean( 0.0 ), variance( 0.0 )
+      {
+      }
+
+      boost::uint64_t count;
+
+      double minimum;
+
+      double maximum;
+
+      double mean;
+
+      double variance;
+
+      // the smallest values with at least each requested fraction of the
+      // pixels at or below them
+      std::vector<double> percentiles;
+
+    };
+
+    struct zone {
+
+      zone() : pixels( 0 )
+      {
+        bounds.l1 = bounds.c1 = bounds.l2 = bounds.c2 = 0;
+      }
+
+      boost::uint64_t pixels;           // inside, valid or not
+
+      image::window bounds;             // lines and columns read
+
+      std::vector<band_stats> bands;
+
+    };
+
+    // percentiles are fractions in [0, 1], computed only when requested
+    zonal_stats( const image& input,
+                 const std::vector<polygon_with_holes>& zones,
+                 const std::vector<double>& percentiles =
+                   std::vector<double>(),
+                 size_t threads = 0 );
+
+    // false without georeferencing or if the image could not be read
+    bool is_valid() const;
+
+    // number of zones
+    size_t size() const;
+
+    // in the order the polygons were given
+    const zone& get_zone( size_t index ) const;
+
+    const std::vector<double>& get_percentiles() const;
+
+  private:
+    struct job;
+
+    static void compute_zones( zonal_stats* self, job* j );
+
+    // values of the valid pixels of each band are kept for percentiles
+    bool compute_zone( const job& j, size_t index,
+                       std::vector<float>& buffer,
+                       std::vector<std::vector<float> >& values );
+
+    std::vector<double> percentiles_;
+
+    std::vector<zone> zones_;
+
+    bool valid_;
+
+  };
+
+}
+
+#endif
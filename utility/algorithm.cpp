@@ -0,0 +1,530 @@
+#include <utility/algorithm.hpp>
+#include <utility/thread_pool.hpp>
+
+#include <boost/bind.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace utility {
+
+  namespace algorithm {
+
+    namespace {
+
+      const char DIGITS[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+
+      void append_decimal( std::string& out, unsigned long long value,
+                           bool negative )
+      {
+        char buffer[24];
+        char* end( buffer + sizeof( buffer ) );
+        char* ptr( end );
+
+        while( value >= 100 ) {
+
+          const char* d( DIGITS + 2 * ( value % 100 ) );
+          value /= 100;
+          *--ptr = d[1];
+          *--ptr = d[0];
+        }
+
+        if( value >= 10 ) {
+
+          const char* d( DIGITS + 2 * value );
+          *--ptr = d[1];
+          *--ptr = d[0];
+
+        } else {
+
+          *--ptr = static_cast<char>( '0' + value );
+        }
+
+        if( negative ) {
+
+          *--ptr = '-';
+        }
+
+        out.append( ptr, end );
+      }
+
+      const double POWERS[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+        1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+      };
+
+      // "%.*f" without printf when value * 10^p is far enough from a rounding
+      // boundary that the double product rounds exactly like the decimal one
+      bool append_fixed( std::string& out, double value, int precision )
+      {
+        if( ( precision < 0 ) || ( precision > 15 ) ) {
+
+          return false;
+        }
+
+        bool negative( ( value < 0.0 ) || ( ( value == 0.0 )
+                                         && ( 1.0 / value < 0.0 ) ) );
+
+        double scaled( std::fabs( value ) * POWERS[precision] );
+
+        if( !( scaled < 4503599627370496.0 ) ) {
+
+          return false;
+        }
+
+        double whole( std::floor( scaled ) );
+        double fraction( scaled - whole );
+
+        if( std::fabs( fraction - 0.5 ) <= scaled * 4.5e-16 + 1e-300 ) {
+
+          return false;
+        }
+
+        unsigned long long digits( static_cast<unsigned long long>( whole ) );
+
+        if( fraction > 0.5 ) {
+
+          ++digits;
+        }
+
+        unsigned long long unit(
+          static_cast<unsigned long long>( POWERS[precision] )
+        );
+
+        append_decimal( out, digits / unit, negative );
+
+        if( precision > 0 ) {
+
+          char buffer[16];
+          unsigned long long decimals( digits % unit );
+
+          for( int n = precision - 1; n >= 0; --n ) {
+
+            buffer[n] = static_cast<char>( '0' + decimals % 10 );
+            decimals /= 10;
+          }
+
+          out += '.';
+          out.append( buffer, precision );
+        }
+
+        return true;
+      }
+
+      template <typename value_type>
+      void append_printf( std::string& out, const char* format,
+                          int precision, value_type value )
+      {
+        char buffer[128];
+        int n( snprintf( buffer, sizeof( buffer ), format, precision, value ) );
+
+        if( n < static_cast<int>( sizeof( buffer ) ) ) {
+
+          out.append( buffer, n );
+
+        } else {
+
+          std::vector<char> large( n + 1 );
+          snprintf( &large[0], large.size(), format, precision, value );
+          out.append( &large[0], n );
+        }
+      }
+
+      template <typename value_type>
+      void append_printf( std::string& out, const char* format,
+                          value_type value )
+      {
+        char buffer[128];
+        int n( snprintf( buffer, sizeof( buffer ), format, value ) );
+
+        BOOST_ASSERT( n < static_cast<int>( sizeof( buffer ) ) );
+        out.append( buffer, n );
+      }
+
+      template <typename unsigned_type>
+      void format_unsigned( std::string& out, unsigned_type value,
+                            const number_format& f )
+      {
+        if( f.is_plain() ) {
+
+          append_decimal( out, value, false );
+
+        } else {
+
+          append_printf( out, f.unsigned_format(),
+                         static_cast<unsigned long long>( value ) );
+        }
+      }
+
+      template <typename signed_type, typename unsigned_type>
+      void format_signed( std::string& out, signed_type value,
+                          const number_format& f )
+      {
+        std::ios_base::fmtflags base( f.flags() & std::ios_base::basefield );
+
+        if( f.is_plain() ) {
+
+          bool negative( value < 0 );
+
+          unsigned long long magnitude(
+            negative ? 0ULL - static_cast<unsigned long long>( value )
+                     : static_cast<unsigned long long>( value )
+          );
+
+          append_decimal( out, magnitude, negative );
+
+        } else if( ( base == std::ios_base::hex )
+                || ( base == std::ios_base::oct ) ) {
+
+          // streams print negative values in octal or hexadecimal as the
+          // unsigned value of the same width
+          append_printf( out, f.unsigned_format(),
+                         static_cast<unsigned long long>(
+                           static_cast<unsigned_type>( value ) ) );
+
+        } else {
+
+          append_printf( out, f.signed_format(),
+                         static_cast<long long>( value ) );
+        }
+      }
+
+      void parse( const char* text, float& value )
+      {
+        value = strtof( text, 0 );
+      }
+
+      void parse( const char* text, double& value )
+      {
+        value = strtod( text, 0 );
+      }
+
+      void parse( const char* text, long double& value )
+      {
+        value = strtold( text, 0 );
+      }
+
+      template <typename real_type, typename print_type>
+      void format_real( std::string& out, real_type value,
+                        const number_format& f, const char* format,
+                        int min_digits, int max_digits )
+      {
+        std::ios_base::fmtflags field(
+          f.flags() & std::ios_base::floatfield
+        );
+
+        if( f.is_roundtrip() ) {
+
+          char buffer[64];
+
+          real_type parsed;
+
+          for( int p = min_digits; p <= max_digits; ++p ) {
+
+            int n( snprintf( buffer, sizeof( buffer ), format, p,
+                             static_cast<print_type>( value ) ) );
+
+            parse( buffer, parsed );
+
+            if( ( p == max_digits ) || ( parsed == value ) ) {
+
+              out.append( buffer, n );
+              return;
+            }
+          }
+
+        } else if( field == ( std::ios_base::fixed
+                            | std::ios_base::scientific ) ) {
+
+          append_printf( out, format, static_cast<print_type>( value ) );
+
+        } else if( ( field == std::ios_base::fixed ) && f.is_plain()
+                && !( f.flags() & std::ios_base::showpoint )
+                && ( sizeof( real_type ) <= sizeof( double ) )
+                && append_fixed( out, value, f.precision() ) ) {
+
+          return;
+
+        } else {
+
+          append_printf( out, format, f.precision(),
+                         static_cast<print_type>( value ) );
+        }
+      }
+
+      void format_chunk( const boost::function<void( size_t,
+                                                     std::string& )>& f,
+                         size_t n, std::string* buffer )
+      {
+        f( n, *buffer );
+      }
+
+    }
+
+    number_format::number_format( const std::ios_base::fmtflags& format,
+                                  const size_t& p )
+      : flags_( format ), precision_( static_cast<int>( p ) ),
+        roundtrip_( false )
+    {
+      std::ios_base::fmtflags base( flags_ & std::ios_base::basefield );
+      std::ios_base::fmtflags field( flags_ & std::ios_base::floatfield );
+
+      bool upper( flags_ & std::ios_base::uppercase );
+      bool hexfloat( field == ( std::ios_base::fixed
+                              | std::ios_base::scientific ) );
+
+      // same conversions the standard library uses for operator<<
+      std::string real( "%" );
+
+      if( flags_ & std::ios_base::showpos ) {
+
+        real += '+';
+      }
+
+      if( flags_ & std::ios_base::showpoint ) {
+
+        real += '#';
+      }
+
+      if( !hexfloat ) {
+
+        real += ".*";
+      }
+
+      char conversion( upper ? 'G' : 'g' );
+
+      if( hexfloat ) {
+
+        conversion = upper ? 'A' : 'a';
+
+      } else if( field == std::ios_base::fixed ) {
+
+        conversion = 'f';
+
+      } else if( field == std::ios_base::scientific ) {
+
+        conversion = upper ? 'E' : 'e';
+      }
+
+      real_ = real + conversion;
+      long_real_ = real + 'L' + conversion;
+
+      plain_ = ( ( base == std::ios_base::dec ) || ( base == 0 ) )
+            && !( flags_ & std::ios_base::showpos );
+
+      signed_ = ( flags_ & std::ios_base::showpos ) ? "%+lld" : "%lld";
+
+      if( base == std::ios_base::hex ) {
+
+        unsigned_ = ( flags_ & std::ios_base::showbase ) ? "%#ll" : "%ll";
+        unsigned_ += upper ? 'X' : 'x';
+
+      } else if( base == std::ios_base::oct ) {
+
+        unsigned_ = ( flags_ & std::ios_base::showbase ) ? "%#llo" : "%llo";
+
+      } else {
+
+        unsigned_ = "%llu";
+      }
+    }
+
+    number_format number_format::roundtrip()
+    {
+      number_format f( std::ios_base::dec, 17 );
+      f.roundtrip_ = true;
+      f.real_ = "%.*g";
+      f.long_real_ = "%.*Lg";
+      return f;
+    }
+
+    const std::ios_base::fmtflags& number_format::flags() const
+    {
+      return flags_;
+    }
+
+    int number_format::precision() const
+    {
+      return precision_;
+    }
+
+    bool number_format::is_roundtrip() const
+    {
+      return roundtrip_;
+    }
+
+    const char* number_format::real_format() const
+    {
+      return real_.c_str();
+    }
+
+    const char* number_format::long_real_format() const
+    {
+      return long_real_.c_str();
+    }
+
+    const char* number_format::signed_format() const
+    {
+      return signed_.c_str();
+    }
+
+    const char* number_format::unsigned_format() const
+    {
+      return unsigned_.c_str();
+    }
+
+    bool number_format::is_plain() const
+    {
+      return plain_;
+    }
+
+    void format_value( std::string& out, bool value, const number_format& f )
+    {
+      if( f.flags() & std::ios_base::boolalpha ) {
+
+        out += value ? "true" : "false";
+
+      } else {
+
+        out += value ? '1' : '0';
+      }
+    }
+
+    void format_value( std::string& out, char value, const number_format& )
+    {
+      out += value;
+    }
+
+    void format_value( std::string& out, signed char value,
+                       const number_format& )
+    {
+      out += static_cast<char>( value );
+    }
+
+    void format_value( std::string& out, unsigned char value,
+                       const number_format& )
+    {
+      out += static_cast<char>( value );
+    }
+
+    void format_value( std::string& out, short value, const number_format& f )
+    {
+      format_signed<short,unsigned short>( out, value, f );
+    }
+
+    void format_value( std::string& out, unsigned short value,
+                       const number_format& f )
+    {
+      format_unsigned( out, value, f );
+    }
+
+    void format_value( std::string& out, int value, const number_format& f )
+    {
+      format_signed<int,unsigned int>( out, value, f );
+    }
+
+    void format_value( std::string& out, unsigned int value,
+                       const number_format& f )
+    {
+      format_unsigned( out, value, f );
+    }
+
+    void format_value( std::string& out, long value, const number_format& f )
+    {
+      format_signed<long,unsigned long>( out, value, f );
+    }
+
+    void format_value( std::string& out, unsigned long value,
+                       const number_format& f )
+    {
+      format_unsigned( out, value, f );
+    }
+
+    void format_value( std::string& out, long long value,
+                       const number_format& f )
+    {
+      format_signed<long long,unsigned long long>( out, value, f );
+    }
+
+    void format_value( std::string& out, unsigned long long value,
+                       const number_format& f )
+    {
+      format_unsigned( out, value, f );
+    }
+
+    void format_value( std::string& out, float value, const number_format& f )
+    {
+      format_real<float,double>( out, value, f, f.real_format(), 6, 9 );
+    }
+
+    void format_value( std::string& out, double value, const number_format& f )
+    {
+      format_real<double,double>( out, value, f, f.real_format(), 15, 17 );
+    }
+
+    void format_value( std::string& out, long double value,
+                       const number_format& f )
+    {
+      format_real<long double,long double>( out, value, f,
+                                            f.long_real_format(), 18, 21 );
+    }
+
+    bool write_chunks( std::ostream& out, size_t chunks,
+                       const boost::function<void( size_t, std::string& )>& f,
+                       size_t threads )
+    {
+      threads = thread_pool::get_threads( threads, chunks );
+
+      if( threads <= 1 ) {
+
+        std::string buffer;
+
+        for( size_t n = 0; n < chunks; ++n ) {
+
+          f( n, buffer );
+          out.write( buffer.data(), buffer.size() );
+        }
+
+        return out.good();
+      }
+
+      // while one round of chunks is written, the next one is formatted
+      std::vector<std::string> front( threads ), back( threads );
+
+      size_t next( 0 ), ready( 0 );
+
+      do {
+
+        thread_pool::group group( thread_pool::global() );
+
+        size_t first( next );
+
+        for( size_t t = 0; ( t < threads ) && ( next < chunks ); ++t, ++next ) {
+
+          group.run(
+            boost::bind( &format_chunk, boost::cref( f ), next, &back[t] )
+          );
+        }
+
+        for( size_t t = 0; t < ready; ++t ) {
+
+          out.write( front[t].data(), front[t].size() );
+        }
+
+        group.wait();
+
+        ready = next - first;
+        front.swap( back );
+
+      } while( ready > 0 );
+
+      return out.good();
+    }
+
+  }
+
+}
@@ -1,19 +1,201 @@
-
 #ifndef UTILITY_ALGORITHM_HPP
 #define UTILITY_ALGORITHM_HPP
 
+#include <utility/columnar.hpp>
+
 #include <boost/assert.hpp>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
 
 namespace utility {
 
   namespace algorithm {
 
+    // number of values formatted by a single task of the parallel writer
+    static const size_t CHUNK_SIZE = 65536;
+
+    class number_format {
+
+    public:
+      number_format( const std::ios_base::fmtflags& format, const size_t& p );
+
+      static number_format roundtrip();
+
+      const std::ios_base::fmtflags& flags() const;
+
+      int precision() const;
+
+      bool is_roundtrip() const;
+
+      const char* real_format() const;
+
+      const char* long_real_format() const;
+
+      const char* signed_format() const;
+
+      const char* unsigned_format() const;
+
+      bool is_plain() const;
+
+    private:
+      std::ios_base::fmtflags flags_;
+
+      int precision_;
+
+      bool roundtrip_;
+
+      bool plain_;
+
+      std::string real_;
+
+      std::string long_real_;
+
+      std::string signed_;
+
+      std::string unsigned_;
+
+    };
+
+    void format_value( std::string& out, bool value,
+                       const number_format& f );
+
+    void format_value( std::string& out, char value,
+                       const number_format& f );
+
+    void format_value( std::string& out, signed char value,
+                       const number_format& f );
+
+    void format_value( std::string& out, unsigned char value,
+                       const number_format& f );
+
+    void format_value( std::string& out, short value,
+                       const number_format& f );
+
+    void format_value( std::string& out, unsigned short value,
+                       const number_format& f );
+
+    void format_value( std::string& out, int value,
+                       const number_format& f );
+
+    void format_value( std::string& out, unsigned int value,
+                       const number_format& f );
+
+    void format_value( std::string& out, long value,
+                       const number_format& f );
+
+    void format_value( std::string& out, unsigned long value,
+                       const number_format& f );
+
+    void format_value( std::string& out, long long value,
+                       const number_format& f );
+
+    void format_value( std::string& out, unsigned long long value,
+                       const number_format& f );
+
+    void format_value( std::string& out, float value,
+                       const number_format& f );
+
+    void format_value( std::string& out, double value,
+                       const number_format& f );
+
+    void format_value( std::string& out, long double value,
+                       const number_format& f );
+
+    // fallback for non-arithmetic types: same output as operator<<
+    template <typename data_type>
+    void format_value( std::string& out, const data_type& value,
+                       const number_format& f )
+    {
+      std::ostringstream s;
+      s.flags( f.flags() );
+      s.precision( f.precision() );
+      s << value;
+      out += s.str();
+    }
+
+    // formats chunk n (values in [bounds[n], bounds[n + 1])) into a string
+    template <typename iterator_type>
+    class chunk_formatter {
+
+    public:
+      chunk_formatter( const std::vector<iterator_type>& bounds,
+                       const number_format& f )
+        : bounds_( bounds ), format_( f )
+      {
+      }
+
+      void operator()( size_t n, std::string& out ) const
+      {
+        out.clear();
+
+        iterator_type it( bounds_[n] );
+
+        for( ; it != bounds_[n + 1]; ++it ) {
+
+          format_value( out, *it, format_ );
+          out.push_back( '\n' );
+        }
+      }
+
+    private:
+      const std::vector<iterator_type>& bounds_;
+
+      const number_format& format_;
+
+    };
+
+    // formats chunks on worker threads and writes them to out in order
+    bool write_chunks( std::ostream& out, size_t chunks,
+                       const boost::function<void( size_t, std::string& )>& f,
+                       size_t threads = 0 );
+
+    template <class container_type>
+    bool write_formatted( const std::string& filename,
+                          const container_type& container,
+                          const number_format& f,
+                          size_t threads = 0 )
+    {
+      typedef typename container_type::const_iterator iterator_type;
+
+      std::vector<iterator_type> bounds;
+      bounds.reserve( container.size() / CHUNK_SIZE + 2 );
+
+      iterator_type it( container.begin() );
+      size_t remaining( container.size() );
+
+      bounds.push_back( it );
+
+      while( remaining > 0 ) {
+
+        size_t n( std::min( remaining, CHUNK_SIZE ) );
+        std::advance( it, n );
+        bounds.push_back( it );
+        remaining -= n;
+      }
+
+      std::ofstream out( filename.c_str(), std::ios::binary );
+
+      if( !out.is_open() ) {
+
+        std::cerr << "Unable to create file " << filename << std::endl;
+        return false;
+      }
+
+      chunk_formatter<iterator_type> formatter( bounds, f );
+
+      bool result( write_chunks( out, bounds.size() - 1, formatter, threads ) );
+      out.close();
+      return result;
+    }
+
     template <class container_type>
     boost::shared_ptr<container_type> load( const std::string& filename )
     {
@@ -29,20 +211,76 @@ namespace utility {
       return data;
     }
 
+    // false if the file cannot be written
     template <class container_type>
-    void write( const std::string& filename,
+    bool write( const std::string& filename,
                 const container_type& container,
                 const std::ios_base::fmtflags& format,
                 const size_t& p = 6 )
     {
-      typedef typename container_type::value_type data_type;
+      return write_formatted( filename, container,
+                              number_format( format, p ) );
+    }
 
-      std::ofstream out( filename.c_str() );
-      out.flags( format );
-      out.precision( p );
-      std::ostream_iterator<data_type> out_it( out, "\n" );
-      std::copy( container.begin(), container.end(), out_it );
-      out.close();
+    // writes the shortest decimal representation that reads back exactly
+    template <class container_type>
+    bool write_roundtrip( const std::string& filename,
+                          const container_type& container )
+    {
+      return write_formatted( filename, container,
+                              number_format::roundtrip() );
+    }
+
+    // single column binary file, mapped read-only without copying
+    template <typename data_type>
+    boost::shared_ptr<const mapped_memory<data_type> > load_binary(
+      const std::string& filename, bool verify = false )
+    {
+      boost::shared_ptr<const mapped_memory<data_type> > data;
+
+      columnar::reader in( filename );
+
+      if( in && ( in.get_columns() > 0 ) ) {
+
+        data = in.template map<data_type>( 0, verify );
+      }
+
+      return data;
+    }
+
+    template <class container_type>
+    bool write_binary( const std::string& filename,
+                       const container_type& container,
+                       bool with_checksum = false )
+    {
+      columnar::writer out( filename, 1, with_checksum );
+      return out.append( container ) && out.close();
+    }
+
+    template <typename data_type>
+    bool text_to_binary( const std::string& text,
+                         const std::string& binary,
+                         bool with_checksum = false )
+    {
+      boost::shared_ptr<std::vector<data_type> > data(
+        load<std::vector<data_type> >( text )
+      );
+
+      return write_binary( binary, *data, with_checksum );
+    }
+
+    template <typename data_type>
+    bool binary_to_text( const std::string& binary,
+                         const std::string& text,
+                         const std::ios_base::fmtflags& format,
+                         const size_t& p = 6 )
+    {
+      boost::shared_ptr<const mapped_memory<data_type> > data(
+        load_binary<data_type>( binary )
+      );
+
+      return data && write_formatted( text, *data,
+                                      number_format( format, p ) );
     }
 
   }
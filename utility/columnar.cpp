@@ -0,0 +1,315 @@
+#include <utility/columnar.hpp>
+
+#include <cstring>
+
+namespace utility {
+
+  namespace columnar {
+
+    size_t value_size( value_type type )
+    {
+      static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 0 };
+      return ( type <= Undefined ) ? sizes[type] : 0;
+    }
+
+    checksum::checksum() : sum1_( 0 ), sum2_( 0 ), pending_size_( 0 )
+    {
+    }
+
+    void checksum::update( const void* data, size_t bytes )
+    {
+      static const boost::uint64_t MODULUS = 4294967295ULL;
+
+      const unsigned char* ptr( static_cast<const unsigned char*>( data ) );
+      const unsigned char* end( ptr + bytes );
+
+      while( ( pending_size_ > 0 ) && ( pending_size_ < 4 ) && ( ptr != end ) ) {
+
+        pending_[pending_size_++] = *ptr++;
+      }
+
+      if( pending_size_ == 4 ) {
+
+        boost::uint32_t word;
+        memcpy( &word, pending_, 4 );
+        sum1_ = ( sum1_ + word ) % MODULUS;
+        sum2_ = ( sum2_ + sum1_ ) % MODULUS;
+        pending_size_ = 0;
+      }
+
+      // the sums cannot overflow within a block of this many words
+      static const size_t BLOCK = 65536;
+
+      while( static_cast<size_t>( end - ptr ) >= 4 ) {
+
+        size_t words( std::min( static_cast<size_t>( end - ptr ) / 4, BLOCK ) );
+
+        for( size_t n = 0; n < words; ++n, ptr += 4 ) {
+
+          boost::uint32_t word;
+          memcpy( &word, ptr, 4 );
+          sum1_ += word;
+          sum2_ += sum1_;
+        }
+
+        sum1_ %= MODULUS;
+        sum2_ %= MODULUS;
+      }
+
+      while( ptr != end ) {
+
+        pending_[pending_size_++] = *ptr++;
+      }
+    }
+
+    boost::uint64_t checksum::value() const
+    {
+      static const boost::uint64_t MODULUS = 4294967295ULL;
+
+      boost::uint64_t s1( sum1_ ), s2( sum2_ );
+
+      if( pending_size_ > 0 ) {
+
+        boost::uint32_t word( 0 );
+        memcpy( &word, pending_, pending_size_ );
+        s1 = ( s1 + word ) % MODULUS;
+        s2 = ( s2 + s1 ) % MODULUS;
+      }
+
+      return ( s2 << 32 ) | s1;
+    }
+
+    writer::writer( const std::string& filename,
+                    const size_t& columns,
+                    bool with_checksum,
+                    const boost::uint32_t& alignment )
+      : filename_( filename ),
+        out_( filename.c_str(), std::ios::binary | std::ios::trunc ),
+        position_( 0 )
+    {
+      BOOST_ASSERT( alignment > 0 );
+
+      memset( &header_, 0, sizeof( header_ ) );
+      memcpy( header_.magic, MAGIC, sizeof( MAGIC ) );
+      header_.version = VERSION;
+      header_.byte_order = ENDIAN_MARK;
+      header_.columns = static_cast<boost::uint32_t>( columns );
+      header_.alignment = alignment;
+      header_.flags = with_checksum ? CHECKSUM : 0;
+
+      columns_.reserve( columns );
+
+      if( !out_.is_open() ) {
+
+        std::cerr << "Unable to create file " << filename << std::endl;
+        return;
+      }
+
+      // header and descriptors are rewritten with final values on close()
+      std::vector<char> blank( sizeof( file_header )
+                             + columns * sizeof( column_header ), 0 );
+
+      out_.write( &blank[0], blank.size() );
+      position_ = blank.size();
+    }
+
+    writer::~writer()
+    {
+      if( out_.is_open() ) {
+
+        close();
+      }
+    }
+
+    writer::operator bool() const
+    {
+      return out_.is_open() && out_.good();
+    }
+
+    bool writer::begin_column( value_type type, size_t size,
+                               const std::string& name )
+    {
+      if( !*this || ( columns_.size() == header_.columns ) ) {
+
+        std::cerr << "Unable to append column to " << filename_ << std::endl;
+        return false;
+      }
+
+      boost::uint64_t padding(
+        ( header_.alignment - position_ % header_.alignment )
+          % header_.alignment
+      );
+
+      if( padding > 0 ) {
+
+        std::vector<char> blank( padding, 0 );
+        out_.write( &blank[0], padding );
+        position_ += padding;
+      }
+
+      column_header c;
+      memset( &c, 0, sizeof( c ) );
+      c.type = type;
+      c.value_size = static_cast<boost::uint32_t>( size );
+      c.offset = position_;
+      strncpy( c.name, name.c_str(), sizeof( c.name ) - 1 );
+
+      columns_.push_back( c );
+      sum_ = checksum();
+
+      return true;
+    }
+
+    void writer::write_values( const void* data, size_t bytes )
+    {
+      out_.write( static_cast<const char*>( data ), bytes );
+      position_ += bytes;
+
+      if( header_.flags & CHECKSUM ) {
+
+        sum_.update( data, bytes );
+      }
+    }
+
+    bool writer::end_column( const boost::uint64_t& count )
+    {
+      column_header& c( columns_.back() );
+      c.count = count;
+      c.checksum = ( header_.flags & CHECKSUM ) ? sum_.value() : 0;
+      return out_.good();
+    }
+
+    bool writer::close()
+    {
+      if( !out_.is_open() ) {
+
+        return false;
+      }
+
+      if( columns_.size() != header_.columns ) {
+
+        std::cerr << "Missing columns in " << filename_ << std::endl;
+        header_.columns = static_cast<boost::uint32_t>( columns_.size() );
+      }
+
+      out_.seekp( 0 );
+      out_.write( reinterpret_cast<const char*>( &header_ ),
+                  sizeof( header_ ) );
+
+      if( !columns_.empty() ) {
+
+        out_.write( reinterpret_cast<const char*>( &columns_[0] ),
+                    columns_.size() * sizeof( column_header ) );
+      }
+
+      bool result( out_.good() );
+      out_.close();
+      return result;
+    }
+
+    reader::reader( const std::string& filename )
+      : filename_( filename ), valid_( false )
+    {
+      std::ifstream in( filename.c_str(), std::ios::binary );
+
+      if( !in.is_open() ) {
+
+        std::cerr << "Unable to open file " << filename << std::endl;
+        return;
+      }
+
+      in.read( reinterpret_cast<char*>( &header_ ), sizeof( header_ ) );
+
+      if( !in || ( memcmp( header_.magic, MAGIC, sizeof( MAGIC ) ) != 0 ) ) {
+
+        std::cerr << "Not a columnar file: " << filename << std::endl;
+        return;
+      }
+
+      if( ( header_.version != VERSION )
+       || ( header_.byte_order != ENDIAN_MARK ) ) {
+
+        std::cerr << "Unsupported columnar file: " << filename << std::endl;
+        return;
+      }
+
+      columns_.resize( header_.columns );
+
+      if( header_.columns > 0 ) {
+
+        in.read( reinterpret_cast<char*>( &columns_[0] ),
+                 header_.columns * sizeof( column_header ) );
+      }
+
+      valid_ = in.good() && ( header_.alignment > 0 );
+
+      // every column must lie in the file, past the descriptors, so that
+      // mapping a truncated file fails here rather than on first access
+      in.seekg( 0, std::ios::end );
+
+      boost::uint64_t size( static_cast<boost::uint64_t>( in.tellg() ) );
+      boost::uint64_t start( sizeof( file_header ) +
+                             columns_.size() * sizeof( column_header ) );
+
+      for( size_t n = 0; valid_ && ( n < columns_.size() ); ++n ) {
+
+        const column_header& c( columns_[n] );
+
+        valid_ = ( c.type < Undefined )
+              && ( c.value_size == value_size(
+                                     static_cast<value_type>( c.type ) ) );
+
+        valid_ = valid_ && ( c.offset >= start ) && ( c.offset <= size )
+              && ( c.offset % header_.alignment == 0 )
+              && ( c.count <= ( size - c.offset ) / c.value_size );
+      }
+
+      if( !valid_ ) {
+
+        std::cerr << "Corrupt columnar file: " << filename << std::endl;
+      }
+    }
+
+    reader::operator bool() const
+    {
+      return valid_;
+    }
+
+    size_t reader::get_columns() const
+    {
+      return columns_.size();
+    }
+
+    value_type reader::get_type( size_t n ) const
+    {
+      BOOST_ASSERT( n < columns_.size() );
+      return static_cast<value_type>( columns_[n].type );
+    }
+
+    boost::uint64_t reader::get_count( size_t n ) const
+    {
+      BOOST_ASSERT( n < columns_.size() );
+      return columns_[n].count;
+    }
+
+    boost::uint64_t reader::get_offset( size_t n ) const
+    {
+      BOOST_ASSERT( n < columns_.size() );
+      return columns_[n].offset;
+    }
+
+    std::string reader::get_name( size_t n ) const
+    {
+      BOOST_ASSERT( n < columns_.size() );
+      const char* name( columns_[n].name );
+      return std::string( name, strnlen( name, sizeof( columns_[n].name ) ) );
+    }
+
+    bool reader::has_checksum() const
+    {
+      return ( header_.flags & CHECKSUM ) != 0;
+    }
+
+  }
+
+}
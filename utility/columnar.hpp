@@ -0,0 +1,265 @@
+#ifndef UTILITY_COLUMNAR_HPP
+#define UTILITY_COLUMNAR_HPP
+
+#include <utility/mapped_memory.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace utility {
+
+  // Binary columnar files: a fixed header, one descriptor per column, then
+  // the raw column values, each column starting at an aligned offset so it
+  // can be memory mapped and used in place.
+  namespace columnar {
+
+    enum value_type { Int8=0, UInt8=1, Int16=2, UInt16=3, Int32=4, UInt32=5,
+                      Int64=6, UInt64=7, Float32=8, Float64=9, Undefined=10 };
+
+    template <typename num_type> struct type_of;
+
+    template <> struct type_of<boost::int8_t>   { enum { code = Int8    }; };
+    template <> struct type_of<boost::uint8_t>  { enum { code = UInt8   }; };
+    template <> struct type_of<boost::int16_t>  { enum { code = Int16   }; };
+    template <> struct type_of<boost::uint16_t> { enum { code = UInt16  }; };
+    template <> struct type_of<boost::int32_t>  { enum { code = Int32   }; };
+    template <> struct type_of<boost::uint32_t> { enum { code = UInt32  }; };
+    template <> struct type_of<boost::int64_t>  { enum { code = Int64   }; };
+    template <> struct type_of<boost::uint64_t> { enum { code = UInt64  }; };
+    template <> struct type_of<float>           { enum { code = Float32 }; };
+    template <> struct type_of<double>          { enum { code = Float64 }; };
+
+    static const char MAGIC[8] = { 'U', 'C', 'O', 'L', 'U', 'M', 'N', 0 };
+
+    static const boost::uint32_t VERSION = 1;
+
+    static const boost::uint32_t ENDIAN_MARK = 0x01020304;
+
+    static const boost::uint32_t DEFAULT_ALIGNMENT = 4096;
+
+    enum flags { CHECKSUM = 1 };
+
+    struct file_header {
+
+      char magic[8];
+
+      boost::uint32_t version;
+
+      boost::uint32_t byte_order;
+
+      boost::uint32_t columns;
+
+      boost::uint32_t alignment;
+
+      boost::uint32_t flags;
+
+      boost::uint32_t reserved;
+
+    };
+
+    struct column_header {
+
+      boost::uint32_t type;
+
+      boost::uint32_t value_size;
+
+      boost::uint64_t count;
+
+      boost::uint64_t offset;
+
+      boost::uint64_t checksum;
+
+      char name[32];
+
+    };
+
+    size_t value_size( value_type type );
+
+    // Fletcher-style checksum over 32-bit words, fed incrementally
+    class checksum {
+
+    public:
+      checksum();
+
+      void update( const void* data, size_t bytes );
+
+      boost::uint64_t value() const;
+
+    private:
+      boost::uint64_t sum1_;
+
+      boost::uint64_t sum2_;
+
+      unsigned char pending_[4];
+
+      size_t pending_size_;
+
+    };
+
+    class writer {
+
+    public:
+      writer( const std::string& filename,
+              const size_t& columns,
+              bool with_checksum = false,
+              const boost::uint32_t& alignment = DEFAULT_ALIGNMENT );
+
+      ~writer();
+
+      operator bool() const;
+
+      template <class container_type>
+      bool append( const container_type& container,
+                   const std::string& name = "" )
+      {
+        typedef typename container_type::value_type data_type;
+        typedef typename container_type::const_iterator iterator_type;
+
+        if( !begin_column( static_cast<value_type>(
+              type_of<data_type>::code ), sizeof( data_type ), name ) ) {
+
+          return false;
+        }
+
+        std::vector<data_type> buffer;
+        buffer.reserve( BUFFER_SIZE / sizeof( data_type ) );
+
+        boost::uint64_t count( 0 );
+
+        for( iterator_type it = container.begin();
+             it != container.end(); ++it, ++count ) {
+
+          buffer.push_back( *it );
+
+          if( buffer.size() == buffer.capacity() ) {
+
+            write_values( &buffer[0], buffer.size() * sizeof( data_type ) );
+            buffer.clear();
+          }
+        }
+
+        if( !buffer.empty() ) {
+
+          write_values( &buffer[0], buffer.size() * sizeof( data_type ) );
+        }
+
+        return end_column( count );
+      }
+
+      bool close();
+
+    private:
+      static const size_t BUFFER_SIZE = 1048576;
+
+      bool begin_column( value_type type, size_t size,
+                         const std::string& name );
+
+      void write_values( const void* data, size_t bytes );
+
+      bool end_column( const boost::uint64_t& count );
+
+      std::string filename_;
+
+      std::ofstream out_;
+
+      file_header header_;
+
+      std::vector<column_header> columns_;
+
+      checksum sum_;
+
+      boost::uint64_t position_;
+
+    };
+
+    class reader {
+
+    public:
+      explicit reader( const std::string& filename );
+
+      operator bool() const;
+
+      size_t get_columns() const;
+
+      value_type get_type( size_t n ) const;
+
+      boost::uint64_t get_count( size_t n ) const;
+
+      // bytes from the start of the file to the values of column n
+      boost::uint64_t get_offset( size_t n ) const;
+
+      std::string get_name( size_t n ) const;
+
+      bool has_checksum() const;
+
+      // maps column n read-only; no data is copied
+      template <typename num_type>
+      boost::shared_ptr<const mapped_memory<num_type> > map(
+        size_t n, bool verify = false ) const
+      {
+        boost::shared_ptr<const mapped_memory<num_type> > result;
+
+        BOOST_ASSERT( n < columns_.size() );
+
+        const column_header& c( columns_[n] );
+
+        if( c.type != static_cast<boost::uint32_t>(
+                        type_of<num_type>::code ) ) {
+
+          std::cerr << "Column type mismatch in " << filename_ << std::endl;
+          return result;
+        }
+
+        if( c.count == 0 ) {
+
+          result.reset( new mapped_memory<num_type>() );
+          return result;
+        }
+
+        result.reset(
+          new mapped_memory<num_type>( filename_, c.offset, c.count )
+        );
+
+        if( !*result ) {
+
+          result.reset();
+
+        } else if( verify && has_checksum() ) {
+
+          checksum sum;
+          sum.update( result->get(), result->bytes() );
+
+          if( sum.value() != c.checksum ) {
+
+            std::cerr << "Checksum mismatch in column " << n
+                      << " of " << filename_ << std::endl;
+            result.reset();
+          }
+        }
+
+        return result;
+      }
+
+    private:
+      std::string filename_;
+
+      file_header header_;
+
+      std::vector<column_header> columns_;
+
+      bool valid_;
+
+    };
+
+  }
+
+}
+
+#endif
@@ -1,15 +1,455 @@
 #include <utility/compat.hpp>
 
-
+#include <cstring>
+#include <exception>
+#include <limits>
 #include <string>
 
 namespace utility {
 
+  namespace {
+
+    const boost::int64_t MICROSECONDS_PER_DAY = 86400000000LL;
+
+    // timestamp broken down as microseconds since 1970-01-01 00:00:00
+    typedef boost::int64_t instant;
+
+    bool is_digit( char c )
+    {
+      return ( c >= '0' ) && ( c <= '9' );
+    }
+
+    bool is_date_separator( char c )
+    {
+      return ( c == ',' ) || ( c == '-' ) || ( c == '.' ) || ( c == '/' );
+    }
+
+    bool is_time_separator( char c )
+    {
+      return ( c == '-' ) || ( c == ':' ) || ( c == ',' ) || ( c == '.' );
+    }
+
+    // around the records of a batch, including the '\r' of CRLF lines
+    bool is_blank( char c )
+    {
+      return ( c == ' ' ) || ( c == '\t' ) || ( c == '\r' );
+    }
+
+    bool parse_number( const char*& ptr, const char* last,
+                       boost::uint32_t max_value, boost::uint32_t& value )
+    {
+      const char* begin( ptr );
+      value = 0;
+
+      for( ; ( ptr != last ) && is_digit( *ptr ); ++ptr ) {
+
+        value = value * 10 + ( *ptr - '0' );
+
+        if( value > max_value ) {
+
+          return false;
+        }
+      }
+
+      return ( ptr != begin );
+    }
+
+    bool parse_month_name( const char*& ptr, const char* last,
+                           boost::uint32_t& month )
+    {
+      static const char* names[] = {
+        "january", "february", "march", "april", "may", "june", "july",
+        "august", "september", "october", "november", "december"
+      };
+
+      char word[10];
+      size_t length( 0 );
+
+      for( ; ( ptr != last ) && !is_date_separator( *ptr ); ++ptr ) {
+
+        if( length == sizeof( word ) ) {
+
+          return false;
+        }
+
+        word[length++] = static_cast<char>( tolower( *ptr ) );
+      }
+
+      for( boost::uint32_t m = 0; m < 12; ++m ) {
+
+        size_t full( strlen( names[m] ) );
+
+        if( ( ( length == 3 ) || ( length == full ) )
+         && ( strncmp( word, names[m], length ) == 0 ) ) {
+
+          month = m + 1;
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool skip_separators( const char*& ptr, const char* last )
+    {
+      const char* begin( ptr );
+
+      while( ( ptr != last ) && is_date_separator( *ptr ) ) {
+
+        ++ptr;
+      }
+
+      return ( ptr != begin );
+    }
+
+    bool is_leap( boost::int64_t year )
+    {
+      return ( ( year % 4 == 0 ) && ( year % 100 != 0 ) ) || ( year % 400 == 0 );
+    }
+
+    boost::uint32_t days_in_month( boost::uint32_t year, boost::uint32_t month )
+    {
+      static const boost::uint32_t days[] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+      };
+
+      return ( ( month == 2 ) && is_leap( year ) ) ? 29 : days[month - 1];
+    }
+
+    // proleptic Gregorian calendar, days relative to 1970-01-01
+    boost::int64_t days_from_civil( boost::int64_t y, boost::uint32_t m,
+                                    boost::uint32_t d )
+    {
+      y -= ( m <= 2 );
+      boost::int64_t era( ( y >= 0 ? y : y - 399 ) / 400 );
+      boost::int64_t yoe( y - era * 400 );
+      boost::int64_t doy( ( 153 * ( m + ( m > 2 ? -3 : 9 ) ) + 2 ) / 5 + d - 1 );
+      boost::int64_t doe( yoe * 365 + yoe / 4 - yoe / 100 + doy );
+      return era * 146097 + doe - 719468;
+    }
+
+    void civil_from_days( boost::int64_t z, boost::int64_t& y,
+                          boost::uint32_t& m, boost::uint32_t& d )
+    {
+      z += 719468;
+      boost::int64_t era( ( z >= 0 ? z : z - 146096 ) / 146097 );
+      boost::int64_t doe( z - era * 146097 );
+      boost::int64_t yoe( ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365 );
+      boost::int64_t doy( doe - ( 365 * yoe + yoe / 4 - yoe / 100 ) );
+      boost::int64_t mp( ( 5 * doy + 2 ) / 153 );
+
+      d = static_cast<boost::uint32_t>( doy - ( 153 * mp + 2 ) / 5 + 1 );
+      m = static_cast<boost::uint32_t>( mp < 10 ? mp + 3 : mp - 9 );
+      y = yoe + era * 400 + ( m <= 2 );
+    }
+
+    bool parse( const char* first, const char* last, instant& result )
+    {
+      const char* ptr( first );
+
+      boost::uint32_t year, month, day;
+
+      // date: year, month and day, split on runs of ",-./"
+      if( !parse_number( ptr, last, 9999, year ) || ( year < 1400 )
+       || !skip_separators( ptr, last ) ) {
+
+        return false;
+      }
+
+      if( ( ptr != last ) && is_digit( *ptr ) ) {
+
+        if( !parse_number( ptr, last, 12, month ) || ( month == 0 ) ) {
+
+          return false;
+        }
+
+      } else if( !parse_month_name( ptr, last, month ) ) {
+
+        return false;
+      }
+
+      if( !skip_separators( ptr, last )
+       || !parse_number( ptr, last, 31, day ) || ( day == 0 )
+       || ( day > days_in_month( year, month ) ) ) {
+
+        return false;
+      }
+
+      // time of day: [-]h[:mm[:ss[.fff]]], fields split on one of "-:,.",
+      // after a blank or the ISO 8601 'T'
+      if( ( ptr == last ) || ( ( *ptr != ' ' ) && ( *ptr != 'T' ) )
+       || ( ++ptr == last ) ) {
+
+        return false;
+      }
+
+      bool negative( *ptr == '-' );
+
+      if( negative ) {
+
+        ++ptr;
+      }
+
+      boost::uint32_t hours, minutes( 0 ), seconds( 0 ), fraction( 0 );
+
+      if( !parse_number( ptr, last, 999999, hours ) ) {
+
+        return false;
+      }
+
+      boost::uint32_t* fields[] = { &minutes, &seconds };
+
+      for( size_t n = 0; ( n < 2 ) && ( ptr != last ); ++n ) {
+
+        if( !is_time_separator( *ptr ) || ( ++ptr == last )
+         || !parse_number( ptr, last, 65535, *fields[n] ) ) {
+
+          return false;
+        }
+      }
+
+      if( ptr != last ) {
+
+        if( !is_time_separator( *ptr ) || ( ++ptr == last )
+         || !is_digit( *ptr ) ) {
+
+          return false;
+        }
+
+        // microsecond resolution, extra digits are truncated
+        size_t digits( 0 );
+
+        for( ; ( ptr != last ) && is_digit( *ptr ); ++ptr, ++digits ) {
+
+          if( digits < 6 ) {
+
+            fraction = fraction * 10 + ( *ptr - '0' );
+          }
+        }
+
+        for( ; digits < 6; ++digits ) {
+
+          fraction *= 10;
+        }
+      }
+
+      if( ptr != last ) {
+
+        return false;
+      }
+
+      boost::int64_t tod( ( static_cast<boost::int64_t>( hours ) * 3600
+                          + static_cast<boost::int64_t>( minutes ) * 60
+                          + seconds ) * 1000000 + fraction );
+
+      result = days_from_civil( year, month, day ) * MICROSECONDS_PER_DAY
+             + ( negative ? -tod : tod );
+
+      // the time of day may move the date out of the range boost supports
+      static const instant lower(
+        days_from_civil( 1400, 1, 1 ) * MICROSECONDS_PER_DAY
+      );
+
+      static const instant upper(
+        days_from_civil( 10000, 1, 1 ) * MICROSECONDS_PER_DAY
+      );
+
+      return ( result >= lower ) && ( result < upper );
+    }
+
+    void to_tm( instant t, struct tm& result )
+    {
+      boost::int64_t days( t / MICROSECONDS_PER_DAY );
+      boost::int64_t tod( t % MICROSECONDS_PER_DAY );
+
+      if( tod < 0 ) {
+
+        tod += MICROSECONDS_PER_DAY;
+        --days;
+      }
+
+      boost::int64_t year;
+      boost::uint32_t month, day;
+      civil_from_days( days, year, month, day );
+
+      tod /= 1000000;
+
+      memset( &result, 0, sizeof( result ) );
+
+      result.tm_year  = static_cast<int>( year - 1900 );
+      result.tm_mon   = static_cast<int>( month - 1 );
+      result.tm_mday  = static_cast<int>( day );
+      result.tm_wday  = static_cast<int>( ( ( days % 7 ) + 11 ) % 7 );
+      result.tm_yday  = static_cast<int>(
+        days - days_from_civil( year, 1, 1 )
+      );
+      result.tm_hour  = static_cast<int>( tod / 3600 );
+      result.tm_min   = static_cast<int>( ( tod / 60 ) % 60 );
+      result.tm_sec   = static_cast<int>( tod % 60 );
+      result.tm_isdst = -1;
+    }
+
+    void store( instant t, struct tm& result )
+    {
+      to_tm( t, result );
+    }
+
+    void store( instant t, double& result )
+    {
+      result = static_cast<double>( t ) * 1e-6;
+    }
+
+    void invalidate( struct tm& result )
+    {
+      memset( &result, 0, sizeof( result ) );
+    }
+
+    void invalidate( double& result )
+    {
+      result = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // what boost::posix_time::time_from_string makes of [first, last), for
+    // the timestamps outside the grammar of parse, such as dates alone
+    bool parse_fallback( const char* first, const char* last,
+                         instant& result )
+    {
+      try {
+
+        boost::posix_time::ptime ptime(
+          boost::posix_time::time_from_string( std::string( first, last ) )
+        );
+
+        if( ptime.is_special() ) {
+
+          return false;
+        }
+
+        static const boost::posix_time::ptime epoch(
+          boost::gregorian::date( 1970, 1, 1 )
+        );
+
+        result = ( ptime - epoch ).total_microseconds();
+        return true;
+
+      } catch( const std::exception& ) {
+
+        return false;
+      }
+    }
+
+    template <typename value_type>
+    size_t parse_batch( const char* buffer, size_t size,
+                        value_type* result, size_t capacity,
+                        bool* valid, char delimiter )
+    {
+      const char* ptr( buffer );
+      const char* end( buffer + size );
+
+      size_t count( 0 );
+
+      while( ( ptr != end ) && ( count < capacity ) ) {
+
+        const char* next(
+          static_cast<const char*>( memchr( ptr, delimiter, end - ptr ) )
+        );
+
+        const char* first( ptr );
+        const char* stop( next ? next : end );
+
+        while( ( first != stop ) && is_blank( *first ) ) {
+
+          ++first;
+        }
+
+        while( ( stop != first ) && is_blank( *( stop - 1 ) ) ) {
+
+          --stop;
+        }
+
+        instant t;
+        bool ok( parse( first, stop, t ) || parse_fallback( first, stop, t ) );
+
+        if( ok ) {
+
+          store( t, result[count] );
+
+        } else {
+
+          invalidate( result[count] );
+        }
+
+        if( valid ) {
+
+          valid[count] = ok;
+        }
+
+        ++count;
+
+        ptr = next ? next + 1 : end;
+      }
+
+      return count;
+    }
+
+  }
+
   struct tm strptime( const char* timestamp )
   {
+    instant t;
+
+    if( parse( timestamp, timestamp + strlen( timestamp ), t ) ) {
+
+      struct tm result;
+      to_tm( t, result );
+      return result;
+    }
+
+    // anything the fast path rejects gets boost's own handling and errors
     std::string ts( timestamp );
     boost::posix_time::ptime ptime = boost::posix_time::time_from_string( ts );
     return boost::posix_time::to_tm( ptime );
   }
 
+  bool parse_timestamp( const char* first, const char* last,
+                        struct tm& result )
+  {
+    instant t;
+
+    if( parse( first, last, t ) ) {
+
+      to_tm( t, result );
+      return true;
+    }
+
+    return false;
+  }
+
+  bool parse_timestamp( const char* first, const char* last, double& epoch )
+  {
+    instant t;
+
+    if( parse( first, last, t ) ) {
+
+      store( t, epoch );
+      return true;
+    }
+
+    return false;
+  }
+
+  size_t strptime( const char* buffer, size_t size,
+                   struct tm* result, size_t capacity,
+                   bool* valid, char delimiter )
+  {
+    return parse_batch( buffer, size, result, capacity, valid, delimiter );
+  }
+
+  size_t strptime( const char* buffer, size_t size,
+                   double* result, size_t capacity,
+                   bool* valid, char delimiter )
+  {
+    return parse_batch( buffer, size, result, capacity, valid, delimiter );
+  }
+
 }
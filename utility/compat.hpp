@@ -1,13 +1,39 @@
-
 #ifndef UTILITY_COMPAT_HPP
 #define UTILITY_COMPAT_HPP
 
+#include <boost/cstdint.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <ctime>
+
 namespace utility {
 
   struct tm strptime( const char* timestamp );
 
+  // Allocation-free parsing of the "yyyy-mm-dd hh:mm:ss[.fff]" timestamps
+  // accepted by boost::posix_time::time_from_string (numeric or named months,
+  // any of ",-./" between date fields and any of "-:,." between time fields),
+  // and of the same with an ISO 8601 'T' between date and time. Returns
+  // false for input outside that grammar.
+  bool parse_timestamp( const char* first, const char* last,
+                        struct tm& result );
+
+  bool parse_timestamp( const char* first, const char* last, double& epoch );
+
+  // Batch parsing of the delimiter separated timestamps in [buffer,
+  // buffer + size). Writes at most capacity values and returns the number of
+  // records found; invalid records are zero filled (NaN for epoch seconds)
+  // and flagged in valid when it is given. Blanks around a record, such as
+  // the '\r' of CRLF lines, are ignored; records outside the grammar of
+  // parse_timestamp go to time_from_string, as in strptime( timestamp ).
+  size_t strptime( const char* buffer, size_t size,
+                   struct tm* result, size_t capacity,
+                   bool* valid = 0, char delimiter = '\n' );
+
+  size_t strptime( const char* buffer, size_t size,
+                   double* result, size_t capacity,
+                   bool* valid = 0, char delimiter = '\n' );
+
 }
 
 #endif
@@ -2,6 +2,9 @@
 #ifndef UTILITY_MAPPED_MEMORY_HPP
 #define UTILITY_MAPPED_MEMORY_HPP
 
+#include <utility/memory_budget.hpp>
+#include <utility/profiler.hpp>
+
 #include <boost/cstdint.hpp>
 #include <boost/filesystem.hpp>
 
@@ -11,6 +14,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <cstdio>
 #include <iostream>
@@ -24,15 +28,38 @@ namespace utility {
   public:
     static const boost::uint64_t MAX_IN_MEMORY = 16777216;
 
+    typedef num_type value_type;
+
+    typedef num_type* iterator;
+
+    typedef const num_type* const_iterator;
+
     explicit mapped_memory( const boost::uint64_t& count = 0 )
-      : ptr_( 0 ), count_( count ), fd_( -1 )
+      : ptr_( 0 ), count_( count ), fd_( -1 ), shift_( 0 ), writable_( true ),
+        private_( false ), mapped_( false ), profiled_( false )
     {
       reserve();
     }
 
+    // maps count values stored at offset bytes into an existing file; a
+    // private mapping is writable but keeps the changes out of the file,
+    // copying the pages written to
+    mapped_memory( const std::string& path,
+                   const boost::uint64_t& offset,
+                   const boost::uint64_t& count,
+                   bool writable = false, bool private_copy = false )
+      : ptr_( 0 ), count_( count ), fd_( -1 ), path_( path ), shift_( 0 ),
+        writable_( writable || private_copy ), private_( private_copy ),
+        mapped_( false ), profiled_( false )
+    {
+      attach( offset );
+    }
+
     mapped_memory( const mapped_memory& other )
       : ptr_( 0 ), count_( other.count_ ),
-        fd_( other.fd_ ), path_( other.path_ )
+        fd_( other.fd_ ), path_( other.path_ ), shift_( other.shift_ ),
+        writable_( other.writable_ ), private_( other.private_ ),
+        mapped_( false ), profiled_( false )
     {
       memcpy( ptr_, other.ptr_, bytes() );
     }
@@ -73,9 +100,30 @@ namespace utility {
       return ptr_;
     }
 
+    const_iterator begin() const
+    {
+      return ptr_;
+    }
+
+    const_iterator end() const
+    {
+      return ptr_ + count_;
+    }
+
+    // decided when the memory is reserved, see memory_budget::place
     bool is_mapped() const
     {
-      return ( count_ > MAX_IN_MEMORY );
+      return mapped_;
+    }
+
+    bool is_attached() const
+    {
+      return !path_.empty();
+    }
+
+    bool is_writable() const
+    {
+      return writable_;
     }
 
     boost::uint64_t size() const
@@ -94,6 +142,12 @@ namespace utility {
       std::swap( other.count_, count_ );
       std::swap( other.fd_   , fd_    );
       std::swap( other.path_ , path_  );
+      std::swap( other.filename_, filename_ );
+      std::swap( other.shift_, shift_ );
+      std::swap( other.writable_, writable_ );
+      std::swap( other.private_, private_ );
+      std::swap( other.mapped_, mapped_ );
+      std::swap( other.profiled_, profiled_ );
     }
 
     void reserve()
@@ -105,7 +159,9 @@ namespace utility {
         return;
       }
 
-      if( is_mapped() ) {
+      mapped_ = memory_budget::place( bytes(), count_ > MAX_IN_MEMORY );
+
+      if( mapped_ ) {
 
         boost::filesystem::path tmp( boost::filesystem::temp_directory_path() );
         filename_ = tmp.string() + "/mm_XXXXXX";
@@ -119,6 +175,7 @@ namespace utility {
         if( fd_ == -1 ) {
 
           std::cerr << "Unable to create map file: " << filename_ << std::endl;
+          memory_budget::release( bytes(), mapped_ );
           return;
         }
 
@@ -135,6 +192,8 @@ namespace utility {
 
         ptr_ = new num_type[count_];
       }
+
+      account();
     }
 
     void release()
@@ -144,7 +203,21 @@ namespace utility {
         return;
       }
 
-      if( is_mapped() ) {
+      if( profiled_ ) {
+
+        profiler::released( bytes() );
+        profiled_ = false;
+      }
+
+      memory_budget::release( bytes(), mapped_ );
+
+      if( is_attached() ) {
+
+        char* base( reinterpret_cast<char*>( ptr_ ) - shift_ );
+        munmap( base, bytes() + shift_ );
+        close( fd_ );
+
+      } else if( is_mapped() ) {
 
         munmap( ptr_, bytes() );
         close( fd_ );
@@ -162,6 +235,56 @@ namespace utility {
     }
 
   private:
+    void attach( const boost::uint64_t& offset )
+    {
+      if( !count_ ) {
+
+        return;
+      }
+
+      fd_ = open( path_.c_str(),
+                  ( writable_ && !private_ ) ? O_RDWR : O_RDONLY );
+
+      if( fd_ == -1 ) {
+
+        std::cerr << "Unable to open map file: " << path_ << std::endl;
+        return;
+      }
+
+      // mmap offsets must be page aligned
+      boost::uint64_t page( sysconf( _SC_PAGESIZE ) );
+      shift_ = offset % page;
+
+      int protection( writable_ ? PROT_READ | PROT_WRITE : PROT_READ );
+
+      void* mem = mmap( 0, bytes() + shift_, protection,
+                        private_ ? MAP_PRIVATE : MAP_SHARED,
+                        fd_, offset - shift_ );
+
+      if( mem == MAP_FAILED ) {
+
+        std::cerr << "Unable to map file: " << path_ << std::endl;
+        close( fd_ );
+        fd_ = -1;
+        return;
+      }
+
+      ptr_ = reinterpret_cast<num_type*>( static_cast<char*>( mem ) + shift_ );
+      mapped_ = true;
+
+      memory_budget::attach( bytes() );
+      account();
+    }
+
+    void account()
+    {
+      if( ptr_ && profiler::enabled() ) {
+
+        profiler::allocated( bytes(), is_mapped() );
+        profiled_ = true;
+      }
+    }
+
     num_type* ptr_;
 
     boost::uint64_t count_;
@@ -172,6 +295,17 @@ namespace utility {
 
     std::string path_;
 
+    boost::uint64_t shift_;
+
+    bool writable_;
+
+    // mapped MAP_PRIVATE, copy-on-write
+    bool private_;
+
+    bool mapped_;
+
+    bool profiled_;
+
   };
 
 }
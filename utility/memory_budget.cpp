@@ -0,0 +1,276 @@
+#include <utility/memory_budget.hpp>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace utility {
+
+  namespace memory_budget {
+
+    namespace {
+
+      // the cache is never shrunk below this
+      const boost::uint64_t MIN_CACHE = 16777216;
+
+      struct state {
+
+        state() : limit( from_environment() ), fraction( 0.25 ), heap( 0 ),
+                  mapped( 0 ), peak_heap( 0 ), peak( 0 ), cache( 0 ),
+                  clients( 0 )
+        {
+        }
+
+        static boost::uint64_t from_environment()
+        {
+          const char* value( getenv( "CANVAS_MEMORY_BUDGET" ) );
+
+          if( !value || !*value ) {
+
+            return 0;
+          }
+
+          char* suffix;
+          double bytes( strtod( value, &suffix ) );
+
+          switch( *suffix ) {
+
+            case 'k': case 'K': bytes *= 1024.0; break;
+            case 'm': case 'M': bytes *= 1048576.0; break;
+            case 'g': case 'G': bytes *= 1073741824.0; break;
+            default: break;
+          }
+
+          return ( bytes > 0.0 ) ? static_cast<boost::uint64_t>( bytes ) : 0;
+        }
+
+        boost::mutex mutex;
+
+        // held while the handler is called, after mutex is released
+        boost::mutex notify_mutex;
+
+        boost::uint64_t limit;
+
+        double fraction;
+
+        boost::uint64_t heap;
+
+        boost::uint64_t mapped;
+
+        boost::uint64_t peak_heap;
+
+        boost::uint64_t peak;
+
+        boost::uint64_t cache;
+
+        size_t clients;
+
+        cache_handler handler;
+
+      };
+
+      state& get_state()
+      {
+        static state s;
+        return s;
+      }
+
+      // part of the limit kept for the cache while there are clients
+      boost::uint64_t cache_share( const state& s )
+      {
+        boost::uint64_t share(
+          static_cast<boost::uint64_t>( s.fraction * s.limit )
+        );
+
+        return std::min( std::max( share, MIN_CACHE ), s.limit );
+      }
+
+      // the share, shrunk when bands already use the rest of the limit
+      boost::uint64_t cache_size( const state& s )
+      {
+        boost::uint64_t free( s.limit > s.heap ? s.limit - s.heap : 0 );
+        return std::max( std::min( cache_share( s ), free ), MIN_CACHE );
+      }
+
+      // true if the size changed, to be notified outside the lock
+      bool update_cache( state& s )
+      {
+        if( !s.limit || !s.clients || !s.handler ) {
+
+          return false;
+        }
+
+        boost::uint64_t size( cache_size( s ) );
+
+        if( size == s.cache ) {
+
+          return false;
+        }
+
+        s.cache = size;
+        return true;
+      }
+
+      // calls the handler one change at a time with the size of the state
+      // as it is then, so that the last call leaves the cache at that size
+      // whatever the order in which changes are notified
+      void notify( state& s, bool changed )
+      {
+        if( !changed ) {
+
+          return;
+        }
+
+        boost::lock_guard<boost::mutex> guard( s.notify_mutex );
+
+        cache_handler handler;
+        boost::uint64_t size;
+
+        {
+          boost::lock_guard<boost::mutex> lock( s.mutex );
+          handler = s.handler;
+          size = s.cache;
+        }
+
+        if( handler ) {
+
+          handler( size );
+        }
+      }
+
+    }
+
+    void set_limit( const boost::uint64_t& bytes )
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+      s.limit = bytes;
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+    }
+
+    boost::uint64_t get_limit()
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      return s.limit;
+    }
+
+    void set_cache_fraction( double fraction )
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+      s.fraction = std::min( std::max( fraction, 0.0 ), 1.0 );
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+    }
+
+    void set_cache_handler( const cache_handler& handler )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      s.handler = handler;
+      s.cache = 0;
+    }
+
+    usage get_usage()
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      usage u = { s.limit, s.heap, s.mapped, s.peak_heap, s.peak,
+                  s.cache, s.clients };
+      return u;
+    }
+
+    bool place( const boost::uint64_t& bytes, bool prefer_mapped )
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+
+      bool mapped( prefer_mapped );
+
+      if( s.limit ) {
+
+        boost::uint64_t reserved( s.clients ? cache_share( s ) : 0 );
+        boost::uint64_t available(
+          s.limit > reserved + s.heap ? s.limit - reserved - s.heap : 0
+        );
+
+        mapped = ( bytes > available );
+      }
+
+      if( mapped ) {
+
+        s.mapped += bytes;
+
+      } else {
+
+        s.heap += bytes;
+        s.peak_heap = std::max( s.peak_heap, s.heap );
+      }
+
+      s.peak = std::max( s.peak, s.heap + s.mapped );
+
+      // the cache shrinks to what the bands leave of the limit
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+
+      return mapped;
+    }
+
+    void attach( const boost::uint64_t& bytes )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      s.mapped += bytes;
+      s.peak = std::max( s.peak, s.heap + s.mapped );
+    }
+
+    void release( const boost::uint64_t& bytes, bool mapped )
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+
+      boost::uint64_t& used( mapped ? s.mapped : s.heap );
+      used -= std::min( used, bytes );
+
+      // and grows back as they are released
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+    }
+
+    void register_client()
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+      ++s.clients;
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+    }
+
+    void unregister_client()
+    {
+      state& s( get_state() );
+      boost::unique_lock<boost::mutex> lock( s.mutex );
+
+      if( s.clients > 0 ) {
+
+        --s.clients;
+      }
+
+      bool changed( update_cache( s ) );
+      lock.unlock();
+      notify( s, changed );
+    }
+
+  }
+
+}
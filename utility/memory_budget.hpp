@@ -0,0 +1,70 @@
+#ifndef UTILITY_MEMORY_BUDGET_HPP
+#define UTILITY_MEMORY_BUDGET_HPP
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+namespace utility {
+
+  // Process-wide accounting of band memory. Every mapped_memory asks it
+  // where to place its values and reports them back when released; images
+  // register as clients so the GDAL block cache can be sized to fit.
+  //
+  // Without a limit (the default) placement follows the per-array
+  // MAX_IN_MEMORY threshold. With a limit, the cache takes its share and
+  // arrays go to the heap while they fit in the rest, and are spilled to
+  // temporary file mappings otherwise. The limit can also be given in the
+  // CANVAS_MEMORY_BUDGET environment variable (bytes, or with a K, M or G
+  // suffix).
+  namespace memory_budget {
+
+    typedef boost::function<void( const boost::uint64_t& )> cache_handler;
+
+    struct usage {
+
+      boost::uint64_t limit;
+
+      boost::uint64_t heap;
+
+      boost::uint64_t mapped;
+
+      boost::uint64_t peak_heap;
+
+      boost::uint64_t peak;
+
+      boost::uint64_t cache;
+
+      size_t clients;
+
+    };
+
+    void set_limit( const boost::uint64_t& bytes );
+
+    boost::uint64_t get_limit();
+
+    // share of the limit given to the GDAL block cache (0.25 by default)
+    void set_cache_fraction( double fraction );
+
+    // called with the new cache size whenever it changes, one call at a
+    // time and never with the lock of the budget held
+    void set_cache_handler( const cache_handler& handler );
+
+    usage get_usage();
+
+    // registers bytes of band memory, returns true if they must be mapped
+    bool place( const boost::uint64_t& bytes, bool prefer_mapped );
+
+    // registers bytes mapped from an existing file
+    void attach( const boost::uint64_t& bytes );
+
+    void release( const boost::uint64_t& bytes, bool mapped );
+
+    void register_client();
+
+    void unregister_client();
+
+  }
+
+}
+
+#endif
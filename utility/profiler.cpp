@@ -0,0 +1,319 @@
+#include <utility/profiler.hpp>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace utility {
+
+  namespace profiler {
+
+    namespace {
+
+      // trace events kept before new ones are dropped (about 64 MiB)
+      const size_t MAX_EVENTS = 1048576;
+
+      struct event {
+
+        const char* name;
+
+        boost::int64_t start;
+
+        boost::int64_t duration;
+
+        unsigned long thread;
+
+        boost::int64_t bytes;
+
+      };
+
+      struct operation {
+
+        operation() : calls( 0 ), nanoseconds( 0 ), faults( 0 )
+        {
+        }
+
+        boost::int64_t calls;
+
+        boost::int64_t nanoseconds;
+
+        boost::int64_t faults;
+
+      };
+
+      struct state {
+
+        state() : tracing( false ), dropped( 0 )
+        {
+          std::fill_n( counters, static_cast<size_t>( COUNTERS ), 0 );
+          origin = now();
+        }
+
+        boost::mutex mutex;
+
+        boost::int64_t counters[COUNTERS];
+
+        std::map<std::string,operation> operations;
+
+        std::vector<event> events;
+
+        bool tracing;
+
+        boost::int64_t dropped;
+
+        boost::int64_t origin;
+
+      };
+
+      state& get_state()
+      {
+        static state s;
+        return s;
+      }
+
+      long thread_faults()
+      {
+        struct rusage usage;
+#ifdef RUSAGE_THREAD
+        getrusage( RUSAGE_THREAD, &usage );
+#else
+        getrusage( RUSAGE_SELF, &usage );
+#endif
+        return usage.ru_majflt + usage.ru_minflt;
+      }
+
+      unsigned long thread_id()
+      {
+        return static_cast<unsigned long>( pthread_self() ) % 1000000007UL;
+      }
+
+      void push( state& s, const char* name, const boost::int64_t& start,
+                 const boost::int64_t& duration, const boost::int64_t& bytes )
+      {
+        if( !s.tracing ) {
+
+          return;
+        }
+
+        if( s.events.size() == MAX_EVENTS ) {
+
+          ++s.dropped;
+          return;
+        }
+
+        event e = { name, start, duration, thread_id(), bytes };
+        s.events.push_back( e );
+      }
+
+      bool from_environment()
+      {
+        const char* value( getenv( "CANVAS_PROFILE" ) );
+        return value && *value && ( std::string( value ) != "0" );
+      }
+
+    }
+
+    volatile bool active( from_environment() );
+
+    void enable( bool on, bool trace )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      s.tracing = on && trace;
+      active = on;
+    }
+
+    void reset()
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      // live band memory stays accounted for
+      boost::int64_t resident( s.counters[RESIDENT_BYTES] );
+
+      std::fill_n( s.counters, static_cast<size_t>( COUNTERS ), 0 );
+      s.counters[RESIDENT_BYTES] = resident;
+      s.counters[PEAK_RESIDENT_BYTES] = resident;
+
+      s.operations.clear();
+      s.events.clear();
+      s.dropped = 0;
+      s.origin = now();
+    }
+
+    boost::int64_t now()
+    {
+      struct timespec t;
+      clock_gettime( CLOCK_MONOTONIC, &t );
+      return static_cast<boost::int64_t>( t.tv_sec ) * 1000000000LL
+           + t.tv_nsec;
+    }
+
+    boost::int64_t get( counter c )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      return s.counters[c];
+    }
+
+    void add( counter c, const boost::int64_t& value )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      s.counters[c] += value;
+    }
+
+    void allocated( const boost::uint64_t& bytes, bool mapped )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      s.counters[mapped ? MAPPED_ALLOCATIONS : HEAP_ALLOCATIONS] += 1;
+      s.counters[mapped ? MAPPED_BYTES : HEAP_BYTES] += bytes;
+      s.counters[RESIDENT_BYTES] += bytes;
+
+      if( s.counters[RESIDENT_BYTES] > s.counters[PEAK_RESIDENT_BYTES] ) {
+
+        s.counters[PEAK_RESIDENT_BYTES] = s.counters[RESIDENT_BYTES];
+      }
+    }
+
+    void released( const boost::uint64_t& bytes )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+      s.counters[RESIDENT_BYTES] -= bytes;
+    }
+
+    void raster_io( const boost::int64_t& start, const boost::uint64_t& bytes,
+                    bool write )
+    {
+      boost::int64_t end( now() );
+
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      s.counters[RASTER_IO_CALLS] += 1;
+      s.counters[RASTER_IO_BYTES] += bytes;
+      s.counters[GDAL_NANOSECONDS] += end - start;
+
+      push( s, write ? "RasterIO write" : "RasterIO read", start,
+            end - start, bytes );
+    }
+
+    void record( const char* name, const boost::int64_t& start,
+                 const boost::int64_t& end, const long& faults )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      operation& op( s.operations[name] );
+      op.calls += 1;
+      op.nanoseconds += end - start;
+      op.faults += faults;
+
+      push( s, name, start, end - start, -1 );
+    }
+
+    void write_json( std::ostream& out )
+    {
+      static const char* names[] = {
+        "raster_io_calls", "raster_io_bytes", "gdal_ns",
+        "heap_allocations", "heap_bytes", "mapped_allocations",
+        "mapped_bytes", "resident_bytes", "peak_resident_bytes"
+      };
+
+      struct rusage usage;
+      getrusage( RUSAGE_SELF, &usage );
+
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      out << "{\n  \"counters\": {";
+
+      for( size_t c = 0; c < COUNTERS; ++c ) {
+
+        out << ( c ? ",\n" : "\n" ) << "    \"" << names[c] << "\": "
+            << s.counters[c];
+      }
+
+      out << "\n  },\n  \"page_faults\": { \"minor\": " << usage.ru_minflt
+          << ", \"major\": " << usage.ru_majflt << " },\n"
+          << "  \"operations\": {";
+
+      std::map<std::string,operation>::const_iterator it;
+
+      for( it = s.operations.begin(); it != s.operations.end(); ++it ) {
+
+        out << ( it == s.operations.begin() ? "\n" : ",\n" )
+            << "    \"" << it->first << "\": { \"calls\": " << it->second.calls
+            << ", \"ns\": " << it->second.nanoseconds
+            << ", \"page_faults\": " << it->second.faults << " }";
+      }
+
+      out << "\n  },\n  \"dropped_events\": " << s.dropped << "\n}\n";
+    }
+
+    void write_trace( std::ostream& out )
+    {
+      state& s( get_state() );
+      boost::lock_guard<boost::mutex> lock( s.mutex );
+
+      int pid( getpid() );
+
+      out << "{\"traceEvents\":[";
+
+      char buffer[64];
+
+      for( size_t n = 0; n < s.events.size(); ++n ) {
+
+        const event& e( s.events[n] );
+
+        snprintf( buffer, sizeof( buffer ), "%.3f,\"dur\":%.3f",
+                  ( e.start - s.origin ) * 1e-3, e.duration * 1e-3 );
+
+        out << ( n ? ",\n" : "\n" )
+            << "{\"name\":\"" << e.name << "\",\"cat\":\""
+            << ( e.bytes >= 0 ? "gdal" : "canvas" )
+            << "\",\"ph\":\"X\",\"ts\":" << buffer
+            << ",\"pid\":" << pid << ",\"tid\":" << e.thread;
+
+        if( e.bytes >= 0 ) {
+
+          out << ",\"args\":{\"bytes\":" << e.bytes << "}";
+        }
+
+        out << "}";
+      }
+
+      out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    void scope::begin( const char* name )
+    {
+      name_ = name;
+      faults_ = thread_faults();
+      start_ = now();
+    }
+
+    void scope::end()
+    {
+      boost::int64_t finish( now() );
+      record( name_, start_, finish, thread_faults() - faults_ );
+    }
+
+  }
+
+}
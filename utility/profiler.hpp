@@ -0,0 +1,104 @@
+#ifndef UTILITY_PROFILER_HPP
+#define UTILITY_PROFILER_HPP
+
+#include <boost/cstdint.hpp>
+
+#include <iostream>
+
+namespace utility {
+
+  // Opt-in process-wide instrumentation. Everything is a no-op apart from a
+  // flag test until enable() is called (or CANVAS_PROFILE is set in the
+  // environment when the library is loaded).
+  namespace profiler {
+
+    enum counter {
+      RASTER_IO_CALLS=0,
+      RASTER_IO_BYTES=1,
+      GDAL_NANOSECONDS=2,
+      HEAP_ALLOCATIONS=3,
+      HEAP_BYTES=4,
+      MAPPED_ALLOCATIONS=5,
+      MAPPED_BYTES=6,
+      RESIDENT_BYTES=7,
+      PEAK_RESIDENT_BYTES=8,
+      COUNTERS=9
+    };
+
+    extern volatile bool active;
+
+    inline bool enabled()
+    {
+      return active;
+    }
+
+    void enable( bool on = true, bool trace = true );
+
+    void reset();
+
+    boost::int64_t now();
+
+    boost::int64_t get( counter c );
+
+    void add( counter c, const boost::int64_t& value );
+
+    // band memory coming and going, tracked for the peak resident size
+    void allocated( const boost::uint64_t& bytes, bool mapped );
+
+    void released( const boost::uint64_t& bytes );
+
+    // a RasterIO call that started at start (as returned by now())
+    void raster_io( const boost::int64_t& start, const boost::uint64_t& bytes,
+                    bool write );
+
+    void record( const char* name, const boost::int64_t& start,
+                 const boost::int64_t& end, const long& faults );
+
+    // JSON object with counters, per operation times and page faults
+    void write_json( std::ostream& out );
+
+    // Chrome trace event format (chrome://tracing, Perfetto)
+    void write_trace( std::ostream& out );
+
+    // times the enclosing block as one operation
+    class scope {
+
+    public:
+      explicit scope( const char* name ) : name_( 0 )
+      {
+        if( enabled() ) {
+
+          begin( name );
+        }
+      }
+
+      ~scope()
+      {
+        if( name_ ) {
+
+          end();
+        }
+      }
+
+    private:
+      scope( const scope& );
+
+      scope& operator=( const scope& );
+
+      void begin( const char* name );
+
+      void end();
+
+      const char* name_;
+
+      boost::int64_t start_;
+
+      long faults_;
+
+    };
+
+  }
+
+}
+
+#endif
@@ -0,0 +1,395 @@
+#include <utility/thread_pool.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace utility {
+
+  namespace {
+
+    // how long a waiting thread sleeps before looking for tasks again
+    const long WAIT_MILLISECONDS = 1;
+
+    struct worker_id {
+
+      const thread_pool* pool;
+
+      size_t index;
+
+    };
+
+    // set on the threads of every pool
+    boost::thread_specific_ptr<worker_id> current_worker;
+
+    struct global_state {
+
+      global_state() : threads( from_environment() )
+      {
+      }
+
+      static size_t from_environment()
+      {
+        const char* value( getenv( "CANVAS_THREADS" ) );
+
+        if( !value || !*value ) {
+
+          return 0;
+        }
+
+        long threads( strtol( value, 0, 10 ) );
+
+        return ( threads > 0 ) ? static_cast<size_t>( threads ) : 0;
+      }
+
+      size_t get_threads() const
+      {
+        return threads ? threads
+          : std::max( boost::thread::hardware_concurrency(), 1U );
+      }
+
+      boost::mutex mutex;
+
+      // 0 for the hardware concurrency
+      size_t threads;
+
+      boost::shared_ptr<thread_pool> pool;
+
+    };
+
+    global_state& get_global()
+    {
+      static global_state s;
+      return s;
+    }
+
+    // shared by the threads of parallel_for
+    struct range_job {
+
+      const thread_pool::range_task* f;
+
+      size_t next;
+
+      size_t last;
+
+      size_t grain;
+
+      boost::mutex mutex;
+
+    };
+
+    void run_ranges( range_job* j )
+    {
+      for( ;; ) {
+
+        size_t first, last;
+
+        {
+          boost::lock_guard<boost::mutex> lock( j->mutex );
+
+          if( j->next >= j->last ) {
+
+            return;
+          }
+
+          first = j->next;
+          last = std::min( first + j->grain, j->last );
+          j->next = last;
+        }
+
+        ( *j->f )( first, last );
+      }
+    }
+
+  }
+
+  thread_pool::group::group( thread_pool& pool )
+    : pool_( pool ), pending_( 0 )
+  {
+  }
+
+  thread_pool::group::~group()
+  {
+    wait();
+  }
+
+  void thread_pool::group::run( const task& t )
+  {
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      ++pending_;
+    }
+
+    pool_.submit( boost::bind( &group::execute, this, t ) );
+  }
+
+  void thread_pool::group::wait()
+  {
+    size_t index( pool_.get_index() );
+
+    for( ;; ) {
+
+      {
+        boost::lock_guard<boost::mutex> lock( mutex_ );
+
+        if( !pending_ ) {
+
+          return;
+        }
+      }
+
+      if( pool_.run_one( index ) ) {
+
+        continue;
+      }
+
+      // the tasks left are running on other threads
+      boost::unique_lock<boost::mutex> lock( mutex_ );
+
+      if( pending_ ) {
+
+        done_.timed_wait( lock,
+          boost::posix_time::milliseconds( WAIT_MILLISECONDS ) );
+      }
+    }
+  }
+
+  void thread_pool::group::execute( const task& t )
+  {
+    t();
+
+    boost::lock_guard<boost::mutex> lock( mutex_ );
+
+    if( !--pending_ ) {
+
+      done_.notify_all();
+    }
+  }
+
+  thread_pool::thread_pool( size_t workers )
+    : queued_( 0 ), next_( 0 ), stop_( false )
+  {
+    // a pool without workers keeps one queue for its waiting threads
+    for( size_t k = 0; k < std::max( workers, static_cast<size_t>( 1 ) );
+         ++k ) {
+
+      queues_.push_back( boost::shared_ptr<queue>( new queue() ) );
+    }
+
+    for( size_t k = 0; k < workers; ++k ) {
+
+      threads_.create_thread( boost::bind( &thread_pool::work, this, k ) );
+    }
+  }
+
+  thread_pool::~thread_pool()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      stop_ = true;
+    }
+
+    wake_.notify_all();
+    threads_.join_all();
+
+    while( run_one( queues_.size() ) ) {
+    }
+  }
+
+  size_t thread_pool::get_workers() const
+  {
+    return threads_.size();
+  }
+
+  void thread_pool::parallel_for( size_t first, size_t last, size_t grain,
+                                  const range_task& f, size_t threads )
+  {
+    if( first >= last ) {
+
+      return;
+    }
+
+    range_job j;
+    j.f = &f;
+    j.next = first;
+    j.last = last;
+    j.grain = std::max( grain, static_cast<size_t>( 1 ) );
+
+    size_t ranges( ( last - first + j.grain - 1 ) / j.grain );
+
+    if( threads == 0 ) {
+
+      threads = get_workers() + 1;
+    }
+
+    run( boost::bind( &run_ranges, &j ), std::min( threads, ranges ) );
+  }
+
+  void thread_pool::run( const task& f, size_t threads )
+  {
+    if( threads <= 1 ) {
+
+      f();
+      return;
+    }
+
+    group g( *this );
+
+    for( size_t t = 1; t < threads; ++t ) {
+
+      g.run( f );
+    }
+
+    f();
+    g.wait();
+  }
+
+  thread_pool& thread_pool::global()
+  {
+    global_state& s( get_global() );
+    boost::lock_guard<boost::mutex> lock( s.mutex );
+
+    if( !s.pool ) {
+
+      // the waiting thread is the last of them
+      s.pool.reset( new thread_pool( s.get_threads() - 1 ) );
+    }
+
+    return *s.pool;
+  }
+
+  void thread_pool::set_threads( size_t threads )
+  {
+    global_state& s( get_global() );
+    boost::lock_guard<boost::mutex> lock( s.mutex );
+
+    s.threads = threads ? threads : global_state::from_environment();
+    s.pool.reset();
+  }
+
+  size_t thread_pool::get_threads()
+  {
+    global_state& s( get_global() );
+    boost::lock_guard<boost::mutex> lock( s.mutex );
+
+    return s.get_threads();
+  }
+
+  size_t thread_pool::get_threads( size_t threads, size_t tasks )
+  {
+    if( threads == 0 ) {
+
+      threads = get_threads();
+    }
+
+    return std::max( std::min( threads, tasks ), static_cast<size_t>( 1 ) );
+  }
+
+  void thread_pool::submit( const task& t )
+  {
+    size_t index( get_index() );
+
+    if( index >= queues_.size() ) {
+
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      index = next_++ % queues_.size();
+    }
+
+    {
+      boost::lock_guard<boost::mutex> lock( queues_[index]->mutex );
+      queues_[index]->tasks.push_back( t );
+    }
+
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      ++queued_;
+    }
+
+    wake_.notify_one();
+  }
+
+  bool thread_pool::run_one( size_t index )
+  {
+    size_t n( queues_.size() );
+    task t;
+
+    // the newest task of the own queue
+    if( index < n ) {
+
+      queue& q( *queues_[index] );
+      boost::lock_guard<boost::mutex> lock( q.mutex );
+
+      if( !q.tasks.empty() ) {
+
+        t = q.tasks.back();
+        q.tasks.pop_back();
+      }
+    }
+
+    // or the oldest of another
+    for( size_t k = 1; !t && ( k <= n ); ++k ) {
+
+      queue& q( *queues_[( index + k ) % n] );
+      boost::lock_guard<boost::mutex> lock( q.mutex );
+
+      if( !q.tasks.empty() ) {
+
+        t = q.tasks.front();
+        q.tasks.pop_front();
+      }
+    }
+
+    if( !t ) {
+
+      return false;
+    }
+
+    {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      --queued_;
+    }
+
+    t();
+
+    return true;
+  }
+
+  size_t thread_pool::get_index() const
+  {
+    worker_id* id( current_worker.get() );
+
+    return ( id && ( id->pool == this ) ) ? id->index : queues_.size();
+  }
+
+  void thread_pool::work( size_t index )
+  {
+    worker_id* id( new worker_id );
+    id->pool = this;
+    id->index = index;
+    current_worker.reset( id );
+
+    for( ;; ) {
+
+      if( run_one( index ) ) {
+
+        continue;
+      }
+
+      boost::unique_lock<boost::mutex> lock( mutex_ );
+
+      while( !stop_ && ( queued_ <= 0 ) ) {
+
+        wake_.wait( lock );
+      }
+
+      if( stop_ && ( queued_ <= 0 ) ) {
+
+        return;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,130 @@
+#ifndef UTILITY_THREAD_POOL_HPP
+#define UTILITY_THREAD_POOL_HPP
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include <deque>
+#include <vector>
+
+namespace utility {
+
+  // Worker threads started once and shared by the parallel operations, so
+  // that nested and concurrent operations do not each start their own.
+  //
+  // Every worker has its own queue: tasks submitted from a worker go to
+  // its queue and are taken back newest first, while idle workers steal
+  // the oldest tasks of the others. Threads waiting for a group run queued
+  // tasks meanwhile, so that a pool without workers runs everything on the
+  // calling thread and nested groups cannot deadlock.
+  //
+  // The global pool runs get_threads() threads at once, counting the
+  // thread that waits: set_threads() or the CANVAS_THREADS environment
+  // variable, and the hardware concurrency otherwise.
+  class thread_pool : private boost::noncopyable {
+
+  public:
+    typedef boost::function<void()> task;
+
+    // indices [first, last) of a range
+    typedef boost::function<void( size_t, size_t )> range_task;
+
+    // tasks that are waited for together
+    class group : private boost::noncopyable {
+
+    public:
+      explicit group( thread_pool& pool );
+
+      // waits for the tasks still running
+      ~group();
+
+      void run( const task& t );
+
+      void wait();
+
+    private:
+      void execute( const task& t );
+
+      thread_pool& pool_;
+
+      size_t pending_;
+
+      boost::mutex mutex_;
+
+      boost::condition_variable done_;
+
+    };
+
+    explicit thread_pool( size_t workers );
+
+    // runs the tasks still queued, then stops the workers
+    ~thread_pool();
+
+    size_t get_workers() const;
+
+    // f on consecutive ranges of at most grain indices of [first, last),
+    // from at most threads threads at once (0 for every worker and the
+    // calling thread)
+    void parallel_for( size_t first, size_t last, size_t grain,
+                       const range_task& f, size_t threads = 0 );
+
+    // f from threads threads at once, the calling thread among them, for
+    // functions that take their share of a job themselves
+    void run( const task& f, size_t threads );
+
+    static thread_pool& global();
+
+    // threads of the global pool, 0 for the default; the pool is restarted
+    // and must not be in use
+    static void set_threads( size_t threads );
+
+    static size_t get_threads();
+
+    // threads for a job of tasks parts when threads are asked for, 0 for
+    // get_threads()
+    static size_t get_threads( size_t threads, size_t tasks );
+
+  private:
+    struct queue {
+
+      boost::mutex mutex;
+
+      std::deque<task> tasks;
+
+    };
+
+    void submit( const task& t );
+
+    // runs a queued task, from queue index first; false if there was none
+    bool run_one( size_t index );
+
+    // the queue of the calling thread, get_workers() for other threads
+    size_t get_index() const;
+
+    void work( size_t index );
+
+    std::vector<boost::shared_ptr<queue> > queues_;
+
+    boost::thread_group threads_;
+
+    boost::mutex mutex_;
+
+    boost::condition_variable wake_;
+
+    // tasks in the queues, below 0 while a pop overtakes its push
+    long queued_;
+
+    // external submissions spread over the queues
+    size_t next_;
+
+    bool stop_;
+
+  };
+
+}
+
+#endif